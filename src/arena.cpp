@@ -0,0 +1,172 @@
+#include <string.h>
+#include "multiarray.h"
+
+/* Arenas hand out memory from large chunks by bumping a pointer, and give it all back at
+once in md_arena_reset. The chunks are kept across resets, so a request loop that resets
+its arena allocates from the C heap only until the arena has grown to its working size. */
+
+//Every arena allocation is rounded to this many bytes.
+#define MD_ARENA_GRAIN 16
+
+struct _md_chunk {
+	struct _md_chunk* next;
+	size_t size, used;
+};
+
+struct MD_ARENA {
+	struct _md_chunk* first;
+	struct _md_chunk* current;
+	size_t chunk_size;
+};
+
+#define MD_CHUNK_HEADER ((sizeof(struct _md_chunk) + MD_ARENA_GRAIN - 1) & ~(size_t)(MD_ARENA_GRAIN - 1))
+#define _md_chunk_data(C) ((char*)(C) + MD_CHUNK_HEADER)
+
+/* Accepts:
+  * chunk_size - The size of the blocks the arena takes from the C heap; 0 picks 1MB.
+Returns: A new, empty arena.*/
+struct MD_ARENA* md_arena_create(size_t chunk_size) {
+	struct MD_ARENA* arena = (struct MD_ARENA*)malloc(sizeof(struct MD_ARENA));
+
+	if (!arena) {
+		fputs("md_arena_create: allocation failed", stderr);
+		throw MULTIARRAY_EX();
+	}
+	arena->first = arena->current = NULL;
+	arena->chunk_size = chunk_size ? chunk_size : 1 << 20;
+	return(arena);
+}
+
+/* Accepts:
+  * arena - An arena.
+Purpose: Releases every array allocated in the arena at once. The arena's memory is kept
+for the allocations that follow.
+Note: Arrays allocated in the arena must not be used after the reset.*/
+void md_arena_reset(struct MD_ARENA* arena) {
+	struct _md_chunk* p;
+
+	for (p=arena->first;p;p=p->next) p->used = 0;
+	arena->current = arena->first;
+}
+
+/* Accepts:
+  * arena - An arena.
+Purpose: Releases every array allocated in the arena, and the arena itself.*/
+void md_arena_destroy(struct MD_ARENA* arena) {
+	struct _md_chunk *p, *next;
+
+	if (!arena) return;
+	for (p=arena->first;p;p=next) {
+		next = p->next;
+		free(p);
+	}
+	free(arena);
+}
+
+//Returns: bytes of zeroed memory from the arena.
+void* _md_arena_take(struct MD_ARENA* arena, size_t bytes) {
+	struct _md_chunk *p, *fresh;
+	size_t size;
+	char* result;
+
+	bytes = (bytes + MD_ARENA_GRAIN - 1) & ~(size_t)(MD_ARENA_GRAIN - 1);
+	//After a reset the chunks are refilled in order.
+	for (p=arena->current;p;p=p->next) {
+		if (p->size - p->used >= bytes) break;
+	}
+	if (!p) {
+		size = bytes > arena->chunk_size ? bytes : arena->chunk_size;
+		fresh = (struct _md_chunk*)malloc(MD_CHUNK_HEADER + size);
+		if (!fresh) {
+			fputs("md_alloc_in: arena allocation failed", stderr);
+			throw MULTIARRAY_EX();
+		}
+		fresh->size = size;
+		fresh->used = 0;
+		if (arena->current) {
+			fresh->next = arena->current->next;
+			arena->current->next = fresh;
+		} else {
+			fresh->next = arena->first;
+			arena->first = fresh;
+		}
+		p = fresh;
+	}
+	arena->current = p;
+	result = _md_chunk_data(p) + p->used;
+	p->used += bytes;
+	memset(result, 0, bytes);
+	return(result);
+}
+
+/* Small arrays on the default path come from per-thread free lists, one per power-of-two
+size class, instead of from calloc. A freed block goes onto the list of the thread that
+frees it; lists are capped at MD_POOL_DEPTH blocks and the excess goes back to the heap. */
+
+#define MD_POOL_MIN_SHIFT 6 //64 bytes
+#define MD_POOL_CLASSES 8 //up to 8KB
+#define MD_POOL_DEPTH 256
+
+struct _md_pool {
+	void* heads[MD_POOL_CLASSES];
+	unsigned int counts[MD_POOL_CLASSES];
+
+	~_md_pool() {
+		unsigned int c;
+		void* p;
+
+		for (c=0;c<MD_POOL_CLASSES;c++) {
+			while ((p = heads[c])) {
+				heads[c] = *(void**)p;
+				free(p);
+			}
+		}
+	}
+};
+
+static thread_local struct _md_pool pool;
+
+static inline int _md_pool_class(size_t bytes) {
+	int c = 0;
+
+	while (((size_t)1 << (c + MD_POOL_MIN_SHIFT)) < bytes) c++;
+	return c < MD_POOL_CLASSES ? c : -1;
+}
+
+/* Accepts:
+  * bytes - The number of bytes needed.
+  * p_block_size - Receives the size of the block returned.
+Returns: A block with its first bytes zeroed, or NULL if bytes is too large for the pools.*/
+void* _md_pool_take(size_t bytes, size_t* p_block_size) {
+	int c = _md_pool_class(bytes);
+	void* p;
+
+	if (c < 0) return(NULL);
+	*p_block_size = (size_t)1 << (c + MD_POOL_MIN_SHIFT);
+	p = pool.heads[c];
+	if (p) {
+		pool.heads[c] = *(void**)p;
+		pool.counts[c]--;
+		memset(p, 0, bytes);
+		return(p);
+	}
+	p = calloc(*p_block_size, 1);
+	if (!p) {
+		fputs("md_alloc: array allocation failed", stderr);
+		throw MULTIARRAY_EX();
+	}
+	return(p);
+}
+
+//Returns a block obtained from _md_pool_take.
+void _md_pool_give(void* p, size_t block_size) {
+	int c = _md_pool_class(block_size);
+
+	if (pool.counts[c] >= MD_POOL_DEPTH) {
+		free(p);
+		return;
+	}
+	*(void**)p = pool.heads[c];
+	pool.heads[c] = p;
+	pool.counts[c]++;
+}
@@ -0,0 +1,70 @@
+#include "md_arith.h"
+#include "md_parallel.h"
+
+/* Both operands are broadcast to the shape of the result as views, and md_zip walks the
+three of them together. Rows along which an operand is repeated have a step of 0, which
+md_zip runs as a loop over one register-held value. */
+
+template <typename T>
+struct MD_ARRAY* md_binary(ARRAYLIKE a, ARRAYLIKE b, unsigned int op, ARRAYLIKE out) {
+	size_t dims[MAX_DIMENSIONS];
+	unsigned int n_dims;
+	struct MD_ARRAY* result = NULL;
+	struct MD_VIEW va, vb;
+
+	if (op > MD_MAXIMUM) {
+		fputs("md_binary: unknown operation", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (out) {
+		n_dims = md_shape(out, dims);
+	} else {
+		n_dims = md_broadcast_shape(a, b, dims);
+		out = result = _md_alloc(dims, n_dims, sizeof(T));
+	}
+	va = md_broadcast_to(a, n_dims, dims);
+	vb = md_broadcast_to(b, n_dims, dims);
+	try {
+		switch (op) {
+		case MD_ADD:
+			md_zip<T, T, T>(out, &va, &vb, [](T x, T y) { return (T)(x + y); });
+			break;
+		case MD_SUB:
+			md_zip<T, T, T>(out, &va, &vb, [](T x, T y) { return (T)(x - y); });
+			break;
+		case MD_MUL:
+			md_zip<T, T, T>(out, &va, &vb, [](T x, T y) { return (T)(x * y); });
+			break;
+		case MD_DIV:
+			md_zip<T, T, T>(out, &va, &vb, [](T x, T y) { return (T)(x / y); });
+			break;
+		case MD_MINIMUM:
+			md_zip<T, T, T>(out, &va, &vb, [](T x, T y) { return y < x ? y : x; });
+			break;
+		case MD_MAXIMUM:
+			md_zip<T, T, T>(out, &va, &vb, [](T x, T y) { return y > x ? y : x; });
+			break;
+		}
+	} catch (...) {
+		if (result) md_free(result);
+		throw;
+	}
+	return result;
+}
+
+#define MD_ARITH_INSTANTIATE(T) \
+	template struct MD_ARRAY* md_binary<T>(ARRAYLIKE a, ARRAYLIKE b, unsigned int op, ARRAYLIKE out);
+
+MD_ARITH_INSTANTIATE(char)
+MD_ARITH_INSTANTIATE(signed char)
+MD_ARITH_INSTANTIATE(unsigned char)
+MD_ARITH_INSTANTIATE(short)
+MD_ARITH_INSTANTIATE(unsigned short)
+MD_ARITH_INSTANTIATE(int)
+MD_ARITH_INSTANTIATE(unsigned int)
+MD_ARITH_INSTANTIATE(long)
+MD_ARITH_INSTANTIATE(unsigned long)
+MD_ARITH_INSTANTIATE(long long)
+MD_ARITH_INSTANTIATE(unsigned long long)
+MD_ARITH_INSTANTIATE(float)
+MD_ARITH_INSTANTIATE(double)
@@ -0,0 +1,796 @@
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include "multiarray.h"
+#include "md_iter.h"
+#include "md_reduce.h"
+#include "md_arith.h"
+#include "md_expr.h"
+#include "md_matmul.h"
+#include "md_sparse.h"
+#include "md_columns.h"
+#include "md_stencil.h"
+#include "md_chunked.h"
+#include "serialize.h"
+
+/* Benchmarks of the library's hot paths: indexing, iteration, reductions, broadcast
+arithmetic, fused expressions, matrix products, sparse traversal, columnar scans, member lookups, serialization, storage layouts, stencils, chunked streaming, allocation, resizing and transposition.
+Every case is run for at least MD_BENCH_MIN_NS, several times over, and the fastest run is
+reported. The results are written as one JSON document, to stdout or to the file named on
+the command line, so that runs of different versions can be compared by a script.
+
+Usage: md_bench [output.json] [name filter]*/
+
+#define MD_BENCH_MIN_NS 50000000.0 //50ms
+#define MD_BENCH_RUNS 3
+
+struct md_bench_result {
+	const char* name;
+	char params[128];
+	double ns_per_op;
+	double bytes_per_op;
+	unsigned long long ops;
+};
+
+static FILE* out;
+static const char* filter;
+static unsigned int n_results = 0;
+static volatile size_t sink;
+
+static double _md_now_ns() {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void _md_report(const struct md_bench_result* r) {
+	fprintf(out, "%s\n    {\"name\": \"%s\", \"params\": {%s}, \"ops\": %llu, \"ns_per_op\": %.3f, \"gb_per_s\": %.3f}",
+		n_results++ ? "," : "", r->name, r->params, r->ops, r->ns_per_op,
+		r->ns_per_op > 0 ? r->bytes_per_op / r->ns_per_op : 0.0);
+	fflush(out);
+}
+
+/* Accepts:
+  * name - The name of the case.
+  * bytes_per_op - The bytes one operation reads or writes, for the GB/s figure.
+  * body - Called as body(n) to perform n operations; returns how many it performed.
+Purpose: Times body with a growing number of operations until a run takes long enough,
+then keeps the best of MD_BENCH_RUNS runs of that size.*/
+template <typename F>
+static void _md_bench(const char* name, const char* params, double bytes_per_op, F body) {
+	struct md_bench_result r;
+	unsigned long long n = 1, done;
+	double t, best = 0;
+	unsigned int run;
+
+	if (filter && !strstr(name, filter)) return;
+	for (;;) {
+		t = _md_now_ns();
+		done = body(n);
+		t = _md_now_ns() - t;
+		if (t >= MD_BENCH_MIN_NS || n >= (1ULL << 40)) break;
+		n = t > 0 && MD_BENCH_MIN_NS / t < 100 ? (unsigned long long)(n * MD_BENCH_MIN_NS / t) + 1 : n * 100;
+	}
+	best = t / done;
+	for (run=1;run<MD_BENCH_RUNS;run++) {
+		t = _md_now_ns();
+		done = body(n);
+		t = (_md_now_ns() - t) / done;
+		if (t < best) best = t;
+	}
+	r.name = name;
+	snprintf(r.params, sizeof(r.params), "%s", params);
+	r.ns_per_op = best;
+	r.bytes_per_op = bytes_per_op;
+	r.ops = done;
+	_md_report(&r);
+}
+
+//A fixed sequence of pseudo-random indices, so that random order costs no more than a load.
+static unsigned int* _md_random_indices(size_t n, unsigned int bound) {
+	unsigned int* p = (unsigned int*)malloc(n * sizeof(unsigned int));
+	unsigned long long x = 88172645463325252ULL;
+	size_t i;
+
+	for (i=0;i<n;i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		p[i] = (unsigned int)(x % bound);
+	}
+	return p;
+}
+
+static void _md_bench_index() {
+	static unsigned int dims2[] = {1024, 1024};
+	static unsigned int dims3[] = {128, 128, 64};
+	struct MD_ARRAY* a2 = md_alloc(dims2, int);
+	struct MD_ARRAY* a3 = md_alloc(dims3, int);
+	unsigned int* rnd = _md_random_indices(1 << 20, 1 << 20);
+	char params2[64], params3[64];
+
+	snprintf(params2, sizeof(params2), "\"shape\": [%u, %u], \"type_size\": %u", dims2[0], dims2[1], (unsigned int)sizeof(int));
+	snprintf(params3, sizeof(params3), "\"shape\": [%u, %u, %u], \"type_size\": %u", dims3[0], dims3[1], dims3[2], (unsigned int)sizeof(int));
+
+	_md_bench("index/md_index/sequential", params2, sizeof(int), [&](unsigned long long n) {
+		unsigned long long k;
+		size_t s = 0;
+		for (k=0;k<n;k++) s += *(int*)md_getptr(md_index(md_index(a2, (k >> 10) & 1023), k & 1023));
+		sink = s;
+		return n;
+	});
+	_md_bench("index/md_index/random", params2, sizeof(int), [&](unsigned long long n) {
+		unsigned long long k;
+		size_t s = 0;
+		unsigned int r;
+		for (k=0;k<n;k++) {
+			r = rnd[k & ((1 << 20) - 1)];
+			s += *(int*)md_getptr(md_index(md_index(a2, r >> 10), r & 1023));
+		}
+		sink = s;
+		return n;
+	});
+	_md_bench("index/md_2d/sequential", params2, sizeof(int), [&](unsigned long long n) {
+		unsigned long long k;
+		size_t s = 0;
+		for (k=0;k<n;k++) s += *md_2d(a2, (k >> 10) & 1023, k & 1023, int);
+		sink = s;
+		return n;
+	});
+	_md_bench("index/md_2d/random", params2, sizeof(int), [&](unsigned long long n) {
+		unsigned long long k;
+		size_t s = 0;
+		unsigned int r;
+		for (k=0;k<n;k++) {
+			r = rnd[k & ((1 << 20) - 1)];
+			s += *md_2d(a2, r >> 10, r & 1023, int);
+		}
+		sink = s;
+		return n;
+	});
+	_md_bench("index/md_3d/sequential", params3, sizeof(int), [&](unsigned long long n) {
+		unsigned long long k;
+		size_t s = 0;
+		for (k=0;k<n;k++) s += *md_3d(a3, (k >> 13) & 127, (k >> 6) & 127, k & 63, int);
+		sink = s;
+		return n;
+	});
+	_md_bench("index/md_3d/random", params3, sizeof(int), [&](unsigned long long n) {
+		unsigned long long k;
+		size_t s = 0;
+		unsigned int r;
+		for (k=0;k<n;k++) {
+			r = rnd[k & ((1 << 20) - 1)];
+			s += *md_3d(a3, r >> 13, (r >> 6) & 127, r & 63, int);
+		}
+		sink = s;
+		return n;
+	});
+	free(rnd);
+	md_free(a3);
+	md_free(a2);
+}
+
+static void _md_bench_iter() {
+	static unsigned int dims[] = {1024, 1024};
+	struct MD_ARRAY* a = md_alloc(dims, int);
+	struct MD_VIEW t = md_subview(a, 1, 0, 1024, 2);
+	char params[64];
+
+	snprintf(params, sizeof(params), "\"shape\": [%u, %u], \"type_size\": %u", dims[0], dims[1], (unsigned int)sizeof(int));
+
+	//One operation is one element visited.
+	_md_bench("iter/md_iter_next_run", params, sizeof(int), [&](unsigned long long n) {
+		unsigned long long k, done = 0;
+		struct MD_ITER it;
+		size_t s = 0, count, i;
+		int* p;
+		for (k=0;k<n;k+=(unsigned long long)dims[0] * dims[1]) {
+			md_iter_init(&it, a, NULL);
+			while ((p = (int*)md_iter_next_run(&it, &count))) {
+				for (i=0;i<count;i++) s += p[i];
+			}
+			done += (unsigned long long)dims[0] * dims[1];
+		}
+		sink = s;
+		return done;
+	});
+	_md_bench("iter/md_range", params, sizeof(int), [&](unsigned long long n) {
+		unsigned long long k, done = 0;
+		size_t s = 0;
+		for (k=0;k<n;k+=(unsigned long long)dims[0] * dims[1]) {
+			for (int& x : md_range<int>(a)) s += x;
+			done += (unsigned long long)dims[0] * dims[1];
+		}
+		sink = s;
+		return done;
+	});
+	_md_bench("iter/md_range/strided", params, sizeof(int), [&](unsigned long long n) {
+		unsigned long long k, done = 0;
+		size_t s = 0;
+		for (k=0;k<n;k+=(unsigned long long)dims[0] * dims[1] / 2) {
+			for (int& x : md_range<int>(&t)) s += x;
+			done += (unsigned long long)dims[0] * dims[1] / 2;
+		}
+		sink = s;
+		return done;
+	});
+	md_free(a);
+}
+
+static void _md_bench_reduce() {
+	static unsigned int dims[] = {1 << 20, 16};
+	static const unsigned int ops[] = {MD_SUM, MD_MAX, MD_ARGMAX};
+	static const char* names[][3] = {
+		{"reduce/sum/axis0", "reduce/max/axis0", "reduce/argmax/axis0"},
+		{"reduce/sum/axis1", "reduce/max/axis1", "reduce/argmax/axis1"}};
+	struct MD_ARRAY* a = md_alloc(dims, float);
+	double bytes = (double)dims[0] * dims[1] * sizeof(float);
+	unsigned int axis, i;
+	char params[64];
+	size_t k;
+
+	for (k=0;k<(size_t)dims[0]*dims[1];k++) ((float*)md_getptr(a))[k] = (float)(k % 1000);
+	snprintf(params, sizeof(params), "\"shape\": [%u, %u], \"type_size\": %u", dims[0], dims[1], (unsigned int)sizeof(float));
+
+	//One operation is one whole reduction.
+	for (axis=0;axis<2;axis++) {
+		for (i=0;i<N_ELEMS(ops);i++) {
+			_md_bench(names[axis][i], params, bytes, [&](unsigned long long n) {
+				unsigned long long j;
+				struct MD_ARRAY* r;
+				for (j=0;j<n;j++) {
+					r = md_reduce<float>(a, axis, ops[i]);
+					sink += (size_t)r->data[0];
+					md_free(r);
+				}
+				return n;
+			});
+		}
+	}
+	_md_bench("reduce/sum/all", params, bytes, [&](unsigned long long n) {
+		unsigned long long j;
+		for (j=0;j<n;j++) sink += (size_t)md_sum<float>(a);
+		return n;
+	});
+	md_free(a);
+}
+
+static void _md_bench_arith() {
+	static unsigned int dims[] = {4096, 1024}, row[] = {1024}, col[] = {4096, 1};
+	struct MD_ARRAY* a = md_alloc(dims, float);
+	struct MD_ARRAY* b = md_alloc(dims, float);
+	struct MD_ARRAY* r = md_alloc(row, float);
+	struct MD_ARRAY* c = md_alloc(col, float);
+	struct MD_ARRAY* out = md_alloc(dims, float);
+	struct MD_ARRAY* ops[] = {b, r, c};
+	static const char* names[] = {"arith/add/same_shape", "arith/add/row_vector", "arith/add/column"};
+	double bytes = (double)dims[0] * dims[1] * sizeof(float);
+	unsigned int i;
+	char params[64];
+
+	snprintf(params, sizeof(params), "\"shape\": [%u, %u], \"type_size\": %u", dims[0], dims[1], (unsigned int)sizeof(float));
+
+	//One operation is one whole add into out; the bytes are those of a and out.
+	for (i=0;i<N_ELEMS(ops);i++) {
+		_md_bench(names[i], params, 2 * bytes, [&](unsigned long long n) {
+			unsigned long long k;
+			for (k=0;k<n;k++) md_add<float>(a, ops[i], out);
+			sink += (size_t)out->data[0];
+			return n;
+		});
+	}
+	md_free(out);
+	md_free(c);
+	md_free(r);
+	md_free(b);
+	md_free(a);
+}
+
+//a*b + c*d - e, as a chain of md_arith calls and as one fused expression.
+static void _md_bench_expr() {
+	static unsigned int dims[] = {4096, 1024};
+	struct MD_ARRAY* ops[5];
+	struct MD_ARRAY* out = md_alloc(dims, float);
+	double bytes = (double)dims[0] * dims[1] * sizeof(float);
+	unsigned int i;
+	char params[64];
+
+	for (i=0;i<N_ELEMS(ops);i++) ops[i] = md_alloc(dims, float);
+	snprintf(params, sizeof(params), "\"shape\": [%u, %u], \"type_size\": %u", dims[0], dims[1], (unsigned int)sizeof(float));
+
+	//One operation is one evaluation; the bytes are the minimum of five reads and a write.
+	_md_bench("expr/chain/md_arith", params, 6 * bytes, [&](unsigned long long n) {
+		unsigned long long k;
+		struct MD_ARRAY *ab, *cd;
+		for (k=0;k<n;k++) {
+			ab = md_mul<float>(ops[0], ops[1]);
+			cd = md_mul<float>(ops[2], ops[3]);
+			md_add<float>(ab, cd, ab);
+			md_sub<float>(ab, ops[4], out);
+			md_free(cd);
+			md_free(ab);
+		}
+		sink += (size_t)out->data[0];
+		return n;
+	});
+	_md_bench("expr/fused/md_expr", params, 6 * bytes, [&](unsigned long long n) {
+		unsigned long long k;
+		for (k=0;k<n;k++) {
+			md_expr<float>(out) = md_expr<float>(ops[0]) * md_expr<float>(ops[1]) + md_expr<float>(ops[2]) * md_expr<float>(ops[3]) - md_expr<float>(ops[4]);
+		}
+		sink += (size_t)out->data[0];
+		return n;
+	});
+	for (i=0;i<N_ELEMS(ops);i++) md_free(ops[i]);
+	md_free(out);
+}
+
+static void _md_bench_matmul() {
+	static const unsigned int sizes[] = {256, 1024, 2048};
+	unsigned int i;
+	char params[64];
+
+	for (i=0;i<N_ELEMS(sizes);i++) {
+		unsigned int dims[] = {sizes[i], sizes[i]};
+		struct MD_ARRAY* a = md_alloc(dims, float);
+		struct MD_ARRAY* b = md_alloc(dims, float);
+		struct MD_ARRAY* c = md_alloc(dims, float);
+		size_t k;
+
+		for (k=0;k<(size_t)dims[0]*dims[1];k++) {
+			((float*)md_getptr(a))[k] = (float)(k % 7);
+			((float*)md_getptr(b))[k] = (float)(k % 5);
+		}
+		snprintf(params, sizeof(params), "\"n\": %u, \"type_size\": %u", sizes[i], (unsigned int)sizeof(float));
+		//One operation is one multiply-add; the figure reported as GB/s is then GFLOP/s.
+		_md_bench("matmul/float", params, 2.0, [&](unsigned long long n) {
+			unsigned long long done = 0;
+			while (done < n) {
+				md_matmul<float>(a, b, c);
+				done += (unsigned long long)dims[0] * dims[0] * dims[0];
+			}
+			sink += (size_t)c->data[0];
+			return done;
+		});
+		md_free(c);
+		md_free(b);
+		md_free(a);
+	}
+}
+
+//Summing a 2048 x 2048 grid that is 1% non-zero, densely and through CSR.
+static void _md_bench_sparse() {
+	unsigned int dims[] = {2048, 2048};
+	struct MD_ARRAY* ar = md_alloc(dims, float);
+	struct MD_SPARSE* sp;
+	size_t k, n = (size_t)dims[0] * dims[1];
+	char params[64];
+
+	for (k=0;k<n;k+=97) ((float*)md_getptr(ar))[(k * 7919) % n] = 1.0f;
+	sp = md_sparse_from_dense(ar, MD_SPARSE_CSR);
+	snprintf(params, sizeof(params), "\"n\": %u, \"nnz\": %zu", dims[0], sp->nnz);
+	_md_bench("sparse/dense_sum", params, sizeof(float), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			sink += (size_t)md_sum<float>(ar);
+			done += n;
+		}
+		return done;
+	});
+	_md_bench("sparse/csr_sum", params, sizeof(float), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			float s = 0;
+			md_sparse_for_each(sp, [&](const size_t*, void* v) { s += *(float*)v; });
+			sink += (size_t)s;
+			done += n;
+		}
+		return done;
+	});
+	md_free(sp);
+	md_free(ar);
+}
+
+//Summing one 8-byte field of 64-byte records, in place and from its column.
+static void _md_bench_columns() {
+	static const struct REFLECT definition_rec64 = {"rec64", 8, 64,
+		{&definition_double, &definition_double, &definition_double, &definition_double,
+		&definition_double, &definition_double, &definition_double, &definition_double},
+		{"v", "a", "b", "c", "d", "e", "f", "g"}, 0, {0}, {0}, {0}};
+	unsigned int dims[] = {1 << 20};
+	struct MD_ARRAY* ar = _md_alloc(dims, 1, 64);
+	struct MD_COLUMNS* cols;
+	size_t k;
+	char params[64];
+
+	for (k=0;k<dims[0];k++) *(double*)(ar->data + k * 64) = (double)(k % 10);
+	cols = md_to_columns(ar, &definition_rec64);
+	snprintf(params, sizeof(params), "\"n\": %u, \"record_size\": 64", dims[0]);
+	_md_bench("columns/aos_field_sum", params, sizeof(double), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			double s = 0;
+			for (k=0;k<dims[0];k++) s += *(const double*)(ar->data + k * 64);
+			sink += (size_t)s;
+			done += dims[0];
+		}
+		return done;
+	});
+	_md_bench("columns/column_sum", params, sizeof(double), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			sink += (size_t)md_sum<double>(md_column(cols, "v"));
+			done += dims[0];
+		}
+		return done;
+	});
+	md_free(cols);
+	md_free(ar);
+}
+
+//Looking up the last member of a 10-member record by name, through the hash table that
+//reflect_define builds and through the linear search of a plain initializer.
+static void _md_bench_reflect() {
+#define MD_BENCH_REC10_MEMBERS {&definition_double, &definition_double, &definition_double, &definition_double, \
+		&definition_double, &definition_double, &definition_double, &definition_double, &definition_double, &definition_double}
+#define MD_BENCH_REC10_NAMES {"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel", "india", "juliett"}
+	static const struct REFLECT definition_rec10_linear = {"rec10", 10, 80, MD_BENCH_REC10_MEMBERS, MD_BENCH_REC10_NAMES, 0, {0}, {0}, {0}};
+#ifdef REFLECT_INLINE_DEFINITIONS
+	static constexpr struct REFLECT definition_rec10_hashed = reflect_define("rec10", 80, MD_BENCH_REC10_MEMBERS, MD_BENCH_REC10_NAMES);
+	static const struct REFLECT* const defs[] = {&definition_rec10_linear, &definition_rec10_hashed};
+#else
+	static const struct REFLECT* const defs[] = {&definition_rec10_linear};
+#endif
+#undef MD_BENCH_REC10_MEMBERS
+#undef MD_BENCH_REC10_NAMES
+	unsigned int d;
+
+	for (d=0;d<sizeof(defs)/sizeof(defs[0]);d++) {
+		REFLECTABLE rec = _alloc(defs[d], 1, defs[d]->bytessize);
+
+		_md_bench("reflect/member_by_name", defs[d]->hashed ? "\"hashed\": true" : "\"hashed\": false", 0, [&](unsigned long long todo) {
+			unsigned long long i;
+
+			for (i=0;i<todo;i++) sink += (size_t)member_by_name(rec, "juliett", NULL);
+			return todo;
+		});
+		reflect_free(rec);
+	}
+}
+
+struct md_bench_point {
+	double x, y;
+};
+
+static const struct REFLECT definition_md_bench_point = {"md_bench_point", 2, 16, {&definition_double, &definition_double}, {"x", "y"}, 0, {0}, {0}, {0}};
+
+//Writing 64Ki records of two doubles as one message and reading them back, through a temporary file
+//and in memory. The first round trip is checked element for element.
+static void _md_bench_serialize() {
+	const size_t n = 1 << 16;
+	REFLECTABLE recs = alloc_array(md_bench_point, n), back;
+	size_t k, count, size = reflect_message_size(&definition_md_bench_point, n);
+	char* buf = (char*)malloc(size);
+	FILE* f = tmpfile();
+	char params[64];
+
+	if (!f || !buf) {
+		fputs("md_bench: no room for the serialize cases\n", stderr);
+		exit(1);
+	}
+	for (k=0;k<n;k++) {
+		((struct md_bench_point*)recs)[k].x = (double)k;
+		((struct md_bench_point*)recs)[k].y = (double)(k * 7);
+	}
+	reflect_write(f, recs);
+	rewind(f);
+	back = reflect_read(f, &definition_md_bench_point);
+	if (reflect_count(back) != n || memcmp(back, recs, n * sizeof(struct md_bench_point))) {
+		fputs("md_bench: serialize round trip differs\n", stderr);
+		exit(1);
+	}
+	reflect_free(back);
+	snprintf(params, sizeof(params), "\"n\": %zu, \"record_size\": %zu", n, sizeof(struct md_bench_point));
+	_md_bench("serialize/file_round_trip", params, 2 * sizeof(struct md_bench_point), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			rewind(f);
+			reflect_write(f, recs);
+			rewind(f);
+			back = reflect_read(f, &definition_md_bench_point);
+			sink += reflect_count(back);
+			reflect_free(back);
+			done += n;
+		}
+		return done;
+	});
+	_md_bench("serialize/memory_round_trip", params, sizeof(struct md_bench_point), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			reflect_serialize_n(&definition_md_bench_point, recs, n, buf);
+			sink += (size_t)reflect_map(buf, size, &definition_md_bench_point, &count) + count;
+			done += n;
+		}
+		return done;
+	});
+	fclose(f);
+	free(buf);
+	reflect_free(recs);
+}
+
+static void _md_bench_layout() {
+	static const unsigned int layouts[] = {MD_LAYOUT_ROW_MAJOR, MD_LAYOUT_TILED, MD_LAYOUT_MORTON};
+	static const char* names[] = {"layout/row_major_column_walk", "layout/tiled_column_walk", "layout/morton_column_walk"};
+	size_t dims[] = {2048, 2048};
+	struct MD_ARRAY* ar;
+	struct MD_ARRAY* ar2;
+	unsigned int l;
+	char params[64];
+
+	snprintf(params, sizeof(params), "\"n\": %zu, \"tile\": 16", dims[0]);
+	for (l=0;l<N_ELEMS(layouts);l++) {
+		ar = md_alloc_layout(dims, float, layouts[l], layouts[l] == MD_LAYOUT_TILED ? 16 : 0);
+		//Down the columns, the order that row-major storage serves worst.
+		_md_bench(names[l], params, sizeof(float), [&](unsigned long long todo) {
+			unsigned long long done = 0;
+			size_t i, j;
+			while (done < todo) {
+				float s = 0;
+				for (j=0;j<dims[1];j++) {
+					for (i=0;i<dims[0];i++) s += *md_2d(ar, i, j, float);
+				}
+				sink += (size_t)s;
+				done += dims[0] * dims[1];
+			}
+			return done;
+		});
+		md_free(ar);
+	}
+	ar = md_alloc(dims, float);
+	_md_bench("layout/md_relayout_tiled", params, sizeof(float), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			ar2 = md_relayout(ar, MD_LAYOUT_TILED, 16);
+			md_free(ar2);
+			done += dims[0] * dims[1];
+		}
+		return done;
+	});
+	_md_bench("layout/md_relayout_morton", params, sizeof(float), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			ar2 = md_relayout(ar, MD_LAYOUT_MORTON);
+			md_free(ar2);
+			done += dims[0] * dims[1];
+		}
+		return done;
+	});
+	md_free(ar);
+}
+
+static void _md_bench_stencil() {
+	static const double laplacian[] = {0, 1, 0, 1, -4, 1, 0, 1, 0};
+	static const double binomial[] = {0.0625, 0.25, 0.375, 0.25, 0.0625, 0.0625, 0.25, 0.375, 0.25, 0.0625};
+	size_t dims[] = {2048, 2048}, k3[] = {3, 3}, k5[] = {5, 5};
+	struct MD_ARRAY* in = md_alloc(dims, float);
+	struct MD_ARRAY* out = md_alloc(dims, float);
+	struct MD_KERNEL lap = md_kernel(2, k3, laplacian);
+	struct MD_KERNEL gauss = md_kernel(2, k5, binomial, true);
+	size_t k;
+	char params[64];
+
+	for (k=0;k<dims[0]*dims[1];k++) ((float*)in->data)[k] = (float)(k % 17);
+	snprintf(params, sizeof(params), "\"n\": %zu", dims[0]);
+	//The hand-written loop the engine replaces, with the edges left out.
+	_md_bench("stencil/md_2d_laplacian", params, 2 * sizeof(float), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		size_t i, j;
+		while (done < todo) {
+			for (i=1;i+1<dims[0];i++) {
+				for (j=1;j+1<dims[1];j++) {
+					*md_2d(out, i, j, float) = *md_2d(in, i-1, j, float) + *md_2d(in, i+1, j, float) +
+						*md_2d(in, i, j-1, float) + *md_2d(in, i, j+1, float) - 4 * *md_2d(in, i, j, float);
+				}
+			}
+			done += dims[0] * dims[1];
+		}
+		return done;
+	});
+	_md_bench("stencil/laplacian", params, 2 * sizeof(float), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			md_stencil<float>(in, out, lap, MD_BOUNDARY_CLAMP);
+			done += dims[0] * dims[1];
+		}
+		return done;
+	});
+	_md_bench("stencil/gauss5x5_separable", params, 2 * sizeof(float), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			md_stencil<float>(in, out, gauss, MD_BOUNDARY_REFLECT);
+			done += dims[0] * dims[1];
+		}
+		return done;
+	});
+	//Per element and step, 8 steps at a time, with and without temporal blocking.
+	_md_bench("stencil/laplacian_8_steps", params, 2 * sizeof(float), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			md_stencil<float>(in, out, lap, MD_BOUNDARY_CLAMP, 8, 1);
+			done += 8 * dims[0] * dims[1];
+		}
+		return done;
+	});
+	_md_bench("stencil/laplacian_8_steps_blocked", params, 2 * sizeof(float), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			md_stencil<float>(in, out, lap, MD_BOUNDARY_CLAMP, 8);
+			done += 8 * dims[0] * dims[1];
+		}
+		return done;
+	});
+	md_free(in);
+	md_free(out);
+}
+
+static void _md_bench_chunked() {
+	size_t dims[] = {4096, 2048}, chunk_dims[] = {256, 256};
+	const char* path = "md_bench_chunks.tmp";
+	struct MD_CHUNKED* ar = md_chunked_create(path, dims, double, chunk_dims, 8 << 20);
+	struct MD_ARRAY* whole = md_alloc(dims, double);
+	char params[96];
+
+	md_for_each_chunk(ar, [&](ARRAYLIKE chunk, const size_t origin[]) {
+		md_fill(chunk, 1.0);
+		(void)origin;
+	}, true);
+	md_chunked_flush(ar);
+	md_fill(whole, 1.0);
+	snprintf(params, sizeof(params), "\"n\": %zu, \"chunk\": %zu, \"cache_mb\": 8", dims[0] * dims[1], chunk_dims[0]);
+	_md_bench("chunked/in_memory_sum", params, sizeof(double), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			sink += (size_t)md_sum<double>(whole);
+			done += dims[0] * dims[1];
+		}
+		return done;
+	});
+	//A 64MB array through an 8MB cache, so every pass reads every chunk.
+	_md_bench("chunked/for_each_chunk_sum", params, sizeof(double), [&](unsigned long long todo) {
+		unsigned long long done = 0;
+		while (done < todo) {
+			double s = 0;
+			md_for_each_chunk(ar, [&](ARRAYLIKE chunk, const size_t origin[]) {
+				s += md_sum<double>(chunk);
+				(void)origin;
+			});
+			sink += (size_t)s;
+			done += dims[0] * dims[1];
+		}
+		return done;
+	});
+	md_free(whole);
+	md_free(ar);
+	remove(path);
+}
+
+static void _md_bench_alloc() {
+	static const unsigned int sizes[] = {16, 256, 4096, 65536, 1 << 20, 16 << 20};
+	unsigned int i;
+	char params[64];
+
+	for (i=0;i<N_ELEMS(sizes);i++) {
+		unsigned int dims[] = {sizes[i]};
+		snprintf(params, sizeof(params), "\"bytes\": %u", sizes[i]);
+		_md_bench("alloc/md_alloc+md_free", params, sizes[i], [&](unsigned long long n) {
+			unsigned long long k;
+			struct MD_ARRAY* a;
+			for (k=0;k<n;k++) {
+				a = md_alloc(dims, char);
+				sink += (size_t)a->data[0];
+				md_free(a);
+			}
+			return n;
+		});
+	}
+}
+
+static void _md_bench_resize() {
+	static const unsigned int axes[] = {0, 1};
+	const unsigned int other = 256, steps = 4096;
+	unsigned int i;
+	char params[96];
+
+	for (i=0;i<N_ELEMS(axes);i++) {
+		unsigned int axis = axes[i];
+		snprintf(params, sizeof(params), "\"axis\": %u, \"other_dim\": %u, \"steps\": %u, \"type_size\": %u", axis, other, steps, (unsigned int)sizeof(float));
+		//One operation is one index appended along the axis.
+		_md_bench(axis ? "resize/grow/axis1" : "resize/grow/axis0", params, (double)other * sizeof(float), [&](unsigned long long n) {
+			unsigned long long k, done = 0;
+			unsigned int dims[] = {other, other}, s;
+			struct MD_ARRAY* a;
+			for (k=0;k<n;k+=steps) {
+				dims[axis] = 1;
+				a = md_alloc(dims, float);
+				for (s=2;s<=steps;s++) a = md_resize(a, axis, s);
+				md_free(a);
+				done += steps - 1;
+			}
+			return done;
+		});
+		_md_bench(axis ? "resize/shrink/axis1" : "resize/shrink/axis0", params, (double)other * sizeof(float), [&](unsigned long long n) {
+			unsigned long long k, done = 0;
+			unsigned int dims[] = {other, other}, s;
+			struct MD_ARRAY* a;
+			for (k=0;k<n;k+=steps) {
+				dims[axis] = steps;
+				a = md_alloc(dims, float);
+				for (s=steps-1;s>=1;s--) a = md_resize(a, axis, s);
+				md_free(a);
+				done += steps - 1;
+			}
+			return done;
+		});
+	}
+}
+
+static void _md_bench_transpose() {
+	static const unsigned int shapes[][2] = {{64, 64}, {1024, 1024}, {4096, 256}, {257, 1023}};
+	static const unsigned int type_sizes[] = {1, 2, 4, 8};
+	static const unsigned int axes[] = {1, 0};
+	unsigned int i, j;
+	char params[96];
+
+	for (i=0;i<N_ELEMS(shapes);i++) {
+		for (j=0;j<N_ELEMS(type_sizes);j++) {
+			unsigned int dims[] = {shapes[i][0], shapes[i][1]};
+			struct MD_ARRAY* a = _md_alloc(dims, 2, type_sizes[j]);
+			double bytes = (double)dims[0] * dims[1] * type_sizes[j];
+			snprintf(params, sizeof(params), "\"shape\": [%u, %u], \"type_size\": %u", dims[0], dims[1], type_sizes[j]);
+			//Bytes read plus bytes written.
+			_md_bench("transpose/md_permute", params, 2 * bytes, [&](unsigned long long n) {
+				unsigned long long k;
+				struct MD_ARRAY* t;
+				for (k=0;k<n;k++) {
+					t = md_permute(a, axes);
+					sink += (size_t)t->data[0];
+					md_free(t);
+				}
+				return n;
+			});
+			md_free(a);
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	out = stdout;
+	if (argc > 1 && strcmp(argv[1], "-")) {
+		out = fopen(argv[1], "w");
+		if (!out) {
+			fprintf(stderr, "md_bench: cannot write %s\n", argv[1]);
+			return 1;
+		}
+	}
+	if (argc > 2) filter = argv[2];
+
+	fprintf(out, "{\n  \"suite\": \"cmultiarray\",\n  \"timestamp\": %lld,\n  \"results\": [", (long long)time(NULL));
+	_md_bench_index();
+	_md_bench_iter();
+	_md_bench_reduce();
+	_md_bench_arith();
+	_md_bench_expr();
+	_md_bench_matmul();
+	_md_bench_sparse();
+	_md_bench_columns();
+	_md_bench_reflect();
+	_md_bench_serialize();
+	_md_bench_layout();
+	_md_bench_stencil();
+	_md_bench_chunked();
+	_md_bench_alloc();
+	_md_bench_resize();
+	_md_bench_transpose();
+	fprintf(out, "\n  ]\n}\n");
+	if (out != stdout) fclose(out);
+	return 0;
+}
@@ -0,0 +1,683 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "md_chunked.h"
+
+/* The cache maps chunk numbers (row-major positions in the grid of chunks) to chunks held
+in ordinary arrays of the chunk shape. Chunks are read and written with pread and pwrite
+at their place in the file, and arrays of evicted chunks are kept for reuse, so a stream
+through the file allocates no more than the cache holds.
+
+A chunk that is being read is in the map, not yet ready, so that a second request for it
+waits for the first instead of reading it again. The read-ahead thread takes chunk numbers
+from a queue and only ever evicts clean chunks, so it never writes. The chunk md_getptr last
+pointed into, and the chunks pinned by md_for_each_chunk and the box copies, are never
+evicted; the cache grows past its bound rather than evict them. */
+
+#define MD_CHUNKED_MAGIC "MDCHUNK"
+#define MD_CHUNKED_VERSION 1
+#define MD_CHUNKED_HEADER 4096
+
+struct _md_chunk {
+	struct MD_ARRAY* ar;
+	bool ready;
+	bool dirty;
+	unsigned int pins;
+	std::list<size_t>::iterator lru;
+};
+
+struct _md_chunk_cache {
+	std::mutex lock;
+	std::condition_variable changed; //A chunk became ready, or the read-ahead queue grew
+	std::unordered_map<size_t, struct _md_chunk> chunks;
+	std::list<size_t> lru; //Most recently used first
+	std::vector<struct MD_ARRAY*> spare; //Arrays of evicted chunks
+	size_t capacity; //Chunks the cache holds
+	size_t current; //The chunk md_getptr last pointed into, or SIZE_MAX
+	size_t last; //The chunk touched before the present one, or SIZE_MAX
+	std::deque<size_t> ahead; //Chunks to read ahead
+	std::thread reader;
+	bool stop;
+};
+
+static __thread struct MD_CHUNKED_SLICE temporary_chunked_slice;
+
+static struct MD_CHUNKED* _md_chunked_resolve(ARRAYLIKE ar, const size_t** p_idx, unsigned int* p_n_dims, const char* fn_name) {
+	struct MD_CHUNKED_SLICE* p_slice;
+
+	switch (ar->struct_identifier) {
+	case 0xAAAB0:
+		*p_idx = NULL;
+		*p_n_dims = ((struct MD_CHUNKED*)ar)->n_dims;
+		return (struct MD_CHUNKED*)ar;
+	case 0xAAAB1:
+		p_slice = (struct MD_CHUNKED_SLICE*)ar;
+		*p_idx = p_slice->idx;
+		*p_n_dims = p_slice->n_dims;
+		return p_slice->p_base;
+	case 0xFEEED:
+		fprintf(stderr, "%s: already freed.", fn_name);
+		throw MULTIARRAY_EX();
+	default:
+		fprintf(stderr, "%s: not a chunked array or chunked array slice.", fn_name);
+		throw MULTIARRAY_EX();
+	}
+}
+
+//Reads or writes chunk c in full. Returns: false on an I/O error.
+static bool _md_chunk_io(const struct MD_CHUNKED* ar, struct MD_ARRAY* buf, size_t c, bool write) {
+	off_t pos = (off_t)MD_CHUNKED_HEADER + (off_t)c * (off_t)ar->chunk_bytes;
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < ar->chunk_bytes) {
+		if (write) n = pwrite(ar->fd, buf->data + done, ar->chunk_bytes - done, pos + done);
+		else n = pread(ar->fd, buf->data + done, ar->chunk_bytes - done, pos + done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return(false);
+		if (n == 0) {
+			//Past the end of the file: never written, so zero.
+			if (write) return(false);
+			memset(buf->data + done, 0, ar->chunk_bytes - done);
+			break;
+		}
+		done += n;
+	}
+	return(true);
+}
+
+/* Finds an array for a chunk about to be read: a spare one, or one taken from the least
+recently used chunk that may be evicted, or a new one while the cache is below its bound.
+The foreground writes a dirty victim back; the read-ahead thread (may_write false) leaves
+dirty chunks alone, and gets NULL when the cache is full of chunks it cannot evict.*/
+static struct MD_ARRAY* _md_chunk_room(struct MD_CHUNKED* ar, bool may_write) {
+	struct _md_chunk_cache* cache = ar->p_cache;
+	std::list<size_t>::iterator it;
+	struct MD_ARRAY* buf;
+	struct _md_chunk* p;
+
+	if (cache->chunks.size() >= cache->capacity) {
+		for (it=cache->lru.end();it!=cache->lru.begin();) {
+			p = &cache->chunks[*--it];
+			if (!p->ready || p->pins || *it == cache->current || (p->dirty && !may_write)) continue;
+			if (p->dirty && !_md_chunk_io(ar, p->ar, *it, true)) {
+				fprintf(stderr, "md_chunked: writing chunk %zu back failed", *it);
+				throw MULTIARRAY_EX();
+			}
+			buf = p->ar;
+			cache->chunks.erase(*it);
+			cache->lru.erase(it);
+			return(buf);
+		}
+		if (!may_write) return(NULL);
+	}
+	if (cache->spare.size()) {
+		buf = cache->spare.back();
+		cache->spare.pop_back();
+		return(buf);
+	}
+	return(_md_alloc_ex(ar->chunk_dims, ar->n_dims, ar->type_size, MD_ALIGN_DATA));
+}
+
+//Queues chunk c to be read ahead, unless it is cached or queued already.
+static void _md_chunk_prefetch(struct _md_chunk_cache* cache, size_t c) {
+	if (cache->chunks.count(c) || std::find(cache->ahead.begin(), cache->ahead.end(), c) != cache->ahead.end()) return;
+	if (cache->ahead.size() >= 2 * MD_CHUNK_READAHEAD) cache->ahead.pop_front();
+	cache->ahead.push_back(c);
+	cache->changed.notify_all();
+}
+
+/* Notes that chunk c is touched after cache->last. When the two are neighbours along one
+axis, the next MD_CHUNK_READAHEAD chunks in the same direction are read ahead.*/
+static void _md_chunk_follow(struct MD_CHUNKED* ar, size_t c) {
+	struct _md_chunk_cache* cache = ar->p_cache;
+	size_t stride = 1, pos;
+	unsigned int k, j;
+	bool up;
+
+	if (cache->last != SIZE_MAX && c != cache->last) {
+		up = c > cache->last;
+		for (k=ar->n_dims;k-->0;) {
+			if ((up ? c - cache->last : cache->last - c) == stride) break;
+			stride *= ar->n_chunks[k];
+		}
+		if (k != (unsigned int)-1) {
+			pos = c / stride % ar->n_chunks[k];
+			for (j=1;j<=MD_CHUNK_READAHEAD;j++) {
+				if (up ? pos + j >= ar->n_chunks[k] : pos < j) break;
+				_md_chunk_prefetch(cache, up ? c + j * stride : c - j * stride);
+			}
+		}
+	}
+	cache->last = c;
+}
+
+/* Returns: The cached chunk c, read first if need be. With pin set, the chunk is pinned
+and must be given back with _md_chunk_unpin; otherwise it becomes the current chunk of
+md_getptr.*/
+static struct _md_chunk* _md_chunk_acquire(struct MD_CHUNKED* ar, size_t c, bool pin, bool dirty) {
+	struct _md_chunk_cache* cache = ar->p_cache;
+	std::unique_lock<std::mutex> hold(cache->lock);
+	std::unordered_map<size_t, struct _md_chunk>::iterator it;
+	struct MD_ARRAY* buf;
+	struct _md_chunk* p;
+	bool ok;
+
+	_md_chunk_follow(ar, c);
+	if (!pin) cache->current = c;
+	for (;;) {
+		it = cache->chunks.find(c);
+		if (it == cache->chunks.end()) break;
+		p = &it->second;
+		if (p->ready) {
+			cache->lru.splice(cache->lru.begin(), cache->lru, p->lru);
+			if (pin) p->pins++;
+			if (dirty) p->dirty = true;
+			return(p);
+		}
+		cache->changed.wait(hold);
+	}
+	buf = _md_chunk_room(ar, true);
+	p = &cache->chunks[c];
+	p->ar = buf;
+	p->ready = false;
+	p->dirty = false;
+	p->pins = pin ? 1 : 0;
+	cache->lru.push_front(c);
+	p->lru = cache->lru.begin();
+	hold.unlock();
+	ok = _md_chunk_io(ar, buf, c, false);
+	hold.lock();
+	//p stays valid: the entry is not ready, so no one else erases it, and rehashing
+	//an unordered_map does not move its elements.
+	if (!ok) {
+		cache->lru.erase(p->lru);
+		cache->chunks.erase(c);
+		cache->spare.push_back(buf);
+		cache->changed.notify_all();
+		fprintf(stderr, "md_chunked: reading chunk %zu failed", c);
+		throw MULTIARRAY_EX();
+	}
+	p->ready = true;
+	if (dirty) p->dirty = true;
+	cache->changed.notify_all();
+	return(p);
+}
+
+static void _md_chunk_unpin(struct MD_CHUNKED* ar, struct _md_chunk* p) {
+	std::lock_guard<std::mutex> hold(ar->p_cache->lock);
+
+	p->pins--;
+}
+
+static void _md_chunk_reader(struct MD_CHUNKED* ar) {
+	struct _md_chunk_cache* cache = ar->p_cache;
+	std::unique_lock<std::mutex> hold(cache->lock);
+	struct MD_ARRAY* buf;
+	struct _md_chunk* p;
+	size_t c;
+	bool ok;
+
+	for (;;) {
+		while (!cache->stop && cache->ahead.empty()) cache->changed.wait(hold);
+		if (cache->stop) return;
+		c = cache->ahead.front();
+		cache->ahead.pop_front();
+		if (cache->chunks.count(c)) continue;
+		buf = _md_chunk_room(ar, false);
+		if (!buf) continue;
+		p = &cache->chunks[c];
+		p->ar = buf;
+		p->ready = false;
+		p->dirty = false;
+		p->pins = 0;
+		cache->lru.push_front(c);
+		p->lru = cache->lru.begin();
+		hold.unlock();
+		ok = _md_chunk_io(ar, buf, c, false);
+		hold.lock();
+		if (ok) {
+			p->ready = true;
+		} else {
+			//Left for the foreground to read, and to report.
+			cache->lru.erase(p->lru);
+			cache->chunks.erase(c);
+			cache->spare.push_back(buf);
+		}
+		cache->changed.notify_all();
+	}
+}
+
+//Fills in the chunk grid and starts the cache of a chunked array whose header is read.
+static struct MD_CHUNKED* _md_chunked_start(struct MD_CHUNKED* ar, size_t cache_bytes) {
+	unsigned int k;
+	size_t total = 1;
+
+	ar->struct_identifier = 0xAAAB0;
+	ar->chunk_bytes = ar->type_size;
+	for (k=0;k<ar->n_dims;k++) {
+		if (ar->chunk_dims[k] == 0) {
+			fputs("md_chunked: a chunk must have at least one element along every dimension", stderr);
+			throw MULTIARRAY_EX();
+		}
+		ar->n_chunks[k] = ar->dims[k] / ar->chunk_dims[k] + (ar->dims[k] % ar->chunk_dims[k] != 0);
+		if (SIZE_MAX / ar->chunk_dims[k] < ar->chunk_bytes || (ar->n_chunks[k] && SIZE_MAX / ar->n_chunks[k] < total)) {
+			fputs("md_chunked: the byte size of the array overflows", stderr);
+			throw MULTIARRAY_EX();
+		}
+		ar->chunk_bytes *= ar->chunk_dims[k];
+		total *= ar->n_chunks[k];
+	}
+	if (total && (off_t)(((unsigned long long)1 << 62) / ar->chunk_bytes) < (off_t)total) {
+		fputs("md_chunked: the byte size of the array overflows", stderr);
+		throw MULTIARRAY_EX();
+	}
+	ar->p_cache = new _md_chunk_cache();
+	ar->p_cache->capacity = cache_bytes / ar->chunk_bytes;
+	if (ar->p_cache->capacity < MD_CHUNK_READAHEAD + 2) ar->p_cache->capacity = MD_CHUNK_READAHEAD + 2;
+	ar->p_cache->current = ar->p_cache->last = SIZE_MAX;
+	ar->p_cache->stop = false;
+	ar->p_cache->reader = std::thread(_md_chunk_reader, ar);
+	return(ar);
+}
+
+static void _md_chunked_fail(struct MD_CHUNKED* ar, const char* message) {
+	fputs(message, stderr);
+	if (ar->fd >= 0) close(ar->fd);
+	free(ar);
+	throw MULTIARRAY_EX();
+}
+
+struct MD_CHUNKED* _md_chunked_create(const char* path, const size_t _md_dims[], unsigned int n_dims, size_t size, const size_t chunk_dims[], size_t cache_bytes) {
+	struct MD_CHUNKED* ar;
+	char header[MD_CHUNKED_HEADER];
+	unsigned long long fields[2 + 2 * MAX_DIMENSIONS];
+	unsigned int k;
+
+	if (n_dims < 1 || n_dims > MAX_DIMENSIONS || size == 0) {
+		fputs("md_chunked_create: n_dims should be between 1 and MAX_DIMENSIONS", stderr);
+		throw MULTIARRAY_EX();
+	}
+	ar = (struct MD_CHUNKED*)calloc(1, sizeof(struct MD_CHUNKED));
+	if (!ar) {
+		fputs("md_chunked_create: allocation failed", stderr);
+		throw MULTIARRAY_EX();
+	}
+	ar->n_dims = n_dims;
+	ar->type_size = size;
+	memcpy(ar->dims, _md_dims, sizeof(size_t) * n_dims);
+	memcpy(ar->chunk_dims, chunk_dims, sizeof(size_t) * n_dims);
+	ar->mode = MD_CHUNKED_READWRITE;
+	ar->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (ar->fd < 0) _md_chunked_fail(ar, "md_chunked_create: cannot create the file");
+	try {
+		_md_chunked_start(ar, cache_bytes);
+	} catch (MULTIARRAY_EX&) {
+		_md_chunked_fail(ar, "");
+	}
+	memset(header, 0, sizeof(header));
+	memcpy(header, MD_CHUNKED_MAGIC, 7);
+	header[7] = MD_CHUNKED_VERSION;
+	fields[0] = n_dims;
+	fields[1] = size;
+	for (k=0;k<n_dims;k++) {
+		fields[2 + k] = _md_dims[k];
+		fields[2 + n_dims + k] = chunk_dims[k];
+	}
+	memcpy(header + 8, fields, sizeof(unsigned long long) * (2 + 2 * n_dims));
+	if (pwrite(ar->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+		md_free(ar);
+		fputs("md_chunked_create: writing the header failed", stderr);
+		throw MULTIARRAY_EX();
+	}
+	return(ar);
+}
+
+struct MD_CHUNKED* md_chunked_open(const char* path, unsigned int mode, size_t cache_bytes) {
+	struct MD_CHUNKED* ar;
+	char header[MD_CHUNKED_HEADER];
+	unsigned long long fields[2 + 2 * MAX_DIMENSIONS];
+	unsigned int k;
+
+	ar = (struct MD_CHUNKED*)calloc(1, sizeof(struct MD_CHUNKED));
+	if (!ar) {
+		fputs("md_chunked_open: allocation failed", stderr);
+		throw MULTIARRAY_EX();
+	}
+	ar->mode = mode;
+	ar->fd = open(path, mode == MD_CHUNKED_READWRITE ? O_RDWR : O_RDONLY);
+	if (ar->fd < 0) _md_chunked_fail(ar, "md_chunked_open: cannot open the file");
+	if (pread(ar->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) || memcmp(header, MD_CHUNKED_MAGIC, 7)) {
+		_md_chunked_fail(ar, "md_chunked_open: not a chunked array file");
+	}
+	if (header[7] != MD_CHUNKED_VERSION) _md_chunked_fail(ar, "md_chunked_open: unsupported version");
+	memcpy(fields, header + 8, sizeof(fields[0]) * 2);
+	if (fields[0] < 1 || fields[0] > MAX_DIMENSIONS || fields[1] == 0) {
+		_md_chunked_fail(ar, "md_chunked_open: the rank is 0 or exceeds MAX_DIMENSIONS");
+	}
+	ar->n_dims = (unsigned int)fields[0];
+	ar->type_size = fields[1];
+	memcpy(fields, header + 8, sizeof(unsigned long long) * (2 + 2 * ar->n_dims));
+	for (k=0;k<ar->n_dims;k++) {
+		ar->dims[k] = fields[2 + k];
+		ar->chunk_dims[k] = fields[2 + ar->n_dims + k];
+	}
+	try {
+		_md_chunked_start(ar, cache_bytes);
+	} catch (MULTIARRAY_EX&) {
+		_md_chunked_fail(ar, "");
+	}
+	return(ar);
+}
+
+void md_chunked_flush(struct MD_CHUNKED* ar) {
+	std::lock_guard<std::mutex> hold(ar->p_cache->lock);
+	std::unordered_map<size_t, struct _md_chunk>::iterator it;
+
+	for (it=ar->p_cache->chunks.begin();it!=ar->p_cache->chunks.end();++it) {
+		if (!it->second.ready || !it->second.dirty) continue;
+		if (!_md_chunk_io(ar, it->second.ar, it->first, true)) {
+			fprintf(stderr, "md_chunked_flush: writing chunk %zu failed", it->first);
+			throw MULTIARRAY_EX();
+		}
+		it->second.dirty = false;
+	}
+}
+
+static void _md_chunked_free(ARRAYLIKE ar) {
+	struct MD_CHUNKED* p_base;
+	struct _md_chunk_cache* cache;
+	std::unordered_map<size_t, struct _md_chunk>::iterator it;
+	const size_t* idx;
+	unsigned int n_dims;
+	size_t k;
+	bool flushed = true;
+
+	if (ar->struct_identifier == 0xAAAB1) {
+		ar->struct_identifier = 0xFEEED;
+		ar = ((struct MD_CHUNKED_SLICE*)ar)->p_base;
+	}
+	p_base = _md_chunked_resolve(ar, &idx, &n_dims, "md_free");
+	cache = p_base->p_cache;
+	{
+		std::lock_guard<std::mutex> hold(cache->lock);
+		cache->stop = true;
+		cache->changed.notify_all();
+	}
+	cache->reader.join();
+	for (it=cache->chunks.begin();it!=cache->chunks.end();++it) {
+		if (it->second.dirty && !_md_chunk_io(p_base, it->second.ar, it->first, true)) flushed = false;
+		md_free(it->second.ar);
+	}
+	for (k=0;k<cache->spare.size();k++) md_free(cache->spare[k]);
+	delete cache;
+	close(p_base->fd);
+	p_base->struct_identifier = 0xFEEED;
+	free(p_base);
+	if (!flushed) {
+		fputs("md_free: writing the chunks of a chunked array back failed", stderr);
+		throw MULTIARRAY_EX();
+	}
+}
+
+//Returns: The number of the chunk holding the element at idx, and in *p_offset the byte
+//offset of the element within the chunk.
+static size_t _md_chunk_of(const struct MD_CHUNKED* ar, const size_t idx[], size_t* p_offset) {
+	size_t c = 0, offset = 0;
+	unsigned int k;
+
+	for (k=0;k<ar->n_dims;k++) {
+		c = c * ar->n_chunks[k] + idx[k] / ar->chunk_dims[k];
+		offset = offset * ar->chunk_dims[k] + idx[k] % ar->chunk_dims[k];
+	}
+	*p_offset = offset * ar->type_size;
+	return(c);
+}
+
+//Returns: A pointer to the first element of ar, a chunked array or slice, in its cached
+//chunk; the chunk is marked as changed when dirty is set.
+static char* _md_chunked_ptr(ARRAYLIKE ar, bool dirty, const char* fn_name) {
+	struct MD_CHUNKED* p_base;
+	size_t full[MAX_DIMENSIONS], c, offset;
+	const size_t* idx;
+	unsigned int n_dims;
+	struct _md_chunk* p;
+
+	p_base = _md_chunked_resolve(ar, &idx, &n_dims, fn_name);
+	if (dirty && p_base->mode != MD_CHUNKED_READWRITE) {
+		fprintf(stderr, "%s: the array is open for reading only", fn_name);
+		throw MULTIARRAY_EX();
+	}
+	memset(full, 0, sizeof(full));
+	if (idx) memcpy(full, idx, sizeof(size_t) * (p_base->n_dims - n_dims));
+	c = _md_chunk_of(p_base, full, &offset);
+	p = _md_chunk_acquire(p_base, c, false, dirty);
+	return(p->ar->data + offset);
+}
+
+//md_getptr only reads, so that chunks that are merely scanned are never written back.
+static char* _md_chunked_getptr(ARRAYLIKE ar) {
+	return(_md_chunked_ptr(ar, false, "md_getptr"));
+}
+
+char* md_chunked_writable(ARRAYLIKE ar) {
+	return(_md_chunked_ptr(ar, true, "md_chunked_writable"));
+}
+
+static unsigned int _md_chunked_shape(ARRAYLIKE ar, size_t dims[]) {
+	struct MD_CHUNKED* p_base;
+	const size_t* idx;
+	unsigned int n_dims;
+
+	p_base = _md_chunked_resolve(ar, &idx, &n_dims, "md_shape");
+	memcpy(dims, p_base->dims + (p_base->n_dims - n_dims), sizeof(size_t) * n_dims);
+	return(n_dims);
+}
+
+static ARRAYLIKE _md_chunked_index(ARRAYLIKE ar, size_t i) {
+	struct MD_CHUNKED_SLICE slice;
+	const size_t* idx;
+	unsigned int level;
+
+	slice.struct_identifier = 0xAAAB1;
+	slice.p_base = _md_chunked_resolve(ar, &idx, &slice.n_dims, "md_index");
+	MD_STAT(_md_tls_stats.index_calls++);
+	level = slice.p_base->n_dims - slice.n_dims;
+#ifdef MD_INDEX_CHECKS
+	if (slice.n_dims == 0) {
+		fputs("md_index: indexed more times than there are dimensions", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (i >= slice.p_base->dims[level]) {
+		fprintf(stderr, "md_index: %zu out of range %zu in dimension %u\n", i, slice.p_base->dims[level], level);
+		throw MULTIARRAY_EX();
+	}
+#endif
+	if (idx) memcpy(slice.idx, idx, sizeof(size_t) * level);
+	slice.idx[level] = i;
+	slice.n_dims--;
+	temporary_chunked_slice = slice;
+	return &temporary_chunked_slice;
+}
+
+static const struct MD_KIND chunked_kind = {_md_chunked_free, _md_chunked_getptr, _md_chunked_shape, _md_chunked_index,
+	"md_base: a chunked array is stored in chunks; see md_for_each_chunk."};
+static int chunked_registered = _md_register_kind(0xAAAB0, &chunked_kind) + _md_register_kind(0xAAAB1, &chunked_kind);
+
+//Advances pos (chunk coordinates) to the next chunk in order, innermost last. Returns:
+//false past the last chunk.
+static bool _md_chunk_next(const struct MD_CHUNKED* ar, const unsigned int axes[], size_t pos[]) {
+	unsigned int k;
+
+	for (k=ar->n_dims;k-->0;) {
+		if (++pos[axes[k]] < ar->n_chunks[axes[k]]) return(true);
+		pos[axes[k]] = 0;
+	}
+	return(false);
+}
+
+static size_t _md_chunk_number(const struct MD_CHUNKED* ar, const size_t pos[]) {
+	size_t c = 0;
+	unsigned int k;
+
+	for (k=0;k<ar->n_dims;k++) c = c * ar->n_chunks[k] + pos[k];
+	return(c);
+}
+
+void md_for_each_chunk(struct MD_CHUNKED* ar, MD_CHUNK_FN fn, void* ctx, bool write, const unsigned int order[]) {
+	size_t pos[MAX_DIMENSIONS], ahead[MAX_DIMENSIONS], origin[MAX_DIMENSIONS];
+	unsigned int axes[MAX_DIMENSIONS], k, j;
+	unsigned long long seen = 0;
+	struct MD_VIEW views[2];
+	struct _md_chunk* p;
+	ARRAYLIKE chunk;
+	bool more;
+
+	if (write && ar->mode != MD_CHUNKED_READWRITE) {
+		fputs("md_for_each_chunk: the array is open for reading only", stderr);
+		throw MULTIARRAY_EX();
+	}
+	for (k=0;k<ar->n_dims;k++) {
+		axes[k] = order ? order[k] : k;
+		if (axes[k] >= ar->n_dims || (seen & (1ull << axes[k]))) {
+			fputs("md_for_each_chunk: order must be a permutation of the dimensions", stderr);
+			throw MULTIARRAY_EX();
+		}
+		seen |= 1ull << axes[k];
+		if (!ar->dims[k]) return;
+	}
+	memset(pos, 0, sizeof(pos));
+	do {
+		//Queue the chunks that come next in this order.
+		memcpy(ahead, pos, sizeof(pos));
+		{
+			std::lock_guard<std::mutex> hold(ar->p_cache->lock);
+			for (j=0;j<MD_CHUNK_READAHEAD && _md_chunk_next(ar, axes, ahead);j++) {
+				_md_chunk_prefetch(ar->p_cache, _md_chunk_number(ar, ahead));
+			}
+		}
+		p = _md_chunk_acquire(ar, _md_chunk_number(ar, pos), true, write);
+		chunk = p->ar;
+		for (k=0,j=0;k<ar->n_dims;k++) {
+			origin[k] = pos[k] * ar->chunk_dims[k];
+			if (origin[k] + ar->chunk_dims[k] > ar->dims[k]) {
+				views[j] = md_subview(chunk, k, 0, ar->dims[k] - origin[k], 1);
+				chunk = &views[j];
+				j ^= 1;
+			}
+		}
+		try {
+			fn(chunk, origin, ctx);
+		} catch (...) {
+			_md_chunk_unpin(ar, p);
+			throw;
+		}
+		_md_chunk_unpin(ar, p);
+		more = _md_chunk_next(ar, axes, pos);
+	} while (more);
+}
+
+//Copies the box of shape dims at origin between ar and other, in the direction of to_ar.
+static void _md_chunked_copy(struct MD_CHUNKED* ar, const size_t origin[], ARRAYLIKE other, bool to_ar, const char* fn_name) {
+	size_t dims[MAX_DIMENSIONS], first[MAX_DIMENSIONS], last[MAX_DIMENSIONS], pos[MAX_DIMENSIONS];
+	size_t lo[MAX_DIMENSIONS], hi[MAX_DIMENSIONS], idx[MAX_DIMENSIONS], strides[MAX_DIMENSIONS];
+	size_t el_sz = ar->type_size, total = 0, j, run, offset;
+	std::vector<ptrdiff_t> table;
+	ptrdiff_t* tabs[MAX_DIMENSIONS];
+	ptrdiff_t other_off, elem_off;
+	char* p_other = md_getptr(other);
+	unsigned int n_dims = ar->n_dims, k, inner = ar->n_dims - 1;
+	struct _md_chunk* p;
+	char* p_chunk;
+	bool contiguous = true;
+
+	if (to_ar && ar->mode != MD_CHUNKED_READWRITE) {
+		fprintf(stderr, "%s: the array is open for reading only", fn_name);
+		throw MULTIARRAY_EX();
+	}
+	if (md_shape(other, dims) != n_dims || md_type_size(md_base(other)) != el_sz) {
+		fprintf(stderr, "%s: the box must have the rank and element size of the chunked array", fn_name);
+		throw MULTIARRAY_EX();
+	}
+	for (k=0;k<n_dims;k++) {
+		if (origin[k] > ar->dims[k] || dims[k] > ar->dims[k] - origin[k]) {
+			fprintf(stderr, "%s: the box does not lie within the chunked array", fn_name);
+			throw MULTIARRAY_EX();
+		}
+		if (!dims[k]) return;
+		total += dims[k];
+	}
+	table.resize(total);
+	for (k=0,total=0;k<n_dims;k++) {
+		tabs[k] = &table[total];
+		_md_axis_offsets(other, k, dims[k], tabs[k]);
+		total += dims[k];
+		first[k] = origin[k] / ar->chunk_dims[k];
+		last[k] = (origin[k] + dims[k] - 1) / ar->chunk_dims[k];
+	}
+	for (j=1;j<dims[inner];j++) {
+		if (tabs[inner][j] - tabs[inner][j-1] != (ptrdiff_t)el_sz) contiguous = false;
+	}
+	strides[inner] = el_sz;
+	for (k=inner;k-->0;) strides[k] = strides[k+1] * ar->chunk_dims[k+1];
+
+	//Chunk by chunk, then row by row of the part of the box in the chunk.
+	memcpy(pos, first, sizeof(size_t) * n_dims);
+	for (;;) {
+		for (k=0;k<n_dims;k++) {
+			lo[k] = pos[k] * ar->chunk_dims[k] > origin[k] ? pos[k] * ar->chunk_dims[k] : origin[k];
+			hi[k] = (pos[k] + 1) * ar->chunk_dims[k] < origin[k] + dims[k] ? (pos[k] + 1) * ar->chunk_dims[k] : origin[k] + dims[k];
+		}
+		p = _md_chunk_acquire(ar, _md_chunk_number(ar, pos), true, to_ar);
+		memcpy(idx, lo, sizeof(size_t) * n_dims);
+		run = hi[inner] - lo[inner];
+		for (;;) {
+			offset = 0;
+			other_off = 0;
+			for (k=0;k<n_dims;k++) {
+				offset += (idx[k] - pos[k] * ar->chunk_dims[k]) * strides[k];
+				other_off += tabs[k][idx[k] - origin[k]];
+			}
+			p_chunk = p->ar->data + offset;
+			if (contiguous) {
+				if (to_ar) memcpy(p_chunk, p_other + other_off, run * el_sz);
+				else memcpy(p_other + other_off, p_chunk, run * el_sz);
+			} else {
+				for (j=0;j<run;j++) {
+					elem_off = other_off + tabs[inner][lo[inner] + j - origin[inner]] - tabs[inner][lo[inner] - origin[inner]];
+					if (to_ar) memcpy(p_chunk + j * el_sz, p_other + elem_off, el_sz);
+					else memcpy(p_other + elem_off, p_chunk + j * el_sz, el_sz);
+				}
+			}
+			for (k=inner;k-->0;) {
+				if (++idx[k] < hi[k]) break;
+				idx[k] = lo[k];
+			}
+			if (k == (unsigned int)-1) break;
+		}
+		_md_chunk_unpin(ar, p);
+		for (k=n_dims;k-->0;) {
+			if (++pos[k] <= last[k]) break;
+			pos[k] = first[k];
+		}
+		if (k == (unsigned int)-1) break;
+	}
+}
+
+void md_chunked_read(struct MD_CHUNKED* ar, const size_t origin[], ARRAYLIKE dst) {
+	_md_chunked_copy(ar, origin, dst, false, "md_chunked_read");
+}
+
+void md_chunked_write(struct MD_CHUNKED* ar, const size_t origin[], ARRAYLIKE src) {
+	_md_chunked_copy(ar, origin, src, true, "md_chunked_write");
+}
@@ -0,0 +1,163 @@
+#include <string.h>
+#include "md_columns.h"
+#include "md_iter.h"
+
+/* Columnar arrays. Each column is allocated with MD_ALIGN_DATA and without row padding,
+so that it is one dense run in row-major order: element k of a column belongs to the k-th
+record in row-major order. The conversions walk the records run by run and move a chunk of
+records at a time, one member after another, so that the chunk stays in cache while its
+members are scattered to (or gathered from) their columns. */
+
+#define MD_COLUMNS_CHUNK 1024 //records moved per pass over the members
+
+static struct MD_COLUMNS* _md_columns_check(ARRAYLIKE ar, const char* fn_name) {
+	switch (ar->struct_identifier) {
+	case 0xAAAAF:
+		return (struct MD_COLUMNS*)ar;
+	case 0xFEEED:
+		fprintf(stderr, "%s: already freed.", fn_name);
+		throw MULTIARRAY_EX();
+	default:
+		fprintf(stderr, "%s: not a columnar array.", fn_name);
+		throw MULTIARRAY_EX();
+	}
+}
+
+static void _md_columns_free(ARRAYLIKE ar);
+
+/* Copies n fields of width bytes, from src_stride bytes apart to dst_stride bytes apart.
+Fields of 1, 2, 4 and 8 bytes are moved as integers, so the loops are plain loads and
+stores that the compiler can vectorize when one side is dense. */
+template <typename W>
+static inline void _md_move_fields(char* dst, ptrdiff_t dst_stride, const char* src, ptrdiff_t src_stride, size_t n) {
+	size_t k;
+	W w;
+
+	for (k=0;k<n;k++) {
+		memcpy(&w, src + k * src_stride, sizeof(W));
+		memcpy(dst + k * dst_stride, &w, sizeof(W));
+	}
+}
+
+static void _md_move_fields(char* dst, ptrdiff_t dst_stride, const char* src, ptrdiff_t src_stride, size_t n, size_t width) {
+	size_t k;
+
+	switch (width) {
+	case 1: _md_move_fields<uint8_t>(dst, dst_stride, src, src_stride, n); break;
+	case 2: _md_move_fields<uint16_t>(dst, dst_stride, src, src_stride, n); break;
+	case 4: _md_move_fields<uint32_t>(dst, dst_stride, src, src_stride, n); break;
+	case 8: _md_move_fields<uint64_t>(dst, dst_stride, src, src_stride, n); break;
+	default:
+		for (k=0;k<n;k++) memcpy(dst + k * dst_stride, src + k * src_stride, width);
+	}
+}
+
+struct MD_COLUMNS* _md_columns_alloc(const struct REFLECT* type, const size_t _md_dims[], unsigned int n_dims) {
+	struct MD_COLUMNS* cols;
+	unsigned int i;
+
+	if (n_dims > MAX_DIMENSIONS) {
+		fputs("md_columns_alloc: n_dims should not exceed MAX_DIMENSIONS", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (type->n_members == 0) {
+		fprintf(stderr, "md_columns_alloc: type %s has no members", type->typenm);
+		throw MULTIARRAY_EX();
+	}
+	cols = (struct MD_COLUMNS*)calloc(1, sizeof(struct MD_COLUMNS));
+	if (!cols) {
+		fputs("md_columns_alloc: allocation failed", stderr);
+		throw MULTIARRAY_EX();
+	}
+	cols->struct_identifier = 0xAAAAF;
+	cols->type = type;
+	cols->n_dims = n_dims;
+	memcpy(cols->dims, _md_dims, sizeof(size_t) * n_dims);
+	try {
+		for (i=0;i<type->n_members;i++) cols->columns[i] = _md_alloc_ex(_md_dims, n_dims, type->members[i]->bytessize, MD_ALIGN_DATA);
+	} catch (...) {
+		_md_columns_free(cols);
+		throw;
+	}
+	return(cols);
+}
+
+static void _md_columns_free(ARRAYLIKE ar) {
+	struct MD_COLUMNS* cols = _md_columns_check(ar, "md_free");
+	unsigned int i;
+
+	for (i=0;i<cols->type->n_members;i++) md_free(cols->columns[i]);
+	cols->struct_identifier = 0xFEEED;
+	free(cols);
+}
+
+static unsigned int _md_columns_shape(ARRAYLIKE ar, size_t dims[]) {
+	struct MD_COLUMNS* cols = _md_columns_check(ar, "md_shape");
+
+	memcpy(dims, cols->dims, sizeof(size_t) * cols->n_dims);
+	return(cols->n_dims);
+}
+
+static const struct MD_KIND columns_kind = {_md_columns_free, NULL, _md_columns_shape, NULL,
+	"md_base: a columnar array has one array per member; see md_column."};
+static int columns_registered = _md_register_kind(0xAAAAF, &columns_kind);
+
+struct MD_ARRAY* md_column(const struct MD_COLUMNS* cols, const char member_name[]) {
+	int i;
+
+	_md_columns_check((ARRAYLIKE)cols, "md_column");
+	i = reflect_member_index(cols->type, member_name);
+	return i < 0 ? NULL : cols->columns[i];
+}
+
+/* Moves every record of ar to or from cols: to the columns when to_columns, from them
+otherwise.*/
+static void _md_columns_transfer(ARRAYLIKE ar, const struct MD_COLUMNS* cols, bool to_columns) {
+	const struct REFLECT* type = cols->type;
+	unsigned int order[MAX_DIMENSIONS];
+	size_t offsets[REFLECT_MAX_MEMBERS];
+	struct MD_ITER it;
+	size_t count, linear = 0, n, width;
+	ptrdiff_t step;
+	unsigned int i, k;
+	char *p, *col;
+
+	for (k=0;k<cols->n_dims;k++) order[k] = k;
+	for (i=0;i<type->n_members;i++) offsets[i] = reflect_offset(type, i);
+	md_iter_init(&it, ar, order);
+	step = md_iter_step(&it);
+	while ((p = md_iter_next_run(&it, &count))) {
+		for (;count;count-=n,p+=(ptrdiff_t)n*step,linear+=n) {
+			n = count < MD_COLUMNS_CHUNK ? count : MD_COLUMNS_CHUNK;
+			for (i=0;i<type->n_members;i++) {
+				width = type->members[i]->bytessize;
+				col = cols->columns[i]->data + linear * width;
+				if (to_columns) _md_move_fields(col, (ptrdiff_t)width, p + offsets[i], step, n, width);
+				else _md_move_fields(p + offsets[i], step, col, (ptrdiff_t)width, n, width);
+			}
+		}
+	}
+}
+
+struct MD_COLUMNS* md_to_columns(ARRAYLIKE ar, const struct REFLECT* type) {
+	size_t dims[MAX_DIMENSIONS];
+	unsigned int n_dims = md_shape(ar, dims);
+	struct MD_COLUMNS* cols;
+
+	if (md_type_size(md_base(ar)) != type->bytessize) {
+		fprintf(stderr, "md_to_columns: elements of %zu bytes are not records of type %s (%u bytes)\n", md_type_size(md_base(ar)), type->typenm, type->bytessize);
+		throw MULTIARRAY_EX();
+	}
+	cols = _md_columns_alloc(type, dims, n_dims);
+	_md_columns_transfer(ar, cols, true);
+	return(cols);
+}
+
+struct MD_ARRAY* md_from_columns(const struct MD_COLUMNS* cols) {
+	struct MD_ARRAY* ar;
+
+	_md_columns_check((ARRAYLIKE)cols, "md_from_columns");
+	ar = _md_alloc(cols->dims, cols->n_dims, cols->type->bytessize);
+	_md_columns_transfer(ar, cols, false);
+	return(ar);
+}
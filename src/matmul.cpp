@@ -0,0 +1,280 @@
+#include <string.h>
+#include <vector>
+#include "md_matmul.h"
+#include "md_parallel.h"
+
+#if defined(__AVX__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+/* The loops follow the GotoBLAS/BLIS layout. For each NC-wide panel of columns and KC-deep
+slice of the inner dimension, b is packed into NR-wide micro-panels shared by all threads.
+Each task then packs an MC-row block of a into MR-tall micro-panels and multiplies it by a
+group of b's micro-panels, one MR x NR tile at a time. A b micro-panel stays in L1 while
+the tiles of the a block, in L2, stream past it. */
+
+#define MD_GEMM_KC 256 //depth of a packed slice
+#define MD_GEMM_MC 96 //rows of a packed block of a; a multiple of every MR
+#define MD_GEMM_NC 2048 //columns of a packed panel of b
+#define MD_GEMM_NB 256 //columns of the product computed by one task; a multiple of every NR
+
+/* The register-tiled kernels. Each one multiplies an MR x kc micro-panel of a, stored
+column after column, by a kc x NR micro-panel of b, stored row after row, and leaves the
+MR x NR result in tile, row after row. The generic version relies on the compiler to keep
+acc in vector registers. */
+template <typename T> struct _md_gemm_kernel {
+	enum { MR = 4, NR = 8 };
+	static inline void run(size_t kc, const T* a, const T* b, T* tile) {
+		T acc[MR][NR];
+		size_t k;
+		int i, j;
+
+		memset(acc, 0, sizeof(acc));
+		for (k=0;k<kc;k++) {
+			for (i=0;i<MR;i++) {
+				for (j=0;j<NR;j++) acc[i][j] += a[i] * b[j];
+			}
+			a += MR;
+			b += NR;
+		}
+		memcpy(tile, acc, sizeof(acc));
+	}
+};
+
+#if defined(__AVX__) && defined(__FMA__)
+//The six rows are written out so that the twelve accumulators stay in registers.
+#define MD_GEMM_ROW(I, SET1, FMADD) \
+	ai = SET1(a + I); \
+	c##I##0 = FMADD(ai, b0, c##I##0); \
+	c##I##1 = FMADD(ai, b1, c##I##1);
+
+template <> struct _md_gemm_kernel<float> {
+	enum { MR = 6, NR = 16 };
+	static inline void run(size_t kc, const float* a, const float* b, float* tile) {
+		__m256 c00, c01, c10, c11, c20, c21, c30, c31, c40, c41, c50, c51, b0, b1, ai;
+		size_t k;
+
+		c00 = c01 = c10 = c11 = c20 = c21 = c30 = c31 = c40 = c41 = c50 = c51 = _mm256_setzero_ps();
+		for (k=0;k<kc;k++) {
+			b0 = _mm256_loadu_ps(b);
+			b1 = _mm256_loadu_ps(b + 8);
+			MD_GEMM_ROW(0, _mm256_broadcast_ss, _mm256_fmadd_ps)
+			MD_GEMM_ROW(1, _mm256_broadcast_ss, _mm256_fmadd_ps)
+			MD_GEMM_ROW(2, _mm256_broadcast_ss, _mm256_fmadd_ps)
+			MD_GEMM_ROW(3, _mm256_broadcast_ss, _mm256_fmadd_ps)
+			MD_GEMM_ROW(4, _mm256_broadcast_ss, _mm256_fmadd_ps)
+			MD_GEMM_ROW(5, _mm256_broadcast_ss, _mm256_fmadd_ps)
+			a += MR;
+			b += NR;
+		}
+		_mm256_storeu_ps(tile, c00);
+		_mm256_storeu_ps(tile + 8, c01);
+		_mm256_storeu_ps(tile + 16, c10);
+		_mm256_storeu_ps(tile + 24, c11);
+		_mm256_storeu_ps(tile + 32, c20);
+		_mm256_storeu_ps(tile + 40, c21);
+		_mm256_storeu_ps(tile + 48, c30);
+		_mm256_storeu_ps(tile + 56, c31);
+		_mm256_storeu_ps(tile + 64, c40);
+		_mm256_storeu_ps(tile + 72, c41);
+		_mm256_storeu_ps(tile + 80, c50);
+		_mm256_storeu_ps(tile + 88, c51);
+	}
+};
+
+template <> struct _md_gemm_kernel<double> {
+	enum { MR = 6, NR = 8 };
+	static inline void run(size_t kc, const double* a, const double* b, double* tile) {
+		__m256d c00, c01, c10, c11, c20, c21, c30, c31, c40, c41, c50, c51, b0, b1, ai;
+		size_t k;
+
+		c00 = c01 = c10 = c11 = c20 = c21 = c30 = c31 = c40 = c41 = c50 = c51 = _mm256_setzero_pd();
+		for (k=0;k<kc;k++) {
+			b0 = _mm256_loadu_pd(b);
+			b1 = _mm256_loadu_pd(b + 4);
+			MD_GEMM_ROW(0, _mm256_broadcast_sd, _mm256_fmadd_pd)
+			MD_GEMM_ROW(1, _mm256_broadcast_sd, _mm256_fmadd_pd)
+			MD_GEMM_ROW(2, _mm256_broadcast_sd, _mm256_fmadd_pd)
+			MD_GEMM_ROW(3, _mm256_broadcast_sd, _mm256_fmadd_pd)
+			MD_GEMM_ROW(4, _mm256_broadcast_sd, _mm256_fmadd_pd)
+			MD_GEMM_ROW(5, _mm256_broadcast_sd, _mm256_fmadd_pd)
+			a += MR;
+			b += NR;
+		}
+		_mm256_storeu_pd(tile, c00);
+		_mm256_storeu_pd(tile + 4, c01);
+		_mm256_storeu_pd(tile + 8, c10);
+		_mm256_storeu_pd(tile + 12, c11);
+		_mm256_storeu_pd(tile + 16, c20);
+		_mm256_storeu_pd(tile + 20, c21);
+		_mm256_storeu_pd(tile + 24, c30);
+		_mm256_storeu_pd(tile + 28, c31);
+		_mm256_storeu_pd(tile + 32, c40);
+		_mm256_storeu_pd(tile + 36, c41);
+		_mm256_storeu_pd(tile + 40, c50);
+		_mm256_storeu_pd(tile + 44, c51);
+	}
+};
+#endif
+
+/* Packs rows [0, mc) and columns [0, kc) of the matrix at p (row stride rs, column stride
+cs, in bytes) into MR-tall micro-panels, padding the last one with zeros.*/
+template <typename T, int MR>
+static void _md_pack_a(T* dst, const char* p, ptrdiff_t rs, ptrdiff_t cs, size_t mc, size_t kc) {
+	size_t i0, k;
+	int r;
+
+	for (i0=0;i0<mc;i0+=MR) {
+		for (k=0;k<kc;k++) {
+			for (r=0;r<MR;r++) *dst++ = i0 + r < mc ? *(const T*)(p + (ptrdiff_t)(i0 + r) * rs + (ptrdiff_t)k * cs) : (T)0;
+		}
+	}
+}
+
+//Packs columns [j0, j0+NR) of the kc x nc matrix at p into one micro-panel.
+template <typename T, int NR>
+static void _md_pack_b(T* dst, const char* p, ptrdiff_t rs, ptrdiff_t cs, size_t kc, size_t nc, size_t j0) {
+	size_t k;
+	int c;
+	const char* row;
+
+	for (k=0;k<kc;k++) {
+		row = p + (ptrdiff_t)k * rs;
+		if (cs == sizeof(T) && j0 + NR <= nc) {
+			memcpy(dst, row + (ptrdiff_t)j0 * cs, NR * sizeof(T));
+			dst += NR;
+		} else {
+			for (c=0;c<NR;c++) *dst++ = j0 + c < nc ? *(const T*)(row + (ptrdiff_t)(j0 + c) * cs) : (T)0;
+		}
+	}
+}
+
+//Stores (or adds, when accumulate is set) the top-left m x n of tile into c.
+template <typename T, int NR>
+static inline void _md_store_tile(char* c, ptrdiff_t rs, ptrdiff_t cs, const T* tile, size_t m, size_t n, bool accumulate) {
+	size_t i, j;
+	T* row;
+
+	for (i=0;i<m;i++) {
+		row = (T*)(c + (ptrdiff_t)i * rs);
+		if (cs == sizeof(T)) {
+			if (accumulate) {
+				for (j=0;j<n;j++) row[j] += tile[i*NR+j];
+			} else {
+				for (j=0;j<n;j++) row[j] = tile[i*NR+j];
+			}
+		} else {
+			for (j=0;j<n;j++) {
+				T* e = (T*)((char*)row + (ptrdiff_t)j * cs);
+				*e = accumulate ? *e + tile[i*NR+j] : tile[i*NR+j];
+			}
+		}
+	}
+}
+
+static unsigned int _md_matrix(ARRAYLIKE ar, size_t el_sz, size_t dims[], ptrdiff_t strides[], const char* name) {
+	if (md_type_size(md_base(ar)) != el_sz) {
+		fprintf(stderr, "md_matmul: element size of %s does not match the multiplication\n", name);
+		throw MULTIARRAY_EX();
+	}
+	if (md_shape(ar, dims) != 2) {
+		fprintf(stderr, "md_matmul: %s must have 2 dimensions\n", name);
+		throw MULTIARRAY_EX();
+	}
+	md_strides(ar, strides);
+	return 2;
+}
+
+template <typename T>
+struct MD_ARRAY* md_matmul(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out) {
+	typedef _md_gemm_kernel<T> K;
+	size_t a_dims[MAX_DIMENSIONS], b_dims[MAX_DIMENSIONS], c_dims[MAX_DIMENSIONS];
+	ptrdiff_t sa[MAX_DIMENSIONS], sb[MAX_DIMENSIONS], sc[MAX_DIMENSIONS];
+	size_t M, N, Kd, jc, pc, nc, kc, n_ib, n_jb;
+	struct MD_ARRAY* result = NULL;
+	const char *pa, *pb;
+	char* pc_base;
+
+	_md_matrix(a, sizeof(T), a_dims, sa, "a");
+	_md_matrix(b, sizeof(T), b_dims, sb, "b");
+	M = a_dims[0];
+	Kd = a_dims[1];
+	N = b_dims[1];
+	if (b_dims[0] != Kd) {
+		fprintf(stderr, "md_matmul: a is [%zu, %zu] but b is [%zu, %zu]\n", a_dims[0], a_dims[1], b_dims[0], b_dims[1]);
+		throw MULTIARRAY_EX();
+	}
+	if (out) {
+		_md_matrix(out, sizeof(T), c_dims, sc, "out");
+		if (c_dims[0] != M || c_dims[1] != N) {
+			fprintf(stderr, "md_matmul: out must be [%zu, %zu]\n", M, N);
+			throw MULTIARRAY_EX();
+		}
+		if (md_base(out) == md_base(a) || md_base(out) == md_base(b)) {
+			fputs("md_matmul: out must not share memory with a or b", stderr);
+			throw MULTIARRAY_EX();
+		}
+	} else {
+		c_dims[0] = M;
+		c_dims[1] = N;
+		out = result = _md_alloc(c_dims, 2, sizeof(T));
+		md_strides(out, sc);
+	}
+	if (!M || !N) return result;
+	if (!Kd) {
+		md_fill<T>(out, (T)0);
+		return result;
+	}
+	pa = md_getptr(a);
+	pb = md_getptr(b);
+	pc_base = md_getptr(out);
+
+	std::vector<T> bpack(((MD_GEMM_NC < N ? MD_GEMM_NC : N) + K::NR - 1) / K::NR * K::NR * (MD_GEMM_KC < Kd ? MD_GEMM_KC : Kd));
+	for (jc=0;jc<N;jc+=MD_GEMM_NC) {
+		nc = N - jc < MD_GEMM_NC ? N - jc : MD_GEMM_NC;
+		n_ib = (M + MD_GEMM_MC - 1) / MD_GEMM_MC;
+		n_jb = (nc + MD_GEMM_NB - 1) / MD_GEMM_NB;
+		for (pc=0;pc<Kd;pc+=MD_GEMM_KC) {
+			kc = Kd - pc < MD_GEMM_KC ? Kd - pc : MD_GEMM_KC;
+			const char* b_panel = pb + (ptrdiff_t)pc * sb[0] + (ptrdiff_t)jc * sb[1];
+			md_parallel_for((nc + K::NR - 1) / K::NR, 16, [&](size_t begin, size_t end) {
+				size_t p;
+				for (p=begin;p<end;p++) _md_pack_b<T, K::NR>(&bpack[p * K::NR * kc], b_panel, sb[0], sb[1], kc, nc, p * K::NR);
+			});
+
+			//Consecutive tasks share a block of a, so that a run of tasks packs it once.
+			md_parallel_for(n_ib * n_jb, 1, [&](size_t begin, size_t end) {
+				std::vector<T> apack((size_t)MD_GEMM_MC * kc);
+				T tile[K::MR * K::NR];
+				size_t t, ib, jb, ic, mc, jr, ir, last_ib = SIZE_MAX, j_end;
+				char* c_block;
+
+				for (t=begin;t<end;t++) {
+					ib = t / n_jb;
+					jb = t % n_jb;
+					ic = ib * MD_GEMM_MC;
+					mc = M - ic < MD_GEMM_MC ? M - ic : MD_GEMM_MC;
+					if (ib != last_ib) {
+						_md_pack_a<T, K::MR>(&apack[0], pa + (ptrdiff_t)ic * sa[0] + (ptrdiff_t)pc * sa[1], sa[0], sa[1], mc, kc);
+						last_ib = ib;
+					}
+					c_block = pc_base + (ptrdiff_t)ic * sc[0] + (ptrdiff_t)jc * sc[1];
+					j_end = (jb + 1) * MD_GEMM_NB < nc ? (jb + 1) * MD_GEMM_NB : nc;
+					for (jr=jb*MD_GEMM_NB;jr<j_end;jr+=K::NR) {
+						for (ir=0;ir<mc;ir+=K::MR) {
+							K::run(kc, &apack[ir * kc], &bpack[jr * kc], tile);
+							_md_store_tile<T, K::NR>(c_block + (ptrdiff_t)ir * sc[0] + (ptrdiff_t)jr * sc[1], sc[0], sc[1], tile,
+								mc - ir < K::MR ? mc - ir : (size_t)K::MR, j_end - jr < K::NR ? j_end - jr : (size_t)K::NR, pc > 0);
+						}
+					}
+				}
+			});
+		}
+	}
+	return result;
+}
+
+template struct MD_ARRAY* md_matmul<float>(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out);
+template struct MD_ARRAY* md_matmul<double>(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out);
+template struct MD_ARRAY* md_matmul<int>(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out);
+template struct MD_ARRAY* md_matmul<long long>(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out);
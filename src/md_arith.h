@@ -0,0 +1,69 @@
+#ifndef _JC_MD_ARITH
+#define _JC_MD_ARITH
+
+#include "multiarray.h"
+
+/*Notes:
+Elementwise arithmetic between multi-arrays with NumPy's broadcasting rules, for the
+built-in integer and floating point element types (the templates are instantiated for
+those in arith.cpp).
+
+The shapes of the operands are matched from their last dimensions; each pair of
+dimensions must be equal, or one of them 1. An operand with a dimension of 1, or with
+fewer dimensions, is repeated along the result through a view with a stride of 0 (see
+md_broadcast_to), so adding a [M] vector or a [N, 1] column to a [N, M] array reads the
+smaller operand in place instead of copying it out to the full shape.
+
+The work runs on the thread pool of md_parallel.h. Integer division by zero is undefined,
+as in C.*/
+
+//Operations of md_binary.
+#define MD_ADD 0
+#define MD_SUB 1
+#define MD_MUL 2
+#define MD_DIV 3
+#define MD_MINIMUM 4
+#define MD_MAXIMUM 5
+
+/* Accepts:
+  * a, b - Arrays, array slices or views with elements of type T, of broadcastable shapes.
+  * op - One of MD_ADD, MD_SUB, MD_MUL, MD_DIV, MD_MINIMUM and MD_MAXIMUM.
+  * out - An array, array slice or view with elements of type T, or NULL. a and b are
+    broadcast to its shape; it may be a or b itself when that operand has its shape.
+Returns: A newly allocated array of the broadcast shape of a and b holding a op b when out
+is NULL; otherwise NULL, and the result is stored into out.
+Note: Throws MULTIARRAY_EX if the shapes are incompatible.*/
+template <typename T>
+struct MD_ARRAY* md_binary(ARRAYLIKE a, ARRAYLIKE b, unsigned int op, ARRAYLIKE out = NULL);
+
+template <typename T>
+static inline struct MD_ARRAY* md_add(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out = NULL) {
+	return md_binary<T>(a, b, MD_ADD, out);
+}
+
+template <typename T>
+static inline struct MD_ARRAY* md_sub(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out = NULL) {
+	return md_binary<T>(a, b, MD_SUB, out);
+}
+
+template <typename T>
+static inline struct MD_ARRAY* md_mul(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out = NULL) {
+	return md_binary<T>(a, b, MD_MUL, out);
+}
+
+template <typename T>
+static inline struct MD_ARRAY* md_div(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out = NULL) {
+	return md_binary<T>(a, b, MD_DIV, out);
+}
+
+template <typename T>
+static inline struct MD_ARRAY* md_minimum(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out = NULL) {
+	return md_binary<T>(a, b, MD_MINIMUM, out);
+}
+
+template <typename T>
+static inline struct MD_ARRAY* md_maximum(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out = NULL) {
+	return md_binary<T>(a, b, MD_MAXIMUM, out);
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef _JC_MD_CHUNKED
+#define _JC_MD_CHUNKED
+
+#include "multiarray.h"
+
+/*Notes:
+Chunked multi-arrays, for arrays larger than memory. A chunked array is split into chunks
+of one fixed shape, which are stored one after another in a local file. At most a bounded
+number of chunks are in memory at a time, in a least-recently-used cache; a chunk is read
+when first touched and, if it was written, written back when it is evicted, flushed or the
+array is freed. A background thread reads ahead: when successive chunks are touched along
+one axis, the next few chunks along that axis are read while the current one is in use.
+
+md_for_each_chunk streams the whole array past a callback a chunk at a time. Each chunk is
+an ordinary array (or a view of one, for the chunks at the far edges of the array), so
+md_sum, md_reduce, md_iter, md_permute and the rest apply to it; that is how reductions
+and transposes are run over the whole array. md_chunked_read and md_chunked_write copy a
+box of elements at any position between a chunked array and an ordinary one.
+
+Elements can also be reached one at a time: md_free, md_shape, md_index and md_getptr
+accept a chunked array and the slices md_index takes on it (md_slice_at and the md_#d
+macros do not). The pointer md_getptr gives is into the cached chunk, and stays valid until
+the next call that touches the same chunked array. It is for reading: a chunk is written
+back only when it was changed through md_chunked_writable, md_for_each_chunk with write set,
+or md_chunked_write, so scanning an array never writes it. md_base does not accept a
+chunked array.
+
+The cache is locked internally, but a chunked array is meant to be used by one thread at a
+time (besides its read-ahead thread). POSIX only.
+
+The file holds a 4096 byte header (the magic string "MDCHUNK", a version byte, the rank,
+element size, dimensions and chunk shape, all in native byte order) and then the chunks, in
+row-major order of their positions. The elements of a chunk are stored in row-major order
+of its full shape, including the part of an edge chunk that lies beyond the array.*/
+
+//Modes of md_chunked_open.
+#define MD_CHUNKED_READONLY 0
+#define MD_CHUNKED_READWRITE 1
+
+//Chunks read ahead along the axis of traversal.
+#define MD_CHUNK_READAHEAD 2
+
+struct MD_CHUNKED : public MD_ARRAYLIKE {
+	//struct_identifier must be AAAB0
+	unsigned int n_dims;
+	size_t type_size;
+
+	size_t dims[MAX_DIMENSIONS];
+	size_t chunk_dims[MAX_DIMENSIONS]; //The shape of every chunk
+	size_t n_chunks[MAX_DIMENSIONS]; //Chunks along each dimension
+	size_t chunk_bytes; //The byte size of a chunk in the file and in memory
+	unsigned int mode; //MD_CHUNKED_*
+	int fd;
+	struct _md_chunk_cache* p_cache;
+};
+
+struct MD_CHUNKED_SLICE : public MD_ARRAYLIKE {
+	//struct_identifier must be AAAB1
+	struct MD_CHUNKED* p_base;
+	unsigned int n_dims; //Dimensions not yet indexed
+	size_t idx[MAX_DIMENSIONS]; //The indices taken so far
+};
+
+/* Accepts:
+  * path - The file to create or overwrite.
+  * _md_dims, n_dims, size - The dimensions and element size, as for _md_alloc.
+  * chunk_dims - The shape of a chunk, one extent per dimension.
+  * cache_bytes - The memory the chunk cache may use; at least enough for
+    MD_CHUNK_READAHEAD + 2 chunks is always allowed.
+Returns: A new chunked array, open for reading and writing, with every element zero. The
+file is created sparse, so it takes disk space only as chunks are written. Free it with
+md_free.*/
+struct MD_CHUNKED* _md_chunked_create(const char* path, const size_t _md_dims[], unsigned int n_dims, size_t size, const size_t chunk_dims[], size_t cache_bytes);
+
+//The same, given the C array of dimensions and the element type.
+#define md_chunked_create(path, _md_dims, type, chunk_dims, cache_bytes) (_md_chunked_create((path), (_md_dims), N_ELEMS(_md_dims), sizeof(type), (chunk_dims), (cache_bytes)))
+
+/* Accepts:
+  * path - A file made by md_chunked_create.
+  * mode - MD_CHUNKED_READONLY or MD_CHUNKED_READWRITE.
+  * cache_bytes - As for _md_chunked_create.
+Returns: The chunked array stored in the file.*/
+struct MD_CHUNKED* md_chunked_open(const char* path, unsigned int mode, size_t cache_bytes);
+
+/* Accepts:
+  * ar - A chunked array.
+Purpose: Writes the chunks that have changed back to the file, leaving them cached.*/
+void md_chunked_flush(struct MD_CHUNKED* ar);
+
+typedef void (*MD_CHUNK_FN)(ARRAYLIKE chunk, const size_t origin[], void* ctx);
+
+/* Accepts:
+  * ar - A chunked array.
+  * fn - Called once per chunk with the chunk's elements, as an array of the chunk shape or,
+    for the chunks at the far edges, a view trimmed to the array. origin holds the indices
+    in ar of its first element. The chunk is only valid during the call.
+  * ctx - Passed through to fn.
+  * write - Whether fn changes the elements; the chunks are then written back.
+  * order - The order in which to visit the chunks, as for md_iter_init: a permutation of
+    the dimensions, outermost first, or NULL for row-major order. The innermost dimension
+    of the order is the axis of traversal that is read ahead along.
+Returns: void.
+Purpose: Streams a chunked array through memory a chunk at a time.*/
+void md_for_each_chunk(struct MD_CHUNKED* ar, MD_CHUNK_FN fn, void* ctx, bool write = false, const unsigned int order[] = NULL);
+
+template <typename F>
+static void _md_for_each_chunk_thunk(ARRAYLIKE chunk, const size_t origin[], void* ctx) {
+	(*(F*)ctx)(chunk, origin);
+}
+
+//The same as above for any functor callable as f(chunk, origin).
+template <typename F>
+void md_for_each_chunk(struct MD_CHUNKED* ar, F f, bool write = false, const unsigned int order[] = NULL) {
+	md_for_each_chunk(ar, _md_for_each_chunk_thunk<F>, &f, write, order);
+}
+
+/* Accepts:
+  * ar - A chunked array opened for writing, or a slice md_index took on one.
+Returns: The pointer md_getptr gives for ar, with its chunk marked as changed, so that writes
+through it reach the file. It stays valid until the next call that touches the same chunked
+array.*/
+char* md_chunked_writable(ARRAYLIKE ar);
+
+/* Accepts:
+  * ar - A chunked array.
+  * origin - The indices in ar of the first element of the box.
+  * dst - An array, array slice or view with the element size of ar; its shape is the shape
+    of the box, which must lie within ar.
+Purpose: Copies a box of elements of ar, which may span any number of chunks, into dst.*/
+void md_chunked_read(struct MD_CHUNKED* ar, const size_t origin[], ARRAYLIKE dst);
+
+/* Accepts:
+  * ar - A chunked array opened for writing.
+  * origin - The indices in ar of the first element of the box.
+  * src - An array, array slice or view with the element size of ar, the shape of the box.
+Purpose: Copies src into a box of elements of ar.*/
+void md_chunked_write(struct MD_CHUNKED* ar, const size_t origin[], ARRAYLIKE src);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _JC_MD_COLUMNS
+#define _JC_MD_COLUMNS
+
+#include "multiarray.h"
+#include "reflectable.h"
+
+/*Notes:
+Columnar (struct-of-arrays) storage for multi-arrays of REFLECTABLE records. An array of
+records is normally one block in which each element is a whole record, so a pass over one
+field brings every other field through the cache with it. A columnar array keeps the same
+dimensions but stores each member of the record, as listed by its REFLECT structure, in an
+array of its own: md_column gives that array, which is an ordinary MD_ARRAY with the
+member as its element, dense and aligned, and can be passed to md_sum, md_iter, md_map and
+the rest. A filter or aggregate over one field then reads only that field's bytes, in
+order, and vectorizes.
+
+md_to_columns and md_from_columns convert from and to the record-per-element layout.
+Members that are themselves records make a column of those records. md_free frees a
+columnar array with all its columns; md_shape gives its dimensions.*/
+
+struct MD_COLUMNS : public MD_ARRAYLIKE {
+	//struct_identifier must be AAAAF
+	const struct REFLECT* type; //The record type
+	unsigned int n_dims;
+	size_t dims[MAX_DIMENSIONS];
+	struct MD_ARRAY* columns[REFLECT_MAX_MEMBERS]; //One per member of type, in order
+};
+
+/* Accepts:
+  * type - The record type.
+  * _md_dims, n_dims - The dimensions, as for _md_alloc.
+Returns: A columnar array of records of type, with every column zeroed. Free it with
+md_free.*/
+struct MD_COLUMNS* _md_columns_alloc(const struct REFLECT* type, const size_t _md_dims[], unsigned int n_dims);
+
+#if SIZE_MAX > UINT_MAX
+static inline struct MD_COLUMNS* _md_columns_alloc(const struct REFLECT* type, const unsigned int _md_dims[], unsigned int n_dims) {
+	size_t wide[MAX_DIMENSIONS];
+
+	return(_md_columns_alloc(type, _md_widen_dims(_md_dims, n_dims, wide), n_dims));
+}
+#endif
+
+//The same, given the C array of dimensions and the name of a REFLECTABLE type.
+#define md_columns_alloc(_md_dims, TYPE) (_md_columns_alloc(&definition_##TYPE, (_md_dims), N_ELEMS(_md_dims)))
+
+/* Accepts:
+  * cols - A columnar array.
+  * member_name - The name of a member of its record type.
+Returns: The column of that member, of the same dimensions as cols; NULL when the type
+has no such member.
+Note: The column belongs to cols, and is freed with it; do not resize or free it.*/
+struct MD_ARRAY* md_column(const struct MD_COLUMNS* cols, const char member_name[]);
+
+/* Accepts:
+  * ar - An array, array slice or view whose elements are records of type.
+  * type - The record type; its bytessize must be the element size of ar.
+Returns: A new columnar array holding the elements of ar.*/
+struct MD_COLUMNS* md_to_columns(ARRAYLIKE ar, const struct REFLECT* type);
+
+/* Accepts:
+  * cols - A columnar array.
+Returns: A new array of the same dimensions whose elements are whole records, assembled
+from the columns.*/
+struct MD_ARRAY* md_from_columns(const struct MD_COLUMNS* cols);
+
+#endif
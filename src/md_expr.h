@@ -0,0 +1,406 @@
+#ifndef _JC_MD_EXPR
+#define _JC_MD_EXPR
+
+#include <string.h>
+#include "multiarray.h"
+#include "md_parallel.h"
+
+/*Notes:
+Lazy elementwise expressions over multi-arrays. md_expr<T>(ar) wraps an array, slice or
+view; the arithmetic operators and md_minimum/md_maximum on wrapped operands (and on
+scalars of type T) build a tree of small structs instead of computing anything. The tree
+is evaluated in one pass when it is assigned to an array:
+
+	md_expr<float>(out) = md_expr<float>(a) * md_expr<float>(b) + md_expr<float>(c) * 0.5f;
+
+or when it is given to md_eval. Each element of the destination is then computed with a
+single loop that reads each operand once, with no temporary arrays in between.
+
+The operands are broadcast to the shape of the destination with the rules of md_arith.h.
+The destination is cut into blocks of MD_EXPR_BLOCK elements along its last axis, which are
+evaluated in parallel on the pool of md_parallel.h. Neighbouring axes that are contiguous in
+every operand are merged first, so packed arrays are one long row. Operands whose row is not
+contiguous (strided views, broadcast rows) are gathered into a small buffer per block, so
+the inner loop always reads contiguous memory and vectorizes.
+
+The destination may also appear among the operands, as long as it is walked in the same
+order there (the same array, or the same view).*/
+
+#define MD_EXPR_BLOCK 256
+
+//The base of every expression node; E is the node itself.
+template <typename E>
+struct md_expr_base {
+	inline const E& self() const { return *static_cast<const E*>(this); }
+};
+
+//Merges shape into the broadcast shape dims, as md_broadcast_shape does.
+static inline void _md_expr_shape(size_t dims[], unsigned int* p_n_dims, const size_t shape[], unsigned int n) {
+	size_t merged[MAX_DIMENSIONS], x, y;
+	unsigned int k, m = *p_n_dims > n ? *p_n_dims : n;
+
+	for (k=0;k<m;k++) {
+		x = k + *p_n_dims >= m ? dims[k+*p_n_dims-m] : 1;
+		y = k + n >= m ? shape[k+n-m] : 1;
+		if (x != y && x != 1 && y != 1) {
+			fprintf(stderr, "md_eval: dimension %u has sizes %zu and %zu\n", k, x, y);
+			throw MULTIARRAY_EX();
+		}
+		merged[k] = x == 1 ? y : x;
+	}
+	memcpy(dims, merged, sizeof(size_t) * m);
+	*p_n_dims = m;
+}
+
+template <typename T> struct md_leaf_expr;
+
+template <typename E>
+void md_eval(ARRAYLIKE out, const md_expr_base<E>& expr);
+
+/* The nodes share one interface, which md_eval drives:
+  * shape - Merges the shapes of the operands into a broadcast shape.
+  * bind - Broadcasts the operands to the shape of the destination, and numbers their
+    gather buffers from first; returns the next free number.
+  * mergeable, merge - Whether axes k and k+1 are contiguous in every operand, and
+    merging them into one.
+  * load - Points every operand at a block of count elements of the row idx, starting at
+    column j0, gathering into bufs where the row is not contiguous.
+  * at - Element j of the block.*/
+
+//An array, slice or view operand. Assigning an expression to it evaluates into the array.
+template <typename T>
+struct md_leaf_expr : public md_expr_base<md_leaf_expr<T> > {
+	typedef T value_type;
+	enum { n_leaves = 1 };
+
+	struct MD_VIEW view;
+	unsigned int id;
+	const T* cur;
+
+	explicit md_leaf_expr(ARRAYLIKE ar) {
+		size_t dims[MAX_DIMENSIONS];
+		unsigned int n_dims;
+
+		if (md_type_size(md_base(ar)) != sizeof(T)) {
+			fputs("md_expr: element size of the array does not match the expression", stderr);
+			throw MULTIARRAY_EX();
+		}
+		n_dims = md_shape(ar, dims);
+		view = md_broadcast_to(ar, n_dims, dims);
+		id = 0;
+		cur = NULL;
+	}
+
+	md_leaf_expr(const md_leaf_expr& other) : view(other.view), id(other.id), cur(other.cur) {
+	}
+
+	template <typename E>
+	md_leaf_expr& operator=(const md_expr_base<E>& e) {
+		md_eval(&view, e);
+		return *this;
+	}
+
+	md_leaf_expr& operator=(const md_leaf_expr& e) {
+		md_eval(&view, e);
+		return *this;
+	}
+
+	inline void shape(size_t dims[], unsigned int* p_n_dims) const {
+		_md_expr_shape(dims, p_n_dims, view.dims, view.n_dims);
+	}
+
+	inline unsigned int bind(unsigned int n_dims, const size_t dims[], unsigned int first) {
+		view = md_broadcast_to(&view, n_dims, dims);
+		id = first;
+		return first + 1;
+	}
+
+	inline bool mergeable(unsigned int k) const {
+		return view.strides[k] == view.strides[k+1] * (ptrdiff_t)view.dims[k+1];
+	}
+
+	inline void merge(unsigned int k) {
+		unsigned int i;
+
+		view.dims[k] *= view.dims[k+1];
+		view.strides[k] = view.strides[k+1];
+		for (i=k+1;i+1<view.n_dims;i++) {
+			view.dims[i] = view.dims[i+1];
+			view.strides[i] = view.strides[i+1];
+		}
+		view.n_dims--;
+	}
+
+	//Returns: The address of column j0 of the row idx.
+	inline char* address(const size_t idx[], size_t j0) const {
+		char* p = view.p_indexing_base;
+		unsigned int k;
+
+		for (k=0;k+1<view.n_dims;k++) p += (ptrdiff_t)idx[k] * view.strides[k];
+		return p + (ptrdiff_t)j0 * view.strides[view.n_dims-1];
+	}
+
+	inline ptrdiff_t step() const {
+		return view.strides[view.n_dims-1];
+	}
+
+	inline void load(const size_t idx[], size_t j0, size_t count, T (*bufs)[MD_EXPR_BLOCK]) {
+		const char* p = address(idx, j0);
+		ptrdiff_t s = step();
+		T* b;
+		size_t j;
+
+		if (s == sizeof(T)) {
+			cur = (const T*)p;
+			return;
+		}
+		b = bufs[id];
+		if (s == 0) {
+			for (j=0;j<count;j++) b[j] = *(const T*)p;
+		} else {
+			for (j=0;j<count;j++) b[j] = *(const T*)(p + (ptrdiff_t)j * s);
+		}
+		cur = b;
+	}
+
+	inline T at(size_t j) const {
+		return cur[j];
+	}
+};
+
+//A constant operand.
+template <typename T>
+struct md_scalar_expr : public md_expr_base<md_scalar_expr<T> > {
+	typedef T value_type;
+	enum { n_leaves = 0 };
+
+	T v;
+
+	explicit md_scalar_expr(T v) : v(v) {
+	}
+
+	inline void shape(size_t[], unsigned int*) const {
+	}
+	inline unsigned int bind(unsigned int, const size_t[], unsigned int first) {
+		return first;
+	}
+	inline bool mergeable(unsigned int) const {
+		return true;
+	}
+	inline void merge(unsigned int) {
+	}
+	inline void load(const size_t[], size_t, size_t, T (*)[MD_EXPR_BLOCK]) {
+	}
+	inline T at(size_t) const {
+		return v;
+	}
+};
+
+template <typename OP, typename A, typename B>
+struct md_binary_expr : public md_expr_base<md_binary_expr<OP, A, B> > {
+	typedef typename A::value_type value_type;
+	enum { n_leaves = A::n_leaves + B::n_leaves };
+
+	A a;
+	B b;
+
+	md_binary_expr(const A& a, const B& b) : a(a), b(b) {
+	}
+
+	inline void shape(size_t dims[], unsigned int* p_n_dims) const {
+		a.shape(dims, p_n_dims);
+		b.shape(dims, p_n_dims);
+	}
+	inline unsigned int bind(unsigned int n_dims, const size_t dims[], unsigned int first) {
+		return b.bind(n_dims, dims, a.bind(n_dims, dims, first));
+	}
+	inline bool mergeable(unsigned int k) const {
+		return a.mergeable(k) && b.mergeable(k);
+	}
+	inline void merge(unsigned int k) {
+		a.merge(k);
+		b.merge(k);
+	}
+	inline void load(const size_t idx[], size_t j0, size_t count, value_type (*bufs)[MD_EXPR_BLOCK]) {
+		a.load(idx, j0, count, bufs);
+		b.load(idx, j0, count, bufs);
+	}
+	inline value_type at(size_t j) const {
+		return OP::apply(a.at(j), b.at(j));
+	}
+};
+
+template <typename OP, typename A>
+struct md_unary_expr : public md_expr_base<md_unary_expr<OP, A> > {
+	typedef typename A::value_type value_type;
+	enum { n_leaves = A::n_leaves };
+
+	A a;
+
+	explicit md_unary_expr(const A& a) : a(a) {
+	}
+
+	inline void shape(size_t dims[], unsigned int* p_n_dims) const {
+		a.shape(dims, p_n_dims);
+	}
+	inline unsigned int bind(unsigned int n_dims, const size_t dims[], unsigned int first) {
+		return a.bind(n_dims, dims, first);
+	}
+	inline bool mergeable(unsigned int k) const {
+		return a.mergeable(k);
+	}
+	inline void merge(unsigned int k) {
+		a.merge(k);
+	}
+	inline void load(const size_t idx[], size_t j0, size_t count, value_type (*bufs)[MD_EXPR_BLOCK]) {
+		a.load(idx, j0, count, bufs);
+	}
+	inline value_type at(size_t j) const {
+		return OP::apply(a.at(j));
+	}
+};
+
+struct _md_op_add {
+	template <typename T> static inline T apply(T x, T y) { return (T)(x + y); }
+};
+struct _md_op_sub {
+	template <typename T> static inline T apply(T x, T y) { return (T)(x - y); }
+};
+struct _md_op_mul {
+	template <typename T> static inline T apply(T x, T y) { return (T)(x * y); }
+};
+struct _md_op_div {
+	template <typename T> static inline T apply(T x, T y) { return (T)(x / y); }
+};
+struct _md_op_minimum {
+	template <typename T> static inline T apply(T x, T y) { return y < x ? y : x; }
+};
+struct _md_op_maximum {
+	template <typename T> static inline T apply(T x, T y) { return y > x ? y : x; }
+};
+struct _md_op_neg {
+	template <typename T> static inline T apply(T x) { return (T)-x; }
+};
+
+/* Accepts:
+  * ar - An array, array slice or view with elements of type T.
+Returns: ar as an operand of an expression, or as the destination of one.*/
+template <typename T>
+static inline md_leaf_expr<T> md_expr(ARRAYLIKE ar) {
+	return md_leaf_expr<T>(ar);
+}
+
+//Defines FN for two expressions, and for an expression and a scalar on either side.
+#define MD_EXPR_BINARY(FN, OP) \
+	template <typename A, typename B> \
+	static inline md_binary_expr<OP, A, B> FN(const md_expr_base<A>& a, const md_expr_base<B>& b) { \
+		return md_binary_expr<OP, A, B>(a.self(), b.self()); \
+	} \
+	template <typename A> \
+	static inline md_binary_expr<OP, A, md_scalar_expr<typename A::value_type> > FN(const md_expr_base<A>& a, typename A::value_type s) { \
+		return md_binary_expr<OP, A, md_scalar_expr<typename A::value_type> >(a.self(), md_scalar_expr<typename A::value_type>(s)); \
+	} \
+	template <typename B> \
+	static inline md_binary_expr<OP, md_scalar_expr<typename B::value_type>, B> FN(typename B::value_type s, const md_expr_base<B>& b) { \
+		return md_binary_expr<OP, md_scalar_expr<typename B::value_type>, B>(md_scalar_expr<typename B::value_type>(s), b.self()); \
+	}
+
+MD_EXPR_BINARY(operator+, _md_op_add)
+MD_EXPR_BINARY(operator-, _md_op_sub)
+MD_EXPR_BINARY(operator*, _md_op_mul)
+MD_EXPR_BINARY(operator/, _md_op_div)
+MD_EXPR_BINARY(md_minimum, _md_op_minimum)
+MD_EXPR_BINARY(md_maximum, _md_op_maximum)
+
+template <typename A>
+static inline md_unary_expr<_md_op_neg, A> operator-(const md_expr_base<A>& a) {
+	return md_unary_expr<_md_op_neg, A>(a.self());
+}
+
+/* Accepts:
+  * out - An array, array slice or view with elements of the type of the expression.
+  * expr - An expression whose operands can be broadcast to the shape of out.
+Purpose: Evaluates expr into out in a single pass.
+Note: Throws MULTIARRAY_EX if an operand cannot be broadcast to out.*/
+template <typename E>
+void md_eval(ARRAYLIKE out, const md_expr_base<E>& expr) {
+	typedef typename E::value_type T;
+	md_leaf_expr<T> dst(out);
+	E e(expr.self());
+	size_t dims[MAX_DIMENSIONS], n_rows = 1, J, blocks_per_row, grain;
+	unsigned int n_dims, k, i;
+
+	n_dims = md_shape(out, dims);
+	//A 0-d destination is evaluated as a single row of one element.
+	if (n_dims == 0) dims[n_dims++] = 1;
+	dst.bind(n_dims, dims, E::n_leaves);
+	e.bind(n_dims, dims, 0);
+	//Merge from the innermost axis out; axis k then carries the stride of the merged pair.
+	for (k=n_dims-1;k-->0;) {
+		if (!dst.mergeable(k) || !e.mergeable(k)) continue;
+		dst.merge(k);
+		e.merge(k);
+		dims[k] *= dims[k+1];
+		for (i=k+1;i+1<n_dims;i++) dims[i] = dims[i+1];
+		n_dims--;
+	}
+	for (k=0;k+1<n_dims;k++) n_rows *= dims[k];
+	J = dims[n_dims-1];
+	if (!n_rows || !J) return;
+	blocks_per_row = (J + MD_EXPR_BLOCK - 1) / MD_EXPR_BLOCK;
+	grain = MD_PARALLEL_GRAIN / (J < MD_EXPR_BLOCK ? J : MD_EXPR_BLOCK);
+
+	md_parallel_for(n_rows * blocks_per_row, grain ? grain : 1, [&](size_t begin, size_t end) {
+		E local(e);
+		T bufs[E::n_leaves + 1][MD_EXPR_BLOCK];
+		size_t idx[MAX_DIMENSIONS], u, row, j0, count, j;
+		unsigned int d;
+		ptrdiff_t s = dst.step();
+		char* p;
+
+		for (u=begin;u<end;u++) {
+			row = u / blocks_per_row;
+			j0 = u % blocks_per_row * MD_EXPR_BLOCK;
+			count = J - j0 < MD_EXPR_BLOCK ? J - j0 : MD_EXPR_BLOCK;
+			for (d=n_dims-1;d-->0;) {
+				idx[d] = row % dims[d];
+				row /= dims[d];
+			}
+			local.load(idx, j0, count, bufs);
+			p = dst.address(idx, j0);
+			if (s == sizeof(T)) {
+				T* o = (T*)p;
+				for (j=0;j<count;j++) o[j] = local.at(j);
+			} else {
+				for (j=0;j<count;j++) *(T*)(p + (ptrdiff_t)j * s) = local.at(j);
+			}
+		}
+	});
+}
+
+/* Accepts:
+  * expr - An expression.
+Returns: A newly allocated array of the broadcast shape of the operands of expr, holding
+its value.*/
+template <typename E>
+struct MD_ARRAY* md_eval(const md_expr_base<E>& expr) {
+	size_t dims[MAX_DIMENSIONS];
+	unsigned int n_dims = 0;
+	struct MD_ARRAY* result;
+
+	expr.self().shape(dims, &n_dims);
+	if (!n_dims) {
+		fputs("md_eval: the expression has no array operand", stderr);
+		throw MULTIARRAY_EX();
+	}
+	result = _md_alloc(dims, n_dims, sizeof(typename E::value_type));
+	try {
+		md_eval(result, expr);
+	} catch (...) {
+		md_free(result);
+		throw;
+	}
+	return result;
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef _JC_MD_ITER
+#define _JC_MD_ITER
+
+#include <string.h>
+#include "multiarray.h"
+
+/*Notes:
+md_iter walks every element of an array, slice or view without indexing. The axes are put
+in the order of the walk, and neighbouring axes that are contiguous with each other are
+merged, so that a packed array is a single run of elements however many dimensions it
+has. The walk then proceeds run by run: md_iter_next_run hands out a pointer and a length,
+and moving on to the next run costs one add per axis that wraps.
+
+By default the axes are walked in memory order, largest stride outermost, which visits
+the elements in the order they are laid out (C order for arrays; views with permuted or
+reversed axes are walked so that each run is as long as possible). An explicit order walks
+the elements in any axis order instead; order[0] is the outermost axis.
+
+An iterator is invalidated by md_resize and md_free on its array, as a slice is.*/
+
+struct MD_ITER {
+	unsigned int n_dims; //After merging; at least 1
+	size_t dims[MAX_DIMENSIONS]; //Outermost first
+	ptrdiff_t strides[MAX_DIMENSIONS]; //In bytes
+	ptrdiff_t wraps[MAX_DIMENSIONS]; //strides[k] * dims[k], taken off when axis k wraps
+	size_t idx[MAX_DIMENSIONS];
+	char* p; //Start of the next run
+	size_t remaining; //Elements not handed out yet
+	size_t el_sz;
+
+	//State of md_iter_next.
+	char* cur;
+	size_t run_left;
+};
+
+/* Accepts:
+  * it - The iterator to set up.
+  * ar - An array, array slice or view.
+  * order - A permutation of the dimensions of ar, outermost first, or NULL for memory order.
+Purpose: Prepares it to walk ar.*/
+static void md_iter_init(struct MD_ITER* it, ARRAYLIKE ar, const unsigned int order[]) {
+	size_t dims[MAX_DIMENSIONS];
+	ptrdiff_t strides[MAX_DIMENSIONS];
+	unsigned int axes[MAX_DIMENSIONS];
+	unsigned int n_dims, i, k, a;
+	unsigned long long seen = 0;
+
+	n_dims = md_shape(ar, dims);
+	md_strides(ar, strides);
+	it->el_sz = md_type_size(md_base(ar));
+	it->p = md_getptr(ar);
+	it->remaining = 1;
+	for (k=0;k<n_dims;k++) it->remaining *= dims[k];
+
+	if (order) {
+		for (k=0;k<n_dims;k++) {
+			if (order[k] >= n_dims || (seen & (1ull << order[k]))) {
+				fputs("md_iter_init: order must be a permutation of the dimensions", stderr);
+				throw MULTIARRAY_EX();
+			}
+			seen |= 1ull << order[k];
+			axes[k] = order[k];
+		}
+	} else {
+		//Insertion sort by decreasing stride magnitude; stable, so ties keep C order.
+		for (k=0;k<n_dims;k++) {
+			a = k;
+			for (i=k;i>0&&(strides[axes[i-1]] < 0 ? -strides[axes[i-1]] : strides[axes[i-1]]) < (strides[a] < 0 ? -strides[a] : strides[a]);i--) {
+				axes[i] = axes[i-1];
+			}
+			axes[i] = a;
+		}
+	}
+
+	//Drop axes of size 1, and merge an axis into the next when it steps over it exactly.
+	it->n_dims = 0;
+	for (k=0;k<n_dims;k++) {
+		a = axes[k];
+		if (dims[a] == 1) continue;
+		if (it->n_dims && it->strides[it->n_dims-1] == strides[a] * (ptrdiff_t)dims[a]) {
+			it->dims[it->n_dims-1] *= dims[a];
+			it->strides[it->n_dims-1] = strides[a];
+			continue;
+		}
+		it->dims[it->n_dims] = dims[a];
+		it->strides[it->n_dims] = strides[a];
+		it->n_dims++;
+	}
+	if (it->n_dims == 0) {
+		it->dims[0] = 1;
+		it->strides[0] = (ptrdiff_t)it->el_sz;
+		it->n_dims = 1;
+	}
+	for (k=0;k<it->n_dims;k++) {
+		it->wraps[k] = it->strides[k] * (ptrdiff_t)it->dims[k];
+		it->idx[k] = 0;
+	}
+	it->cur = NULL;
+	it->run_left = 0;
+}
+
+//Returns: The distance in bytes between the elements of a run.
+static inline ptrdiff_t md_iter_step(const struct MD_ITER* it) {
+	return it->strides[it->n_dims-1];
+}
+
+/* Accepts:
+  * it - An iterator.
+  * p_count - Receives the number of elements in the run.
+Returns: The first element of the next run of elements, which are md_iter_step(it) bytes
+apart, or NULL when the walk is over.*/
+static inline char* md_iter_next_run(struct MD_ITER* it, size_t* p_count) {
+	char* run = it->p;
+	unsigned int k;
+
+	if (!it->remaining) return NULL;
+	*p_count = it->dims[it->n_dims-1];
+	it->remaining -= *p_count;
+	for (k=it->n_dims-1;k-->0;) {
+		it->p += it->strides[k];
+		if (++it->idx[k] < it->dims[k]) break;
+		it->p -= it->wraps[k];
+		it->idx[k] = 0;
+	}
+	return run;
+}
+
+/* Accepts:
+  * it - An iterator.
+Returns: The next element, or NULL when the walk is over.
+Note: Do not mix with md_iter_next_run on the same iterator.*/
+static inline char* md_iter_next(struct MD_ITER* it) {
+	if (it->run_left) {
+		it->cur += it->strides[it->n_dims-1];
+	} else {
+		it->cur = md_iter_next_run(it, &it->run_left);
+		if (!it->cur) return NULL;
+	}
+	it->run_left--;
+	return it->cur;
+}
+
+/*md_range<T> adapts md_iter to range-based for loops:
+
+	for (float& x : md_range<float>(ar)) x *= 2;
+
+The elements are visited in memory order unless an order is given.*/
+template <typename T>
+class md_range {
+	struct MD_ITER it;
+
+public:
+	class iterator {
+		struct MD_ITER* it;
+		char* p;
+		ptrdiff_t step;
+		size_t left; //Elements left in the current run
+		size_t remaining; //Elements left in the walk, the current one included
+
+	public:
+		iterator(struct MD_ITER* it, bool at_end) : it(it), p(NULL), step(md_iter_step(it)), left(0), remaining(0) {
+			if (!at_end && it->remaining) {
+				remaining = it->remaining;
+				p = md_iter_next_run(it, &left);
+			}
+		}
+
+		inline T& operator*() const { return *(T*)p; }
+
+		inline iterator& operator++() {
+			remaining--;
+			if (--left) p += step;
+			else if (remaining) p = md_iter_next_run(it, &left);
+			return *this;
+		}
+
+		inline bool operator!=(const iterator& other) const { return remaining != other.remaining; }
+		inline bool operator==(const iterator& other) const { return remaining == other.remaining; }
+	};
+
+	/* Accepts:
+	  * ar - An array, array slice or view whose elements have the size of T.
+	  * order - As for md_iter_init.
+	Note: Throws MULTIARRAY_EX if the element size does not match.*/
+	explicit md_range(ARRAYLIKE ar, const unsigned int order[] = NULL) {
+		if (md_type_size(md_base(ar)) != sizeof(T)) {
+			fputs("md_range: element size of the array does not match the range", stderr);
+			throw MULTIARRAY_EX();
+		}
+		md_iter_init(&it, ar, order);
+	}
+
+	//A range can be walked once.
+	iterator begin() { return iterator(&it, false); }
+	iterator end() { return iterator(&it, true); }
+};
+
+#endif
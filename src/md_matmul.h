@@ -0,0 +1,29 @@
+#ifndef _JC_MD_MATMUL
+#define _JC_MD_MATMUL
+
+#include "multiarray.h"
+
+/*Notes:
+Dense matrix multiplication on 2-dimensional multi-arrays, without an external BLAS. The
+template is instantiated for float, double, int and long long in matmul.cpp.
+
+The product is computed the way optimized BLAS libraries do it: b is copied a panel at a
+time, and a a block at a time, into buffers laid out in the order a small register-tiled
+kernel reads them, sized to stay in the L1, L2 and L3 caches. The kernel holds a 6x16 (float)
+or 6x8 (double) tile of the product in AVX registers when the library is built with AVX and
+FMA, and is plain C++ that the compiler vectorizes otherwise. Tiles of the product are
+spread over the thread pool of md_parallel.h; every element is summed in the same order
+whatever the number of threads.*/
+
+/* Accepts:
+  * a - An array, array slice or view of 2 dimensions [m, k], with elements of type T.
+  * b - The same, of dimensions [k, n].
+  * out - An array, array slice or view of dimensions [m, n] with elements of type T, or
+    NULL. It must not share memory with a or b.
+Returns: A newly allocated [m, n] array holding the product of a and b when out is NULL;
+otherwise NULL, and the product is stored into out.
+Note: Throws MULTIARRAY_EX if the shapes do not agree.*/
+template <typename T>
+struct MD_ARRAY* md_matmul(ARRAYLIKE a, ARRAYLIKE b, ARRAYLIKE out = NULL);
+
+#endif
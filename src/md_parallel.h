@@ -0,0 +1,241 @@
+#ifndef _JC_MD_PARALLEL
+#define _JC_MD_PARALLEL
+
+#include <string.h>
+#include "multiarray.h"
+
+/*Notes:
+Bulk elementwise operations on multi-arrays, run on a persistent work-stealing thread pool.
+
+md_fill, md_map and md_zip split the elements of their operands into chunks and hand the
+chunks to the pool; an idle worker steals chunks from the others, so uneven functors still
+keep every core busy. Arrays and slices are contiguous and are walked as one flat buffer;
+views are walked row by row along their innermost axis.
+
+The number of threads is set with md_set_num_threads. Calls made from inside a pool task
+run serially on the calling thread. An exception thrown by a functor is rethrown by the
+operation after all of its chunks have finished.*/
+
+typedef void (*MD_RANGE_FN)(size_t begin, size_t end, void* ctx);
+
+/* Accepts:
+  * n - The number of threads the pool should use; 0 selects the number of hardware threads.
+Purpose: Resizes the pool. The workers are started lazily by the next parallel operation.
+Note: Must not be called while a parallel operation is running.*/
+void md_set_num_threads(unsigned int n);
+
+//Returns: The number of threads parallel operations are spread over (including the caller).
+unsigned int md_get_num_threads();
+
+/* Accepts:
+  * n - The size of the index range [0, n).
+  * grain - The smallest number of indices worth running as one task; 0 picks a default.
+  * fn - Called with disjoint subranges [begin, end) that together cover [0, n).
+  * ctx - Passed through to fn.
+Purpose: Runs fn over [0, n) on the thread pool and returns once every subrange is done.*/
+void md_parallel_for(size_t n, size_t grain, MD_RANGE_FN fn, void* ctx);
+
+template <typename F>
+static void _md_parallel_for_thunk(size_t begin, size_t end, void* ctx) {
+	(*(F*)ctx)(begin, end);
+}
+
+//The same as above for any functor callable as f(begin, end).
+template <typename F>
+void md_parallel_for(size_t n, size_t grain, F f) {
+	md_parallel_for(n, grain, _md_parallel_for_thunk<F>, &f);
+}
+
+#define MD_PARALLEL_GRAIN 16384
+
+//Describes up to three operands of one shape for the elementwise walkers.
+struct _md_walk {
+	unsigned int n_dims;
+	size_t dims[MAX_DIMENSIONS];
+	unsigned int n_ops;
+	char* p[3];
+	ptrdiff_t strides[3][MAX_DIMENSIONS];
+	bool contiguous;
+	size_t n_elems;
+};
+
+static void _md_walk_init(struct _md_walk* w, unsigned int n_ops, ARRAYLIKE ops[], const size_t el_sz[], const char* fn_name) {
+	size_t dims[MAX_DIMENSIONS];
+	unsigned int i, k;
+	ptrdiff_t packed;
+
+	w->n_ops = n_ops;
+	w->n_dims = md_shape(ops[0], w->dims);
+	w->contiguous = true;
+	w->n_elems = 1;
+	for (k=0;k<w->n_dims;k++) w->n_elems *= w->dims[k];
+	for (i=0;i<n_ops;i++) {
+		if (md_type_size(md_base(ops[i])) != el_sz[i]) {
+			fprintf(stderr, "%s: element size of operand %u does not match the functor\n", fn_name, i);
+			throw MULTIARRAY_EX();
+		}
+		if (md_shape(ops[i], dims) != w->n_dims || memcmp(dims, w->dims, sizeof(size_t) * w->n_dims)) {
+			fprintf(stderr, "%s: operand %u does not have the shape of operand 0\n", fn_name, i);
+			throw MULTIARRAY_EX();
+		}
+		w->p[i] = md_getptr(ops[i]);
+		md_strides(ops[i], w->strides[i]);
+		packed = el_sz[i];
+		for (k=w->n_dims;k-->0;) {
+			if (w->dims[k] > 1 && w->strides[i][k] != packed) w->contiguous = false;
+			packed *= w->dims[k];
+		}
+	}
+}
+
+/* Calls row(p[], step[], count) for the elements [begin, end) of the walk, in runs along
+the innermost axis; p[] holds the address of the first element of each operand and step[]
+the distance to the next. Contiguous operands are handled as a single run.*/
+template <typename R>
+static void _md_walk_range(const struct _md_walk* w, size_t begin, size_t end, R row) {
+	char* p[3];
+	ptrdiff_t step[3];
+	size_t idx[MAX_DIMENSIONS];
+	unsigned int i, k;
+	size_t inner, rest, count;
+
+	if (begin >= end) return;
+	if (w->contiguous || w->n_dims == 0) {
+		for (i=0;i<w->n_ops;i++) {
+			step[i] = w->n_dims ? w->strides[i][w->n_dims-1] : 0;
+			p[i] = w->p[i] + (ptrdiff_t)begin * step[i];
+		}
+		row(p, step, end - begin);
+		return;
+	}
+	inner = w->dims[w->n_dims-1];
+	rest = begin;
+	for (k=w->n_dims;k-->0;) {
+		idx[k] = rest % w->dims[k];
+		rest /= w->dims[k];
+	}
+	for (i=0;i<w->n_ops;i++) {
+		step[i] = w->strides[i][w->n_dims-1];
+		p[i] = w->p[i];
+		for (k=0;k<w->n_dims;k++) p[i] += (ptrdiff_t)idx[k] * w->strides[i][k];
+	}
+	while (begin < end) {
+		count = inner - idx[w->n_dims-1];
+		if (count > end - begin) count = end - begin;
+		row(p, step, count);
+		begin += count;
+		if (begin >= end) break;
+		//Move to the start of the next row.
+		for (i=0;i<w->n_ops;i++) p[i] -= (ptrdiff_t)idx[w->n_dims-1] * step[i];
+		idx[w->n_dims-1] = 0;
+		for (k=w->n_dims-1;k-->0;) {
+			for (i=0;i<w->n_ops;i++) p[i] += w->strides[i][k];
+			if (++idx[k] < w->dims[k]) break;
+			for (i=0;i<w->n_ops;i++) p[i] -= (ptrdiff_t)idx[k] * w->strides[i][k];
+			idx[k] = 0;
+		}
+	}
+}
+
+/* Accepts:
+  * ar - An array, array slice or view with elements of type T.
+  * value - The value to store.
+Purpose: Sets every element of ar to value, in parallel.*/
+template <typename T>
+void md_fill(ARRAYLIKE ar, const T& value) {
+	struct _md_walk w;
+	const size_t el_sz[] = {sizeof(T)};
+
+	_md_walk_init(&w, 1, &ar, el_sz, "md_fill");
+	md_parallel_for(w.n_elems, MD_PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+		_md_walk_range(&w, begin, end, [&](char** p, const ptrdiff_t* step, size_t count) {
+			size_t j;
+
+			if (step[0] == sizeof(T)) {
+				T* d = (T*)p[0];
+				for (j=0;j<count;j++) d[j] = value;
+			} else {
+				for (j=0;j<count;j++) *(T*)(p[0] + (ptrdiff_t)j * step[0]) = value;
+			}
+		});
+	});
+}
+
+/* Accepts:
+  * out - An array, array slice or view with elements of type TOut.
+  * in - An array, array slice or view of the same shape with elements of type TIn. It may
+    be out itself.
+  * f - A function or functor taking a TIn and returning a TOut.
+Purpose: Stores f(x) into out for every element x of in, in parallel.*/
+template <typename TOut, typename TIn, typename F>
+void md_map(ARRAYLIKE out, ARRAYLIKE in, F f) {
+	struct _md_walk w;
+	ARRAYLIKE ops[] = {out, in};
+	const size_t el_sz[] = {sizeof(TOut), sizeof(TIn)};
+
+	_md_walk_init(&w, 2, ops, el_sz, "md_map");
+	md_parallel_for(w.n_elems, MD_PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+		_md_walk_range(&w, begin, end, [&](char** p, const ptrdiff_t* step, size_t count) {
+			size_t j;
+
+			if (step[0] == sizeof(TOut) && step[1] == sizeof(TIn)) {
+				TOut* d = (TOut*)p[0];
+				const TIn* a = (const TIn*)p[1];
+				for (j=0;j<count;j++) d[j] = f(a[j]);
+			} else {
+				for (j=0;j<count;j++) *(TOut*)(p[0] + (ptrdiff_t)j * step[0]) = f(*(const TIn*)(p[1] + (ptrdiff_t)j * step[1]));
+			}
+		});
+	});
+}
+
+//In-place form: replaces every element x of ar, of type T, with f(x).
+template <typename T, typename F>
+void md_map(ARRAYLIKE ar, F f) {
+	md_map<T, T>(ar, ar, f);
+}
+
+/* Accepts:
+  * out - An array, array slice or view with elements of type TOut.
+  * a, b - Arrays, array slices or views of the same shape, with elements of types TA and TB.
+    Either may be out itself.
+  * f - A function or functor taking a TA and a TB and returning a TOut.
+Purpose: Stores f(x, y) into out for every pair of corresponding elements of a and b,
+in parallel.*/
+template <typename TOut, typename TA, typename TB, typename F>
+void md_zip(ARRAYLIKE out, ARRAYLIKE a, ARRAYLIKE b, F f) {
+	struct _md_walk w;
+	ARRAYLIKE ops[] = {out, a, b};
+	const size_t el_sz[] = {sizeof(TOut), sizeof(TA), sizeof(TB)};
+
+	_md_walk_init(&w, 3, ops, el_sz, "md_zip");
+	md_parallel_for(w.n_elems, MD_PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+		_md_walk_range(&w, begin, end, [&](char** p, const ptrdiff_t* step, size_t count) {
+			size_t j;
+
+			if (step[0] == sizeof(TOut) && step[1] == sizeof(TA) && step[2] == sizeof(TB)) {
+				TOut* d = (TOut*)p[0];
+				const TA* x = (const TA*)p[1];
+				const TB* y = (const TB*)p[2];
+				for (j=0;j<count;j++) d[j] = f(x[j], y[j]);
+			} else if (step[0] == sizeof(TOut) && step[1] == sizeof(TA) && step[2] == 0) {
+				//b repeats one element along the row, as a broadcast column does.
+				TOut* d = (TOut*)p[0];
+				const TA* x = (const TA*)p[1];
+				const TB y = *(const TB*)p[2];
+				for (j=0;j<count;j++) d[j] = f(x[j], y);
+			} else if (step[0] == sizeof(TOut) && step[1] == 0 && step[2] == sizeof(TB)) {
+				TOut* d = (TOut*)p[0];
+				const TA x = *(const TA*)p[1];
+				const TB* y = (const TB*)p[2];
+				for (j=0;j<count;j++) d[j] = f(x, y[j]);
+			} else {
+				for (j=0;j<count;j++) {
+					*(TOut*)(p[0] + (ptrdiff_t)j * step[0]) = f(*(const TA*)(p[1] + (ptrdiff_t)j * step[1]), *(const TB*)(p[2] + (ptrdiff_t)j * step[2]));
+				}
+			}
+		});
+	});
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _JC_MD_REDUCE
+#define _JC_MD_REDUCE
+
+#include <type_traits>
+#include "multiarray.h"
+
+/*Notes:
+Reductions over the elements of multi-arrays, for the built-in integer and floating point
+element types (the templates are instantiated for those in reduce.cpp).
+
+md_reduce reduces along one axis and returns a new array of one lower rank; md_sum, md_min,
+md_max, md_mean, md_argmin and md_argmax reduce a whole array, slice or view to a scalar.
+
+Runs of contiguous elements are reduced in 8 independent lanes, which the compiler keeps in
+vector registers. Floating point sums are pairwise over contiguous runs and compensated
+(Kahan) elsewhere, so their error does not grow with the length of the axis. Large
+reductions are split over the thread pool of md_parallel.h into a fixed number of parts
+that depends only on the shape, so that the result does not depend on the thread count.
+
+Comparisons are made with < and >; minima and maxima of arrays holding NaNs are undefined.*/
+
+//Operations of md_reduce, and the element type of the array it returns for elements of type T.
+#define MD_SUM 0 //md_reduce_types<T>::sum_type
+#define MD_MIN 1 //T
+#define MD_MAX 2 //T
+#define MD_MEAN 3 //md_reduce_types<T>::mean_type
+#define MD_ARGMIN 4 //size_t, the index along the axis of the first minimum
+#define MD_ARGMAX 5 //size_t, the index along the axis of the first maximum
+
+//Integers are summed in 64 bits and averaged in double; floating point types in themselves.
+template <typename T>
+struct md_reduce_types {
+	typedef typename std::conditional<std::is_floating_point<T>::value, T,
+		typename std::conditional<std::is_signed<T>::value, long long, unsigned long long>::type>::type sum_type;
+	typedef typename std::conditional<std::is_floating_point<T>::value, T, double>::type mean_type;
+};
+
+/* Accepts:
+  * ar - An array, array slice or view with elements of type T.
+  * axis - The dimension to reduce.
+  * op - One of MD_SUM, MD_MIN, MD_MAX, MD_MEAN, MD_ARGMIN and MD_ARGMAX.
+Returns: A newly allocated array with the dimensions of ar other than axis, holding the
+reduction of each line of elements along axis. Reducing an array of one dimension gives an
+array of one element.
+Note: Throws MULTIARRAY_EX for MD_MIN, MD_MAX, MD_ARGMIN and MD_ARGMAX along an axis of size
+0. The mean along an axis of size 0 is NaN.*/
+template <typename T>
+struct MD_ARRAY* md_reduce(ARRAYLIKE ar, unsigned int axis, unsigned int op);
+
+/* Accepts:
+  * ar - An array, array slice or view with elements of type T.
+Returns: The sum, minimum, maximum or mean of all the elements of ar, or the index of the
+first minimum or maximum counted in C order (the last dimension varying fastest).
+Note: md_min, md_max, md_argmin and md_argmax throw MULTIARRAY_EX for an empty array.*/
+template <typename T> typename md_reduce_types<T>::sum_type md_sum(ARRAYLIKE ar);
+template <typename T> T md_min(ARRAYLIKE ar);
+template <typename T> T md_max(ARRAYLIKE ar);
+template <typename T> typename md_reduce_types<T>::mean_type md_mean(ARRAYLIKE ar);
+template <typename T> size_t md_argmin(ARRAYLIKE ar);
+template <typename T> size_t md_argmax(ARRAYLIKE ar);
+
+#endif
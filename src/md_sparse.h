@@ -0,0 +1,133 @@
+#ifndef _JC_MD_SPARSE
+#define _JC_MD_SPARSE
+
+#include "multiarray.h"
+
+/*Notes:
+Sparse multi-arrays, for arrays that are mostly zero. A sparse array stores only its
+non-zero elements, so that its memory, and the cost of walking it with md_sparse_for_each,
+is proportional to their number rather than to the product of the dimensions. It carries a
+struct_identifier of its own, so md_free, md_getptr, md_shape and md_index accept it (and
+the slices md_index takes on it) like any other array-like object; md_base does not, as
+there is no dense block behind it. The pointer md_getptr gives is for reading only: for an
+element that is not stored it points to a block of zeros shared by the whole array, so a
+write through it would change every such element rather than store one. md_sparse_insert is
+the only way to write an element. Compile with -DMD_INDEX_CHECKS to have md_getptr,
+md_sparse_at and md_sparse_to_dense throw once the shared zeros have been written to.
+
+An element is addressed by its row-major linear index. The array is kept in one of three
+formats:
+  * MD_SPARSE_COO - unsorted (linear index, value) pairs. Cheap to append to with
+    md_sparse_insert; meant for building an array, since looking an element up scans it.
+  * MD_SPARSE_CSR - compressed sparse rows. The leading dimensions are flattened into rows
+    and the last dimension gives the columns; each row lists its columns in increasing
+    order, so an element is found by a binary search in its row.
+  * MD_SPARSE_BSR - the same, with dense block_rows x block_cols blocks in place of single
+    elements. Suited to data whose non-zeros cluster, and to kernels that want dense tiles.
+md_sparse_convert moves between the formats, and md_sparse_from_dense / md_sparse_to_dense
+to and from ordinary arrays. An element is zero when all its bytes are.*/
+
+#define MD_SPARSE_COO 0
+#define MD_SPARSE_CSR 1
+#define MD_SPARSE_BSR 2
+
+struct MD_SPARSE : public MD_ARRAYLIKE {
+	//struct_identifier must be AAAAD
+	unsigned int n_dims;
+	size_t type_size;
+
+	size_t dims[MAX_DIMENSIONS];
+	unsigned int format;
+	size_t nnz; //Entries stored: elements for COO and CSR (COO counts duplicates), blocks for BSR
+	size_t cap; //Entries p_index and p_values have room for
+	size_t block[2]; //Block rows and columns for BSR; 1 and 1 otherwise
+
+	size_t* p_index; //Linear indices (COO), columns (CSR) or block columns (BSR), one per entry
+	size_t* p_rows; //CSR and BSR: where each (block) row starts in p_index; one more than there are rows
+	char* p_values; //type_size bytes per element; block[0] * block[1] elements per BSR entry
+	char zero[1]; //type_size zero bytes, standing for the elements that are not stored
+};
+
+struct MD_SPARSE_SLICE : public MD_ARRAYLIKE {
+	//struct_identifier must be AAAAE
+	struct MD_SPARSE* p_base;
+	unsigned int n_dims; //Dimensions not yet indexed
+	size_t offset; //The indices taken so far, as a row-major linear index over their dimensions
+};
+
+struct MD_SPARSE* _md_sparse_alloc(const size_t _md_dims[], unsigned int n_dims, size_t size);
+
+#if SIZE_MAX > UINT_MAX
+static inline struct MD_SPARSE* _md_sparse_alloc(const unsigned int _md_dims[], unsigned int n_dims, size_t size) {
+	size_t wide[MAX_DIMENSIONS];
+
+	return(_md_sparse_alloc(_md_widen_dims(_md_dims, n_dims, wide), n_dims, size));
+}
+#endif
+
+/* Accepts:
+  * _md_dims - The dimensions, as a C array.
+  * type - The element type.
+Returns: An empty sparse array in COO format; every element reads as zero. Free it with
+md_free.*/
+#define md_sparse_alloc(_md_dims, type) (_md_sparse_alloc((_md_dims), N_ELEMS(_md_dims), sizeof(type)))
+
+/* Accepts:
+  * sp - A sparse array in COO format.
+  * idx - One index per dimension.
+Returns: The zeroed storage of a new entry for the element at idx, to be written by the
+caller. It stays valid until the next call that changes sp.
+Note: Inserting an element twice is allowed; the last insertion wins when the array is
+read or converted.*/
+void* md_sparse_insert(struct MD_SPARSE* sp, const size_t idx[]);
+
+/* Accepts:
+  * sp - A sparse array, or a slice of one.
+  * idx - One index for each dimension of sp.
+Returns: The stored element at idx, or NULL when it is not stored (and so reads as zero).
+Note: CSR and BSR take a binary search; COO takes a scan of all the entries.*/
+void* md_sparse_at(ARRAYLIKE sp, const size_t idx[]);
+
+/* Accepts:
+  * ar - An array, array slice or view.
+  * format - One of MD_SPARSE_COO, MD_SPARSE_CSR or MD_SPARSE_BSR.
+  * block_rows, block_cols - The block size for MD_SPARSE_BSR; ignored otherwise.
+Returns: A new sparse array holding the non-zero elements of ar.*/
+struct MD_SPARSE* md_sparse_from_dense(ARRAYLIKE ar, unsigned int format, size_t block_rows = 1, size_t block_cols = 1);
+
+/* Accepts:
+  * sp - A sparse array.
+Returns: A new dense array with the same dimensions and elements as sp.*/
+struct MD_ARRAY* md_sparse_to_dense(const struct MD_SPARSE* sp);
+
+/* Accepts:
+  * sp - A sparse array.
+  * format, block_rows, block_cols - As for md_sparse_from_dense.
+Returns: A new sparse array in the given format with the same elements as sp, which is left
+as it was. Duplicate COO entries are merged, keeping the last one; the zero padding of BSR
+blocks is dropped when converting away from BSR.*/
+struct MD_SPARSE* md_sparse_convert(const struct MD_SPARSE* sp, unsigned int format, size_t block_rows = 1, size_t block_cols = 1);
+
+typedef void (*MD_SPARSE_VISITOR)(const size_t idx[], void* value, void* ctx);
+
+/* Accepts:
+  * sp - A sparse array.
+  * f - Called with the indices and storage of each stored element.
+  * ctx - Passed on to f.
+Purpose: Visits the stored elements: in row-major order for CSR and BSR, and in order of
+insertion for COO, duplicates included. For BSR every element of a stored block that lies
+inside the array is visited, zero or not.*/
+void md_sparse_for_each(const struct MD_SPARSE* sp, MD_SPARSE_VISITOR f, void* ctx);
+
+template <typename F>
+static void _md_sparse_call(const size_t idx[], void* value, void* ctx) {
+	(*(F*)ctx)(idx, value);
+}
+
+//The same, with any callable taking (const size_t idx[], void* value).
+template <typename F>
+static inline void md_sparse_for_each(const struct MD_SPARSE* sp, F f) {
+	md_sparse_for_each(sp, &_md_sparse_call<F>, &f);
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef _JC_MD_STATS
+#define _JC_MD_STATS
+
+#include <stddef.h>
+
+/*Notes:
+Instrumentation of multi-array operations. Compile every file that includes multiarray.h
+with -DMD_STATS to turn it on; without it the counting statements below are not compiled
+in at all.
+
+Counters are kept per thread, so counting costs a few plain additions and never contends;
+md_stats_snapshot and md_stats_reset read and clear the counters of the calling thread,
+which makes it simple to find what one request costs. A hook can be registered to see
+every allocation, free and resize as it happens. A resize that moves an array to a new
+block also reports the new block as allocated and the old one as freed.*/
+
+#define MD_STATS_BUCKETS 40 //histogram bucket k counts values in [2^k, 2^(k+1)); bucket 0 also holds 0
+
+struct MD_COUNTERS {
+	unsigned long long index_calls; //slices and views taken by md_index, md_slice_at and md_#d
+	unsigned long long alloc_calls;
+	unsigned long long alloc_bytes;
+	unsigned long long free_calls;
+	unsigned long long free_bytes;
+	unsigned long long resize_calls; //md_resize, md_resize_all, md_reserve and copying md_unshare
+	unsigned long long resize_moves; //resizes that moved the elements to a new block
+	unsigned long long resize_bytes_moved;
+	unsigned long long resize_ns;
+	unsigned long long alloc_size_hist[MD_STATS_BUCKETS]; //by bytes allocated
+	unsigned long long resize_ns_hist[MD_STATS_BUCKETS]; //by nanoseconds taken
+};
+
+//Kinds of MD_EVENT.
+#define MD_EVENT_ALLOC 0
+#define MD_EVENT_FREE 1
+#define MD_EVENT_RESIZE 2
+
+struct MD_EVENT {
+	unsigned int kind;
+	const struct MD_ARRAY* ar; //The array allocated, about to be freed, or resized
+	size_t bytes; //Bytes allocated or freed; for a resize, the bytes moved
+	unsigned int dim_i; //For a resize, the dimension changed, or MD_EVENT_ALL_DIMS
+	size_t old_size, new_size; //For a resize, the old and new size (capacity for md_reserve) of dim_i
+	unsigned long long ns; //For a resize, the time it took
+};
+
+#define MD_EVENT_ALL_DIMS ((unsigned int)-1)
+
+typedef void (*MD_EVENT_HOOK)(const struct MD_EVENT* event, void* ctx);
+
+/* Accepts:
+  * stats - Receives the counters of the calling thread since it started or last called
+    md_stats_reset.*/
+void md_stats_snapshot(struct MD_COUNTERS* stats);
+
+//Purpose: Clears the counters of the calling thread.
+void md_stats_reset();
+
+/* Accepts:
+  * hook - Called on the thread that allocates, frees or resizes, after the operation
+    (before it, for frees); NULL removes the hook.
+  * ctx - Passed through to hook.
+Note: Set the hook before other threads start using the library.*/
+void md_set_event_hook(MD_EVENT_HOOK hook, void* ctx);
+
+#ifdef MD_STATS
+#define MD_STAT(...) __VA_ARGS__
+
+extern thread_local struct MD_COUNTERS _md_tls_stats;
+
+void _md_stats_alloc(const struct MD_ARRAY* ar);
+void _md_stats_free(const struct MD_ARRAY* ar);
+void _md_stats_resize_begin();
+void _md_stats_moved(size_t bytes);
+void _md_stats_resize_end(const struct MD_ARRAY* ar, unsigned int dim_i, size_t old_size, size_t new_size);
+#else
+#define MD_STAT(...)
+#endif
+
+#endif
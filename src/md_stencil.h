@@ -0,0 +1,89 @@
+#ifndef _JC_MD_STENCIL
+#define _JC_MD_STENCIL
+
+#include "multiarray.h"
+
+/*Notes:
+Stencils and convolution filters on 1-, 2- and 3-dimensional multi-arrays, for float and
+double elements (the template is instantiated for those in stencil.cpp).
+
+md_stencil sets every element of out to the weighted sum of the elements of in around the
+same position, with the weights of a kernel centred on it. This is a correlation, as image
+filters are usually written; flip the kernel for a convolution. Elements of the kernel that
+fall outside in are read as the boundary mode says.
+
+The output is computed a tile at a time. A tile of in, with a halo as wide as the kernel
+reaches, is copied into a buffer that stays in cache, the boundary mode is applied while
+copying, and each output row is then summed over the taps of the kernel in vector registers
+(AVX and FMA when the library is built with them), so neighbouring outputs share their
+loads. Separable kernels are applied one dimension at a time, at the cost of the sum of
+their extents rather than the product. Tiles are spread over the thread pool of
+md_parallel.h.
+
+Iterated stencils (steps > 1) are temporally blocked: a tile is loaded with a halo wide
+enough for several steps, which are all taken in cache before the tile is written out.
+The halo is computed redundantly by neighbouring tiles, in exchange for one trip through
+memory per block of steps instead of one per step.
+
+in and out may be in any layout (see md_alloc_layout), including tiled and Morton order.*/
+
+//Boundary modes of md_stencil: what elements beyond the edges of in read as.
+#define MD_BOUNDARY_ZERO 0 //0
+#define MD_BOUNDARY_CLAMP 1 //the nearest edge element
+#define MD_BOUNDARY_WRAP 2 //the elements of the opposite side, as if in were periodic
+#define MD_BOUNDARY_REFLECT 3 //the mirror image of in about its edge: ... 2 1 0 | 0 1 2 ...
+
+//Temporal blocking takes at most this many steps per trip through memory by default.
+#define MD_STENCIL_TIME_BLOCK 4
+
+struct MD_KERNEL {
+	unsigned int n_dims; //1, 2 or 3: the rank of the arrays it applies to
+	size_t dims[3]; //The extent of the kernel along each dimension
+	size_t center[3]; //The position of the tap that lines up with the output element
+	bool separable; //The kernel is the outer product of one 1-D kernel per dimension
+	//The dims[0]*dims[1]*... weights in row-major order; for a separable kernel, the
+	//dims[0]+dims[1]+... weights of the 1-D kernels, one after another.
+	const double* weights;
+};
+
+/* Accepts:
+  * n_dims - 1, 2 or 3.
+  * dims - The extent of the kernel along each dimension.
+  * weights - As for MD_KERNEL::weights; they are not copied.
+  * separable - Whether weights holds one 1-D kernel per dimension.
+Returns: A kernel centred at dims[k]/2 along each dimension.*/
+static inline struct MD_KERNEL md_kernel(unsigned int n_dims, const size_t dims[], const double* weights, bool separable = false) {
+	struct MD_KERNEL kernel;
+	unsigned int k;
+
+	if (n_dims < 1 || n_dims > 3) {
+		fputs("md_kernel: a kernel has 1, 2 or 3 dimensions", stderr);
+		throw MULTIARRAY_EX();
+	}
+	kernel.n_dims = n_dims;
+	for (k=0;k<n_dims;k++) {
+		kernel.dims[k] = dims[k];
+		kernel.center[k] = dims[k] / 2;
+	}
+	kernel.separable = separable;
+	kernel.weights = weights;
+	return(kernel);
+}
+
+/* Accepts:
+  * in - An array, array slice or view of 1, 2 or 3 dimensions with elements of type T.
+  * out - The same, of the same shape. It must not share memory with in.
+  * kernel - A kernel of the rank of in.
+  * boundary - One of MD_BOUNDARY_*.
+  * steps - The number of times to apply the kernel; each application reads the result of
+    the one before.
+  * time_block - The largest number of steps taken per trip through memory; 0 picks
+    MD_STENCIL_TIME_BLOCK, and 1 turns temporal blocking off.
+Returns: void.
+Purpose: Applies kernel to in and stores the result into out.
+Note: Throws MULTIARRAY_EX if the shapes, ranks or element sizes do not agree. With steps > 1
+a temporary array of the shape of in is allocated.*/
+template <typename T>
+void md_stencil(ARRAYLIKE in, ARRAYLIKE out, const struct MD_KERNEL& kernel, unsigned int boundary, unsigned int steps = 1, unsigned int time_block = 0);
+
+#endif
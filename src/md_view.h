@@ -0,0 +1,89 @@
+#ifndef _JC_MD_VIEW
+#define _JC_MD_VIEW
+
+#include "multiarray.h"
+
+/*Notes:
+md_view<T, N> is a typed window onto a multi-array (slice or view) of rank N holding elements
+of type T. The dimensions and strides are read out of the array header once, when the view
+is constructed; after that v(i, j, k) is a plain multiply-add on the data pointer with no
+dispatch on struct_identifier, no division and no thread-local temporaries, so loops over
+a view can be hoisted and vectorized by the compiler like loops over a C array.
+
+A view does not own anything. It is invalidated by md_resize and md_free on its array, in
+the same way as a slice.
+
+Bounds checking follows the library: compile with -DMD_INDEX_CHECKS to enable it.*/
+
+template <typename T, unsigned int N>
+class md_view {
+	static_assert(N >= 1 && N <= MAX_DIMENSIONS, "md_view: rank must be between 1 and MAX_DIMENSIONS");
+
+	T* p_data;
+	size_t _dims[N];
+	//Strides in elements; they are negative on the reversed axes of a view.
+	ptrdiff_t _strides[N];
+
+	template <typename... I>
+	inline ptrdiff_t offset(I... idx) const {
+		const size_t ix[N] = {(size_t)idx...};
+		ptrdiff_t off = 0;
+		unsigned int k;
+
+#ifdef MD_INDEX_CHECKS
+		for (k=0;k<N;k++) {
+			if (ix[k] >= _dims[k]) {
+				fprintf(stderr, "md_view: %zu out of range %zu in dimension %u\n", ix[k], _dims[k], k);
+				throw MULTIARRAY_EX();
+			}
+		}
+#endif
+		for (k=0;k<N;k++) off += (ptrdiff_t)ix[k] * _strides[k];
+		return(off);
+	}
+
+public:
+	/* Accepts:
+	  * ar - An array, array slice or view of rank N whose elements have the size of T.
+	Note: Throws MULTIARRAY_EX if the rank or the element size does not match.*/
+	explicit md_view(ARRAYLIKE ar) {
+		size_t dims[MAX_DIMENSIONS];
+		ptrdiff_t strides[MAX_DIMENSIONS];
+		unsigned int k;
+
+		if (md_shape(ar, dims) != N) {
+			fputs("md_view: rank of the array does not match the view", stderr);
+			throw MULTIARRAY_EX();
+		}
+		if (md_type_size(md_base(ar)) != sizeof(T)) {
+			fputs("md_view: element size of the array does not match the view", stderr);
+			throw MULTIARRAY_EX();
+		}
+		p_data = (T*)md_getptr(ar);
+		md_strides(ar, strides);
+		for (k=0;k<N;k++) {
+			_dims[k] = dims[k];
+			_strides[k] = strides[k] / (ptrdiff_t)sizeof(T);
+		}
+	}
+
+	/* Accepts:
+	  * i, j, k, etc. - Exactly N indices.
+	Returns: A reference to the element.*/
+	template <typename... I>
+	inline T& operator()(I... idx) const {
+		static_assert(sizeof...(I) == N, "md_view: wrong number of indices");
+		return p_data[offset(idx...)];
+	}
+
+	//Returns: The size of dimension k.
+	inline size_t dim(unsigned int k) const { return _dims[k]; }
+
+	//Returns: The distance, in elements, between consecutive indices of dimension k.
+	inline ptrdiff_t stride(unsigned int k) const { return _strides[k]; }
+
+	//Returns: A pointer to the first element.
+	inline T* data() const { return p_data; }
+};
+
+#endif
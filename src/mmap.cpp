@@ -0,0 +1,332 @@
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "multiarray.h"
+
+/* Arrays are stored in the NumPy .npy format: a magic string, a version, the length of a
+text header, the header itself (a Python dict literal giving descr, fortran_order and
+shape), and then the elements in C order. NumPy pads the header so that the elements
+start on a 64 byte boundary of the file.
+
+md_open_mmap maps the whole file privately, one page after the start of a reserved
+region, and writes an MD_ARRAY header into the bytes just in front of the elements; the
+.npy header there is overwritten in the process's private copy of the first page only.
+The elements themselves are paged in from the file on first touch. */
+
+#define MD_NPY_MAGIC "\x93NUMPY"
+#define MD_NPY_MAGIC_LEN 6
+//Longer type strings than this are rejected by md_save, which formats them into a fixed buffer.
+#define MD_NPY_DESCR_MAX 16
+
+static bool _md_little_endian() {
+	const unsigned short one = 1;
+
+	return *(const unsigned char*)&one == 1;
+}
+
+static const char* _md_skip_space(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+	return p;
+}
+
+//Returns: A pointer just past the value of key in the header dict, or NULL.
+static const char* _md_npy_find(const char* text, const char* end, const char* key) {
+	size_t len = strlen(key);
+	const char* p;
+
+	for (p=text;p+len+2<=end;p++) {
+		if ((*p == '\'' || *p == '"') && p[len+1] == *p && !memcmp(p+1, key, len)) {
+			p = _md_skip_space(p+len+2, end);
+			if (p < end && *p == ':') return _md_skip_space(p+1, end);
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+/* Accepts:
+  * descr - A NumPy type string such as '<f8', '|u1' or '|V16'.
+Returns: The element size it names, or 0 if it cannot be used here (byte swapped,
+objects, structured types).*/
+static unsigned int _md_npy_itemsize(const char* descr, size_t len) {
+	unsigned long size = 0;
+	size_t i;
+
+	if (len < 3) return 0;
+	if (descr[0] == (_md_little_endian() ? '>' : '<')) {
+		//Byte order only matters for elements wider than a byte.
+		if (len != 3 || descr[2] != '1') return 0;
+	} else if (descr[0] != '<' && descr[0] != '>' && descr[0] != '|' && descr[0] != '=') {
+		return 0;
+	}
+	if (!strchr("biufcmMVSU", descr[1])) return 0;
+	for (i=2;i<len;i++) {
+		if (descr[i] < '0' || descr[i] > '9' || size > UINT_MAX / 10) return 0;
+		size = size * 10 + (descr[i] - '0');
+	}
+	//Unicode strings count characters of 4 bytes.
+	if (descr[1] == 'U') size *= 4;
+	return size <= UINT_MAX ? (unsigned int)size : 0;
+}
+
+/* Parses the header of a .npy file into header (n_dims, dims, caps, type_size and
+packed strides).
+Returns: The offset of the elements in the file.*/
+static size_t _md_npy_parse(const char* p_file, size_t file_size, struct MD_ARRAY* header) {
+	const char *text, *end, *p, *q;
+	size_t header_len, data_offset, total;
+	size_t dim;
+	unsigned int k;
+
+	if (file_size < MD_NPY_MAGIC_LEN + 4 || memcmp(p_file, MD_NPY_MAGIC, MD_NPY_MAGIC_LEN)) {
+		fputs("md_open_mmap: not a .npy file", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (p_file[6] == 1) {
+		header_len = (unsigned char)p_file[8] | (size_t)(unsigned char)p_file[9] << 8;
+		data_offset = 10 + header_len;
+	} else if ((p_file[6] == 2 || p_file[6] == 3) && file_size >= 12) {
+		header_len = (unsigned char)p_file[8] | (size_t)(unsigned char)p_file[9] << 8 |
+			(size_t)(unsigned char)p_file[10] << 16 | (size_t)(unsigned char)p_file[11] << 24;
+		data_offset = 12 + header_len;
+	} else {
+		fputs("md_open_mmap: unsupported .npy version", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (data_offset > file_size) {
+		fputs("md_open_mmap: truncated .npy header", stderr);
+		throw MULTIARRAY_EX();
+	}
+	text = p_file + data_offset - header_len;
+	end = p_file + data_offset;
+
+	p = _md_npy_find(text, end, "fortran_order");
+	if (p && end - p >= 4 && !memcmp(p, "True", 4)) {
+		fputs("md_open_mmap: Fortran ordered arrays are not supported", stderr);
+		throw MULTIARRAY_EX();
+	}
+
+	p = _md_npy_find(text, end, "descr");
+	if (!p || (*p != '\'' && *p != '"') || !(q = (const char*)memchr(p+1, *p, end-p-1)) ||
+			!(header->type_size = _md_npy_itemsize(p+1, q-p-1))) {
+		fputs("md_open_mmap: unsupported element type", stderr);
+		throw MULTIARRAY_EX();
+	}
+
+	p = _md_npy_find(text, end, "shape");
+	if (!p || *p != '(') {
+		fputs("md_open_mmap: missing shape", stderr);
+		throw MULTIARRAY_EX();
+	}
+	header->n_dims = 0;
+	for (p=_md_skip_space(p+1, end);p<end&&*p!=')';) {
+		if (header->n_dims == MAX_DIMENSIONS) {
+			fputs("md_open_mmap: n_dims should not exceed MAX_DIMENSIONS", stderr);
+			throw MULTIARRAY_EX();
+		}
+		for (dim=0;p<end&&*p>='0'&&*p<='9';p++) {
+			if (dim > (SIZE_MAX - 9) / 10) {
+				fputs("md_open_mmap: dimension too large", stderr);
+				throw MULTIARRAY_EX();
+			}
+			dim = dim * 10 + (*p - '0');
+		}
+		header->dims[header->n_dims++] = dim;
+		p = _md_skip_space(p, end);
+		if (p < end && *p == ',') p = _md_skip_space(p+1, end);
+		else if (p < end && *p != ')') break;
+	}
+	if (p >= end || *p != ')') {
+		fputs("md_open_mmap: malformed shape", stderr);
+		throw MULTIARRAY_EX();
+	}
+
+	total = header->type_size;
+	for (k=header->n_dims;k-->0;) {
+		header->strides[k] = total;
+		if (header->dims[k] && SIZE_MAX / header->dims[k] < total) {
+			fputs("The byte size of the array overflows", stderr);
+			throw MULTIARRAY_EX();
+		}
+		total *= header->dims[k];
+	}
+	memcpy(header->caps, header->dims, sizeof(size_t) * header->n_dims);
+	if (total > file_size - data_offset) {
+		fputs("md_open_mmap: the file is shorter than its shape", stderr);
+		throw MULTIARRAY_EX();
+	}
+	return(data_offset);
+}
+
+/* Accepts:
+  * path - The path of a .npy file.
+  * mode - MD_MMAP_READONLY or MD_MMAP_COPY_ON_WRITE.
+Returns: The array stored in the file, mapped into memory rather than read.*/
+struct MD_ARRAY* md_open_mmap(const char* path, unsigned int mode) {
+	struct MD_ARRAY header;
+	struct MD_ARRAY* _md_p;
+	struct stat st;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE), header_size = header.data - (char*)&header;
+	size_t data_offset, map_size, protect_from;
+	char *p_region, *p_file;
+	int fd;
+
+	if (mode != MD_MMAP_READONLY && mode != MD_MMAP_COPY_ON_WRITE) {
+		fputs("md_open_mmap: unknown mode", stderr);
+		throw MULTIARRAY_EX();
+	}
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "md_open_mmap: cannot open %s\n", path);
+		throw MULTIARRAY_EX();
+	}
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		fprintf(stderr, "md_open_mmap: cannot map %s\n", path);
+		throw MULTIARRAY_EX();
+	}
+	map_size = (st.st_size + page - 1) / page * page;
+
+	//One spare page in front of the file, for headers that are shorter than MD_ARRAY.
+	p_region = (char*)mmap(NULL, page + map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p_region == MAP_FAILED) {
+		close(fd);
+		fputs("md_open_mmap: out of address space", stderr);
+		throw MULTIARRAY_EX();
+	}
+	p_file = (char*)mmap(p_region + page, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+	close(fd);
+	if (p_file == MAP_FAILED) {
+		munmap(p_region, page + map_size);
+		fprintf(stderr, "md_open_mmap: cannot map %s\n", path);
+		throw MULTIARRAY_EX();
+	}
+
+	try {
+		data_offset = _md_npy_parse(p_file, st.st_size, &header);
+	} catch (...) {
+		munmap(p_region, page + map_size);
+		throw;
+	}
+	if (data_offset % sizeof(void*) || header_size > page) {
+		munmap(p_region, page + map_size);
+		fputs("md_open_mmap: the elements are not aligned in the file", stderr);
+		throw MULTIARRAY_EX();
+	}
+	header.struct_identifier = 0xAAAAA;
+	header.flags = 0;
+	header.layout = MD_LAYOUT_ROW_MAJOR;
+	header.tile_shift = 0;
+	header.storage = MD_STORAGE_MMAP;
+	header.p_block = p_region;
+	header.block_size = page + map_size;
+	header.p_owner = NULL;
+	header.refs = 0;
+
+	_md_p = (struct MD_ARRAY*)(p_file + data_offset - header_size);
+	memcpy(_md_p, &header, header_size);
+
+	if (mode == MD_MMAP_READONLY) {
+		//The page holding the MD_ARRAY header stays writable, for md_retain and md_free. The
+		//header sits directly in front of the elements, so that page also holds the first
+		//elements, and writes to them go to the private copy rather than fault.
+		protect_from = ((size_t)_md_p->data - (size_t)p_region + page - 1) / page * page;
+		if (protect_from < page + map_size) mprotect(p_region + protect_from, page + map_size - protect_from, PROT_READ);
+	}
+	MD_STAT(_md_stats_alloc(_md_p));
+	return(_md_p);
+}
+
+//Unmaps an array opened with md_open_mmap.
+void _md_unmap(struct MD_ARRAY* ar) {
+	munmap(ar->p_block, ar->block_size);
+}
+
+static void _md_save_fail(FILE* f, const char* path) {
+	if (f) fclose(f);
+	fprintf(stderr, "md_save: cannot write %s\n", path);
+	throw MULTIARRAY_EX();
+}
+
+/* Accepts:
+  * ar - An array, array slice or view.
+  * path - The file to create or overwrite.
+  * descr - The NumPy type string of the elements, such as "<f8" or "<i4". When NULL the
+    elements are saved as opaque records ("|V" and the element size).
+Purpose: Writes ar to path in the .npy format (version 1.0), so that it can be opened with
+md_open_mmap or with NumPy.*/
+void md_save(ARRAYLIKE ar, const char* path, const char* descr) {
+	struct MD_ARRAY* p_base = md_base(ar);
+	size_t dims[MAX_DIMENSIONS], idx[MAX_DIMENSIONS], j;
+	ptrdiff_t strides[MAX_DIMENSIONS];
+	size_t el_sz = md_type_size(p_base);
+	unsigned int n_dims, k;
+	char text[128 + 64 + 24 * MAX_DIMENSIONS], opaque[32], prefix[10];
+	size_t len, total_len, n_rows = 1, row;
+	const char* p;
+	FILE* f;
+
+	if (!descr) {
+		snprintf(opaque, sizeof(opaque), "|V%zu", el_sz);
+		descr = opaque;
+	}
+	if (strlen(descr) > MD_NPY_DESCR_MAX) {
+		fputs("md_save: descr is too long", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (_md_npy_itemsize(descr, strlen(descr)) != el_sz) {
+		fputs("md_save: descr does not match the element size of the array", stderr);
+		throw MULTIARRAY_EX();
+	}
+	n_dims = md_shape(ar, dims);
+	md_strides(ar, strides);
+
+	len = snprintf(text, sizeof(text), "{'descr': '%s', 'fortran_order': False, 'shape': (", descr);
+	for (k=0;k<n_dims;k++) len += snprintf(text + len, sizeof(text) - len, n_dims == 1 ? "%zu," : k ? ", %zu" : "%zu", dims[k]);
+	len += snprintf(text + len, sizeof(text) - len, "), }");
+	if (len + 64 > sizeof(text)) {
+		fputs("md_save: the .npy header is too long", stderr);
+		throw MULTIARRAY_EX();
+	}
+	//Pad with spaces and a newline so that the elements start on a 64 byte boundary.
+	total_len = (10 + len + 1 + 63) / 64 * 64;
+	memset(text + len, ' ', total_len - 10 - len - 1);
+	text[total_len - 10 - 1] = '\n';
+
+	memcpy(prefix, MD_NPY_MAGIC, MD_NPY_MAGIC_LEN);
+	prefix[6] = 1;
+	prefix[7] = 0;
+	prefix[8] = (char)((total_len - 10) & 0xFF);
+	prefix[9] = (char)((total_len - 10) >> 8);
+
+	f = fopen(path, "wb");
+	if (!f) _md_save_fail(f, path);
+	if (fwrite(prefix, 1, 10, f) != 10 || fwrite(text, 1, total_len - 10, f) != total_len - 10) _md_save_fail(f, path);
+
+	//Write the innermost rows one at a time, gathering them if they are strided.
+	if (n_dims == 0) {
+		if (fwrite(md_getptr(ar), el_sz, 1, f) != 1) _md_save_fail(f, path);
+	} else {
+		for (k=0;k+1<n_dims;k++) n_rows *= dims[k];
+		memset(idx, 0, sizeof(idx));
+		for (row=0;row<n_rows&&dims[n_dims-1];row++) {
+			p = md_getptr(ar);
+			for (k=0;k+1<n_dims;k++) p += (ptrdiff_t)idx[k] * strides[k];
+			if (strides[n_dims-1] == (ptrdiff_t)el_sz) {
+				if (fwrite(p, el_sz, dims[n_dims-1], f) != dims[n_dims-1]) _md_save_fail(f, path);
+			} else {
+				for (j=0;j<dims[n_dims-1];j++) {
+					if (fwrite(p + (ptrdiff_t)j * strides[n_dims-1], el_sz, 1, f) != 1) _md_save_fail(f, path);
+				}
+			}
+			for (k=n_dims-1;k-->0;) {
+				if (++idx[k] < dims[k]) break;
+				idx[k] = 0;
+			}
+		}
+	}
+	if (fclose(f)) _md_save_fail(NULL, path);
+}
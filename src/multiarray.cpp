@@ -5,195 +5,807 @@
 
 
 static __thread struct MD_SLICE temporary_slice;
+static __thread struct MD_VIEW temporary_view;
 
-static inline unsigned int _the_stride(struct MD_ARRAY* ar, unsigned int dim_i, unsigned int el_sz) {
-	unsigned int str = el_sz, *p_start = ar->dims+dim_i, *p_end = ar->dims+md_dims_n(ar);
+static unsigned int default_alloc_flags = 0;
 
-	for (;p_start!=p_end;p_start++) {
-#ifdef MD_INDEX_CHECKS
-		if (UINT_MAX / *p_start <= str) {
-			fputs("The byte size of the array overflows", stderr);
-			throw MULTIARRAY_EX();
-		}
-#endif
-		str *= *p_start;
-	}
-	return(str);
-}
+struct MD_KIND _md_kinds[MD_KIND_LAST - MD_KIND_FIRST + 1];
 
+static struct MD_ARRAY* _md_alloc_impl(struct MD_ARENA* arena, const size_t _md_dims[], const size_t caps[], unsigned int n_dims, size_t size, unsigned int flags, unsigned int layout, unsigned int tile_shift);
 
-static inline unsigned int calculate_array_dimensions(unsigned int _md_dims[], unsigned int n_dims, unsigned int size) {
-	unsigned int _md_i, _md_sz = size;
+static inline size_t _md_times(size_t a, size_t b) {
+	if (b && SIZE_MAX / b < a) {
+		fputs("The byte size of the array overflows", stderr);
+		throw MULTIARRAY_EX();
+	}
+	return(a * b);
+}
 
-	for(_md_i=0;_md_i<n_dims;_md_i++) {
+/* Fills in the strides of the header from its caps, type_size, flags and layout; rows of
+the innermost dimension are padded to MD_ALIGNMENT bytes under MD_PAD_ROWS. The caps of
+tiled arrays are rounded up to whole tiles, and those of Morton-order arrays to powers of 2.
+Returns: The byte size of the array's data.*/
+static size_t _md_layout(struct MD_ARRAY* ar) {
+	unsigned int n_dims = md_dims_n(ar), k, bits[MAX_DIMENSIONS], b, pos = 0;
+	size_t sz = md_type_size(ar), side = (size_t)1 << ar->tile_shift;
+	bool more;
 
-#ifdef MD_INDEX_CHECKS
-		if (UINT_MAX/_md_dims[_md_i] <= _md_sz) {
-			fputs("The byte size of the array overflows", stderr);
-			throw MULTIARRAY_EX();
+	switch (ar->layout) {
+	case MD_LAYOUT_COL_MAJOR:
+		for (k=0;k<n_dims;k++) {
+			ar->strides[k] = sz;
+			sz = _md_times(sz, ar->caps[k]);
+			if (k == 0 && (ar->flags & MD_PAD_ROWS)) {
+				sz = (sz + MD_ALIGNMENT - 1) / MD_ALIGNMENT * MD_ALIGNMENT;
+			}
 		}
-#endif
-		_md_sz *= _md_dims[_md_i];
+		return(sz);
+	case MD_LAYOUT_TILED:
+		for (k=0;k<n_dims;k++) {
+			ar->caps[k] = (ar->caps[k] + side - 1) & ~(side - 1);
+			sz = _md_times(sz, side);
+		}
+		//sz is now the byte size of a tile; the tiles go in row-major order.
+		for (k=n_dims;k-->0;) {
+			ar->strides[k] = sz;
+			sz = _md_times(sz, ar->caps[k] >> ar->tile_shift);
+		}
+		return(sz);
+	case MD_LAYOUT_MORTON:
+		for (k=0;k<n_dims;k++) {
+			for (bits[k]=0;((size_t)1 << bits[k]) < ar->caps[k];bits[k]++) ;
+			ar->caps[k] = (size_t)1 << bits[k];
+			ar->strides[k] = 0;
+		}
+		//Deal out the bits of the Z-order index, lowest first, starting with the innermost
+		//dimension.
+		for (b=0,more=true;more;b++) {
+			more = false;
+			for (k=n_dims;k-->0;) {
+				if (b >= bits[k]) continue;
+				if (pos >= sizeof(size_t) * CHAR_BIT - 1) {
+					fputs("The byte size of the array overflows", stderr);
+					throw MULTIARRAY_EX();
+				}
+				ar->strides[k] |= (size_t)1 << pos++;
+				more = true;
+			}
+		}
+		return(_md_times(sz, (size_t)1 << pos));
 	}
-
-
-	return(_md_sz);
+	for (k=n_dims;k-->0;) {
+		ar->strides[k] = sz;
+		sz = _md_times(sz, ar->caps[k]);
+		if (k == n_dims - 1 && (ar->flags & MD_PAD_ROWS)) {
+			sz = (sz + MD_ALIGNMENT - 1) / MD_ALIGNMENT * MD_ALIGNMENT;
+		}
+	}
+	return(sz);
 }
 
 /* Accepts:
-  * ar - An array or array slice.
+  * ar - An array, array slice or view.
   * i - The index for the next dimension to index.
-Returns: A pointer to array slice standing for the data at the already-selected
-indices. The pointer returned cannot be dereferenced; it can only be passed
-to other functions.
-Note: The md_#d macros demonstrate how to chain together calls to md_index
-in order to index multi-dimensional arrays.*/
-struct MD_SLICE* md_index(ARRAYLIKE ar, unsigned int i) {
-	struct MD_SLICE* p_slice;
+Returns: The slice standing for the data at the already-selected indices, by value.
+Note: Slices of slices are taken by the inline overload in multiarray.h, which needs
+no dispatch on struct_identifier.*/
+struct MD_SLICE md_slice_at(ARRAYLIKE ar, size_t i) {
 	struct MD_ARRAY* p_header;
+	struct MD_VIEW* p_view;
 	struct MD_SLICE slice;
-	unsigned dim_size;
+#ifdef MD_INDEX_CHECKS
+	size_t dim_size;
+#endif
 
+	MD_STAT(_md_tls_stats.index_calls++);
 	switch (ar->struct_identifier) {
 	case 0xAAAAA:
 		p_header = (struct MD_ARRAY*)ar;
-		dim_size = md_dims_array(p_header)[0];
 #ifdef MD_INDEX_CHECKS
+		dim_size = md_dims_array(p_header)[0];
+		if (p_header->n_dims == 0) {
+			fputs("md_slice_at: indexed more times than there are dimensions", stderr);
+			throw MULTIARRAY_EX();
+		}
 		if (i >= dim_size) {
-			fprintf(stderr, "md_index: %u out of range %u in dimension 0\n", i, dim_size);
+			fprintf(stderr, "md_slice_at: %zu out of range %zu in dimension 0\n", i, dim_size);
 			throw MULTIARRAY_EX();
 		}
 #endif
+		slice.struct_identifier = 0xAAAAB;
 		slice.p_base = p_header;
-		slice.stride = _the_stride(p_header, 1, md_type_size(p_header));
-		slice.p_indexing_base = p_header->data + i * slice.stride;
+		slice.p_view = NULL;
+		slice.stride = p_header->strides[0];
+		slice.p_indexing_base = p_header->data + _md_dim_offset(p_header, 0, i);
 		slice.n_dims = p_header->n_dims - 1;
-		break;
+		return(slice);
 	case 0xAAAAB:
-		p_slice = (struct MD_SLICE*)ar;
-		p_header = p_slice->p_base;
+		return(md_slice_at(*(struct MD_SLICE*)ar, i));
+	case 0xAAAAC:
+		p_view = (struct MD_VIEW*)ar;
 #ifdef MD_INDEX_CHECKS
-		if (p_slice->n_dims == 0) {
-			fputs("md_index: indexed more times than there are dimensions", stderr);
+		if (p_view->n_dims == 0) {
+			fputs("md_slice_at: indexed more times than there are dimensions", stderr);
 			throw MULTIARRAY_EX();
 		}
-#endif
-		dim_size = p_header->dims[md_dims_n(p_header)-p_slice->n_dims];
-#ifdef MD_INDEX_CHECKS
-		if (i >= dim_size) {
-			fprintf(stderr, "md_index: %u out of range %u in dimension %u\n", i, dim_size, p_header->n_dims - p_slice->n_dims);
+		if (i >= p_view->dims[0]) {
+			fprintf(stderr, "md_slice_at: %zu out of range %zu in dimension 0 of view\n", i, p_view->dims[0]);
 			throw MULTIARRAY_EX();
 		}
 #endif
-		slice.p_base = p_slice->p_base;
-		slice.stride = p_slice->stride / dim_size;
-		slice.p_indexing_base = p_slice->p_indexing_base + i * slice.stride;
-		slice.n_dims = p_slice->n_dims - 1;
-		break;
+		slice.struct_identifier = 0xAAAAB;
+		slice.p_base = p_view->p_base;
+		slice.p_view = p_view;
+		slice.stride = 0;
+		slice.p_indexing_base = p_view->p_indexing_base + (ptrdiff_t)i * p_view->strides[0];
+		slice.n_dims = p_view->n_dims - 1;
+		return(slice);
 	case 0xFEEED:
-		fputs("md_index: already freed.", stderr);
+		fputs("md_slice_at: already freed.", stderr);
 		throw MULTIARRAY_EX();
 	default:
-		fputs("md_index: not an array or array slice.", stderr);
+		fputs("md_slice_at: not an array, array slice or view.", stderr);
 		throw MULTIARRAY_EX();
 	}
-	slice.struct_identifier = 0xAAAAB;
-	temporary_slice = slice;
-	return &temporary_slice;
 }
 
-/* Accepts
-  * ar - Pointer to an array or array slice.
-  * dim_i - A dimension number (starting from 0).
-  * size - The new size (number of elements) of the selected dimension.
-Returns: a new MD_ARRAY on success, NULL on failure.
-Purpose: Resizes a multi-array along one dimension.
-Note: It can be assumed that md_resize will render invalid the parameter multi-array,
-and will also render invalid any slices formerly taken on that multi-array.*/
-struct MD_ARRAY* md_resize(ARRAYLIKE ar, unsigned int dim_i, unsigned int size) {
-	struct MD_ARRAY* ar2;
-	struct MD_SLICE* p_slice;
-	char *p_read, *p_write, *p_write_end;
-	unsigned int old_str, new_str, old_size, new_size, old_dim_size, n_dims;
+/* Accepts:
+  * ar - An array, array slice or view.
+  * i - The index for the next dimension to index.
+Returns: A pointer to array slice (or view, when ar is a view) standing for the data at
+the already-selected indices. The pointer returned cannot be dereferenced; it can only
+be passed to other functions, and it is overwritten by the next call to md_index on the
+same thread.
+Note: md_slice_at returns slices by value and does not share this limitation.*/
+ARRAYLIKE md_index(ARRAYLIKE ar, size_t i) {
+	struct MD_VIEW* p_view;
+	struct MD_VIEW view;
+	unsigned k;
 
-again:
-	switch (ar->struct_identifier) {
-	case 0xAAAAA:
-		ar2 = (struct MD_ARRAY*)ar;
-		old_str = _the_stride(ar2, dim_i, md_type_size(ar2));
-		old_size = _the_stride(ar2, 0, md_type_size(ar2));
-		old_dim_size = md_dims_array(ar2)[dim_i];
-		md_dims_array(ar2)[dim_i] = size;
-		new_str = _the_stride(ar2, dim_i, md_type_size(ar2));
-		new_size = _the_stride(ar2, 0, md_type_size(ar2));
-		n_dims = md_dims_n(ar2);
-
-		if (size == old_dim_size) {
-			return(ar2);
-		} else if (size < old_dim_size) {
-			p_read = p_write = ar2->data;
-			p_write_end = ar2->data + new_size;
-			for (;p_write!=p_write_end;p_read+=old_str,p_write+=new_str) {
-				memmove(p_write, p_read, new_str);
+	if (_md_kind(ar) && _md_kind(ar)->index_fn) return _md_kind(ar)->index_fn(ar, i);
+	if (ar->struct_identifier != 0xAAAAC) {
+		temporary_slice = md_slice_at(ar, i);
+		return &temporary_slice;
+	}
+	MD_STAT(_md_tls_stats.index_calls++);
+	p_view = (struct MD_VIEW*)ar;
+#ifdef MD_INDEX_CHECKS
+	if (p_view->n_dims == 0) {
+		fputs("md_index: indexed more times than there are dimensions", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (i >= p_view->dims[0]) {
+		fprintf(stderr, "md_index: %zu out of range %zu in dimension 0 of view\n", i, p_view->dims[0]);
+		throw MULTIARRAY_EX();
+	}
+#endif
+	view.struct_identifier = 0xAAAAC;
+	view.p_base = p_view->p_base;
+	view.p_indexing_base = p_view->p_indexing_base + (ptrdiff_t)i * p_view->strides[0];
+	view.n_dims = p_view->n_dims - 1;
+	for (k=0;k<view.n_dims;k++) {
+		view.dims[k] = p_view->dims[k+1];
+		view.strides[k] = p_view->strides[k+1];
+	}
+	temporary_view = view;
+	return &temporary_view;
+}
+
+/* Accepts:
+  * ar - An array, array slice or view.
+  * axis - The dimension to restrict.
+  * start, stop, step - The indices to keep along axis, as in start, start+step, ... < stop
+    (> stop for a negative step).
+Returns: A view sharing the data of ar. See multiarray.h.*/
+struct MD_VIEW md_subview(ARRAYLIKE ar, unsigned int axis, ptrdiff_t start, ptrdiff_t stop, ptrdiff_t step) {
+	struct MD_VIEW view;
+	ptrdiff_t n;
+
+	view.struct_identifier = 0xAAAAC;
+	view.p_base = md_base(ar);
+	view.p_indexing_base = md_getptr(ar);
+	view.n_dims = md_shape(ar, view.dims);
+	md_strides(ar, view.strides);
+	if (axis >= view.n_dims) {
+		fprintf(stderr, "md_subview: axis %u out of range for %u dimensions\n", axis, view.n_dims);
+		throw MULTIARRAY_EX();
+	}
+	if (step == 0) {
+		fputs("md_subview: step must not be zero", stderr);
+		throw MULTIARRAY_EX();
+	}
+	n = view.dims[axis];
+	if (step > 0) {
+		if (start < 0) start = 0;
+		if (stop > n) stop = n;
+		n = start < stop ? (stop - start + step - 1) / step : 0;
+	} else {
+		if (start > n - 1) start = n - 1;
+		if (stop < -1) stop = -1;
+		n = start > stop ? (start - stop - step - 1) / -step : 0;
+	}
+	if (n) view.p_indexing_base += start * view.strides[axis];
+	view.dims[axis] = (size_t)n;
+	view.strides[axis] *= step;
+	return(view);
+}
+
+struct MD_VIEW md_broadcast_to(ARRAYLIKE ar, unsigned int n_dims, const size_t dims[]) {
+	struct MD_VIEW view;
+	size_t src_dims[MAX_DIMENSIONS];
+	ptrdiff_t src_strides[MAX_DIMENSIONS];
+	unsigned int src_n, k, lead;
+
+	src_n = md_shape(ar, src_dims);
+	md_strides(ar, src_strides);
+	if (n_dims > MAX_DIMENSIONS || n_dims < src_n) {
+		fprintf(stderr, "md_broadcast_to: cannot broadcast %u dimensions to %u\n", src_n, n_dims);
+		throw MULTIARRAY_EX();
+	}
+	lead = n_dims - src_n;
+	view.struct_identifier = 0xAAAAC;
+	view.p_base = md_base(ar);
+	view.p_indexing_base = md_getptr(ar);
+	view.n_dims = n_dims;
+	for (k=0;k<n_dims;k++) {
+		view.dims[k] = dims[k];
+		if (k < lead || src_dims[k-lead] == 1) {
+			view.strides[k] = 0;
+		} else if (src_dims[k-lead] == dims[k]) {
+			view.strides[k] = src_strides[k-lead];
+		} else {
+			fprintf(stderr, "md_broadcast_to: dimension %u of size %zu cannot be broadcast to %zu\n", k - lead, src_dims[k-lead], dims[k]);
+			throw MULTIARRAY_EX();
+		}
+	}
+	return(view);
+}
+
+unsigned int md_broadcast_shape(ARRAYLIKE a, ARRAYLIKE b, size_t dims[]) {
+	size_t a_dims[MAX_DIMENSIONS], b_dims[MAX_DIMENSIONS], x, y;
+	unsigned int a_n, b_n, n, k;
+
+	a_n = md_shape(a, a_dims);
+	b_n = md_shape(b, b_dims);
+	n = a_n > b_n ? a_n : b_n;
+	for (k=0;k<n;k++) {
+		x = k + a_n >= n ? a_dims[k+a_n-n] : 1;
+		y = k + b_n >= n ? b_dims[k+b_n-n] : 1;
+		if (x != y && x != 1 && y != 1) {
+			fprintf(stderr, "md_broadcast_shape: dimension %u has sizes %zu and %zu\n", k, x, y);
+			throw MULTIARRAY_EX();
+		}
+		dims[k] = x == 1 ? y : x;
+	}
+	return(n);
+}
+
+/* Returns the memory of an array to wherever it came from.*/
+void _md_release(struct MD_ARRAY* ar) {
+	switch (ar->storage) {
+	case MD_STORAGE_HEAP:
+		free(ar->p_block);
+		break;
+	case MD_STORAGE_POOL:
+		_md_pool_give(ar->p_block, ar->block_size);
+		break;
+	case MD_STORAGE_ARENA:
+		//Reclaimed by md_arena_reset.
+		break;
+	case MD_STORAGE_MMAP:
+		_md_unmap(ar);
+		break;
+	}
+}
+
+/* Accepts:
+  * struct_identifier - The identifier of the kind, from MD_KIND_FIRST to MD_KIND_LAST.
+  * kind - Its entry points, copied into _md_kinds.
+Note: Called while static variables are initialized, before main.*/
+int _md_register_kind(unsigned int struct_identifier, const struct MD_KIND* kind) {
+	_md_kinds[struct_identifier - MD_KIND_FIRST] = *kind;
+	return(1);
+}
+
+//Capacity given to an axis that has to grow past its capacity: half as much again as
+//before, so that a run of appends along the axis moves the elements O(log n) times.
+static inline size_t _md_grow_cap(size_t cap, size_t size) {
+	size_t grown = cap + cap / 2 + 1;
+
+	if (grown < cap) grown = SIZE_MAX;
+	return(grown > size ? grown : size);
+}
+
+/* Zeroes indices [from, to) of dimension dim_i of a row-major or column-major array, across
+the current extent of the outer dimensions (those before dim_i in row-major order, after it
+in column-major order); each index covers a whole subarray, capacity included.*/
+static void _md_zero_slab(struct MD_ARRAY* ar, unsigned int dim_i, size_t from, size_t to) {
+	size_t counter[MAX_DIMENSIONS];
+	unsigned int outer[MAX_DIMENSIONS], n_outer = 0, k, j;
+	size_t off = (size_t)from * ar->strides[dim_i], run = (size_t)ar->strides[dim_i] * (to - from);
+
+	for (k=0;k<md_dims_n(ar);k++) {
+		if (ar->layout == MD_LAYOUT_COL_MAJOR ? k > dim_i : k < dim_i) outer[n_outer++] = k;
+	}
+	for (j=0;j<n_outer;j++) {
+		if (!ar->dims[outer[j]]) return;
+	}
+	memset(counter, 0, sizeof(counter));
+	for (;;) {
+		memset(ar->data + off, 0, run);
+		for (j=n_outer;j-->0;) {
+			k = outer[j];
+			off += ar->strides[k];
+			if (++counter[j] < ar->dims[k]) break;
+			off -= (size_t)ar->strides[k] * ar->dims[k];
+			counter[j] = 0;
+		}
+		if (j == (unsigned int)-1) break;
+	}
+}
+
+/* Gives back a reference to an array on the way to a new copy of it: the old array is
+released, unless other holders still share it.*/
+static void _md_drop(struct MD_ARRAY* ar) {
+	if (__atomic_fetch_sub(&ar->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+	MD_STAT(_md_stats_free(ar));
+	ar->struct_identifier = 0xFEEED;
+	_md_release(ar);
+}
+
+/* Fills table with the byte offsets from md_getptr(ar) of indices 0 to n-1 along dimension
+k of ar, an array, slice or view in any layout.*/
+void _md_axis_offsets(ARRAYLIKE ar, unsigned int k, size_t n, ptrdiff_t table[]) {
+	struct MD_ARRAY* p_base = md_base(ar);
+	ptrdiff_t strides[MAX_DIMENSIONS];
+	size_t dims[MAX_DIMENSIONS], i;
+	unsigned int level;
+
+	if (ar->struct_identifier == 0xAAAAC || p_base->layout < MD_LAYOUT_TILED ||
+			(ar->struct_identifier == 0xAAAAB && ((struct MD_SLICE*)ar)->p_view)) {
+		md_strides(ar, strides);
+		for (i=0;i<n;i++) table[i] = (ptrdiff_t)i * strides[k];
+		return;
+	}
+	level = md_dims_n(p_base) - md_shape(ar, dims) + k;
+	for (i=0;i<n;i++) table[i] = (ptrdiff_t)_md_dim_offset(p_base, level, i);
+}
+
+template <typename T>
+static inline void _md_gather(char* dst, const char* src, const ptrdiff_t dst_tab[], const ptrdiff_t src_tab[], size_t n) {
+	size_t j;
+
+	for (j=0;j<n;j++) memcpy(dst + dst_tab[j], src + src_tab[j], sizeof(T));
+}
+
+/* Copies the elements of src at indices below dims[] to the same indices of dst; either may
+be in any layout. Runs that are contiguous on both sides are moved with memcpy, and where
+the runs are short (as for Morton order) the elements are moved one by one.
+Returns: The number of bytes moved.*/
+static size_t _md_transfer(struct MD_ARRAY* dst, ARRAYLIKE src, unsigned int n_dims, const size_t dims[]) {
+	size_t el_sz = md_type_size(dst), counter[MAX_DIMENSIONS], total = 0, n_runs, j, start;
+	ptrdiff_t* tabs[2][MAX_DIMENSIONS];
+	ptrdiff_t *dst_tab, *src_tab, src_off = 0, dst_off = 0;
+	size_t* runs;
+	char* src_data = md_getptr(src);
+	unsigned int k, last;
+
+	if (n_dims == 0) {
+		memcpy(dst->data, src_data, el_sz);
+		return(el_sz);
+	}
+	for (k=0;k<n_dims;k++) {
+		if (!dims[k]) return(0);
+		total += dims[k];
+	}
+	last = n_dims - 1;
+	tabs[0][0] = (ptrdiff_t*)malloc(sizeof(ptrdiff_t) * 2 * total + sizeof(size_t) * (dims[last] + 1));
+	if (!tabs[0][0]) {
+		fputs("Array re-allocation failed", stderr);
+		throw MULTIARRAY_EX();
+	}
+	tabs[1][0] = tabs[0][0] + total;
+	for (k=0;k<n_dims;k++) {
+		if (k) {
+			tabs[0][k] = tabs[0][k-1] + dims[k-1];
+			tabs[1][k] = tabs[1][k-1] + dims[k-1];
+		}
+		_md_axis_offsets(dst, k, dims[k], tabs[0][k]);
+		_md_axis_offsets(src, k, dims[k], tabs[1][k]);
+	}
+	dst_tab = tabs[0][last];
+	src_tab = tabs[1][last];
+	//Split the innermost dimension into runs that are contiguous in both arrays.
+	runs = (size_t*)(tabs[1][0] + total);
+	n_runs = 0;
+	for (j=1;j<=dims[last];j++) {
+		if (j == dims[last] || dst_tab[j] - dst_tab[j-1] != (ptrdiff_t)el_sz || src_tab[j] - src_tab[j-1] != (ptrdiff_t)el_sz) {
+			runs[n_runs++] = j;
+		}
+	}
+	memset(counter, 0, sizeof(counter));
+	for (;;) {
+		if (n_runs * 8 > dims[last] && (el_sz == 1 || el_sz == 2 || el_sz == 4 || el_sz == 8)) {
+			switch (el_sz) {
+			case 1: _md_gather<uint8_t>(dst->data + dst_off, src_data + src_off, dst_tab, src_tab, dims[last]); break;
+			case 2: _md_gather<uint16_t>(dst->data + dst_off, src_data + src_off, dst_tab, src_tab, dims[last]); break;
+			case 4: _md_gather<uint32_t>(dst->data + dst_off, src_data + src_off, dst_tab, src_tab, dims[last]); break;
+			default: _md_gather<uint64_t>(dst->data + dst_off, src_data + src_off, dst_tab, src_tab, dims[last]); break;
 			}
-			ar2 = (struct MD_ARRAY*)(realloc(ar2, sizeof(struct MD_ARRAY) + new_size));
-			if (ar2) return (ar2);
-			return((struct MD_ARRAY*)ar);
 		} else {
-			ar2 = (struct MD_ARRAY*)(realloc(ar2, sizeof(struct MD_ARRAY) + new_size));
-			if (!ar2) {
-				fputs("Array re-allocation failed", stderr);
-				//...but the old array is still available.
-				throw MULTIARRAY_EX();
+			for (j=0,start=0;j<n_runs;start=runs[j++]) {
+				memcpy(dst->data + dst_off + dst_tab[start], src_data + src_off + src_tab[start], (runs[j] - start) * el_sz);
 			}
+		}
+		for (k=last;k-->0;) {
+			if (++counter[k] < dims[k]) {
+				dst_off += tabs[0][k][counter[k]] - tabs[0][k][counter[k]-1];
+				src_off += tabs[1][k][counter[k]] - tabs[1][k][counter[k]-1];
+				break;
+			}
+			dst_off -= tabs[0][k][dims[k]-1];
+			src_off -= tabs[1][k][dims[k]-1];
+			counter[k] = 0;
+		}
+		if (k == (unsigned int)-1) break;
+	}
+	free(tabs[0][0]);
+	total = el_sz;
+	for (k=0;k<n_dims;k++) total *= dims[k];
+	return(total);
+}
+
+/* Moves the elements of an array into a fresh allocation with the given dimensions and
+capacities, the same flags and layout, and from the same arena. The old array is dropped.*/
+static struct MD_ARRAY* _md_resize_copy(struct MD_ARRAY* ar, const size_t new_dims[], const size_t caps[]) {
+	struct MD_ARRAY* result;
+	size_t dims[MAX_DIMENSIONS], counter[MAX_DIMENSIONS];
+	unsigned int n_dims = md_dims_n(ar), k, last;
+	size_t src_off = 0, dst_off = 0;
+	MD_STAT(size_t moved = 0);
+
+	memcpy(dims, new_dims, sizeof(size_t) * n_dims);
+	result = _md_alloc_impl(ar->storage == MD_STORAGE_ARENA ? (struct MD_ARENA*)ar->p_owner : NULL, dims, caps, n_dims, md_type_size(ar), ar->flags, ar->layout, ar->tile_shift);
+	MD_STAT(_md_stats_alloc(result));
+	for (k=0;k<n_dims;k++) {
+		if (ar->dims[k] < dims[k]) dims[k] = ar->dims[k];
+		if (!dims[k]) goto done;
+	}
+	if (ar->layout != MD_LAYOUT_ROW_MAJOR) {
+		size_t bytes = _md_transfer(result, ar, n_dims, dims);
 
-			p_read = ar2->data + old_size;
-			p_write = ar2->data + new_size;
-			p_write_end = ar2->data;
-			do {
-				p_read -= old_str;
-				p_write -= new_str;
-				memmove(p_write, p_read, old_str);
-				memset(p_write+old_str, 0, new_str-old_str);
-			} while (p_write!=p_write_end);
-			return(ar2);
+		MD_STAT(_md_stats_moved(bytes));
+		(void)bytes;
+		goto done;
+	}
+	last = n_dims - 1;
+	memset(counter, 0, sizeof(counter));
+	for (;;) {
+		memcpy(result->data + dst_off, ar->data + src_off, dims[last] * md_type_size(ar));
+		MD_STAT(moved += dims[last] * md_type_size(ar));
+		for (k=last;k-->0;) {
+			src_off += ar->strides[k];
+			dst_off += result->strides[k];
+			if (++counter[k] < dims[k]) break;
+			src_off -= ar->strides[k] * dims[k];
+			dst_off -= result->strides[k] * dims[k];
+			counter[k] = 0;
 		}
+		if (k == (unsigned int)-1) break;
+	}
+	MD_STAT(_md_stats_moved(moved));
+done:
+	_md_drop(ar);
+	return(result);
+}
+
+/* Gives an array new capacities. When only the capacity of the
+outermost dimension (the first, or for column-major the last) changes the strides stay the
+same, and a plain heap array is simply realloc'ed; otherwise, or when the array is shared,
+the elements are copied.*/
+static struct MD_ARRAY* _md_recap(struct MD_ARRAY* ar, const size_t dims[], const size_t caps[]) {
+	struct MD_ARRAY* ar2;
+	unsigned int n_dims = md_dims_n(ar), o = ar->layout == MD_LAYOUT_COL_MAJOR && n_dims ? n_dims - 1 : 0;
+	size_t old_cap = ar->caps[o], new_size;
+
+	if (ar->storage != MD_STORAGE_HEAP || (ar->flags & MD_ALIGN_DATA) || n_dims == 0 || md_is_shared(ar) || ar->layout >= MD_LAYOUT_TILED ||
+			memcmp(ar->caps, caps, sizeof(size_t) * o) || memcmp(ar->caps + o + 1, caps + o + 1, sizeof(size_t) * (n_dims - o - 1))) {
+		return(_md_resize_copy(ar, dims, caps));
+	}
+	//The old block is reported freed before realloc can release it, and the new one allocated after.
+	MD_STAT(_md_stats_free(ar));
+	ar->caps[o] = caps[o];
+	new_size = _md_layout(ar);
+	ar2 = (struct MD_ARRAY*)(realloc(ar, sizeof(struct MD_ARRAY) + new_size));
+	if (!ar2) {
+		ar->caps[o] = old_cap;
+		MD_STAT(_md_stats_alloc(ar));
+		fputs("Array re-allocation failed", stderr);
+		//...but the old array is still available.
+		throw MULTIARRAY_EX();
+	}
+	MD_STAT(if (ar2 != ar) _md_stats_moved(ar2->block_size < sizeof(struct MD_ARRAY) + new_size ? ar2->block_size : sizeof(struct MD_ARRAY) + new_size));
+	ar2->p_block = ar2;
+	ar2->block_size = sizeof(struct MD_ARRAY) + new_size;
+	MD_STAT(_md_stats_alloc(ar2));
+	return(ar2);
+}
+
+/* Sets the dimensions of an array, growing capacities geometrically where they are
+exceeded. Elements that come into range are zeroed. A shared array is copied first, so
+that its other holders keep it as it was. Row-major and column-major arrays are zeroed in
+place; tiled and Morton-order arrays are copied into fresh (zeroed) memory whenever a
+dimension grows.*/
+static struct MD_ARRAY* _md_resize_to(struct MD_ARRAY* ar, const size_t dims[]) {
+	size_t caps[MAX_DIMENSIONS], old;
+	unsigned int n_dims = md_dims_n(ar), k;
+	bool grow = false, widen = false;
+
+	memcpy(caps, ar->caps, sizeof(size_t) * n_dims);
+	for (k=0;k<n_dims;k++) {
+		if (dims[k] > caps[k]) {
+			caps[k] = _md_grow_cap(caps[k], dims[k]);
+			grow = true;
+		}
+		if (dims[k] > ar->dims[k]) widen = true;
+	}
+	if (ar->layout >= MD_LAYOUT_TILED) {
+		if (widen || md_is_shared(ar)) return(_md_resize_copy(ar, dims, caps));
+		memcpy(ar->dims, dims, sizeof(size_t) * n_dims);
+		return(ar);
+	}
+	if (grow || md_is_shared(ar)) ar = _md_recap(ar, ar->dims, caps);
+	for (k=0;k<n_dims;k++) {
+		old = ar->dims[k];
+		ar->dims[k] = dims[k];
+		if (dims[k] > old) _md_zero_slab(ar, k, old, dims[k]);
+	}
+	return(ar);
+}
+
+/* Finds the array that md_resize and its relatives act on. Slices and views are used up.
+Returns: The array; *p_first_dim receives the dimension of the array that is dimension 0
+of ar.*/
+static struct MD_ARRAY* _md_resize_target(ARRAYLIKE ar, unsigned int* p_first_dim, const char* fn_name) {
+	struct MD_SLICE* p_slice;
+	struct MD_VIEW* p_view;
+
+	switch (ar->struct_identifier) {
+	case 0xAAAAA:
+		*p_first_dim = 0;
+		return((struct MD_ARRAY*)ar);
 	case 0xAAAAB:
 		p_slice = (struct MD_SLICE*)ar;
 		p_slice->struct_identifier = 0xFEEED;
-		ar = (ARRAYLIKE)(p_slice->p_base);
-		dim_i += md_dims_n(p_slice->p_base) - p_slice->n_dims;
-		goto again;
+		*p_first_dim = md_dims_n(p_slice->p_base) - p_slice->n_dims;
+		return(p_slice->p_base);
+	case 0xAAAAC:
+		//A view's dimensions are the trailing dimensions of its array.
+		p_view = (struct MD_VIEW*)ar;
+		p_view->struct_identifier = 0xFEEED;
+		*p_first_dim = md_dims_n(p_view->p_base) - p_view->n_dims;
+		return(p_view->p_base);
 	case 0xFEEED:
-		fputs("md_resize: already freed.", stderr);
+		fprintf(stderr, "%s: already freed.", fn_name);
 		throw MULTIARRAY_EX();
 	default:
-		fputs("md_resize: not an array or array slice.", stderr);
+		fprintf(stderr, "%s: not an array, array slice or view.", fn_name);
 		throw MULTIARRAY_EX();
 	}
 }
 
+/* Accepts
+  * ar - Pointer to an array, array slice or view.
+  * dim_i - A dimension number (starting from 0).
+  * size - The new size (number of elements) of the selected dimension.
+Returns: The resized array, which may have moved.
+Purpose: Resizes a multi-array along one dimension.
+Note: It can be assumed that md_resize will render invalid the parameter multi-array,
+and will also render invalid any slices formerly taken on that multi-array. Arrays
+allocated with alignment flags keep them. When the array is shared (see md_retain), the
+resized array is a private copy, and the other holders and their slices are unaffected.
+Growing a dimension past its capacity enlarges the capacity by half, so appending to
+any dimension one index at a time costs amortized O(1) per element; shrinking keeps the
+capacity (see md_reserve). This holds for row-major and column-major arrays; tiled and
+Morton-order arrays are copied whenever a dimension grows.*/
+struct MD_ARRAY* md_resize(ARRAYLIKE ar, unsigned int dim_i, size_t size) {
+	struct MD_ARRAY* ar2;
+	size_t dims[MAX_DIMENSIONS];
+	unsigned int first;
+
+	ar2 = _md_resize_target(ar, &first, "md_resize");
+	dim_i += first;
+	if (size == md_dims_array(ar2)[dim_i]) return(ar2);
+	memcpy(dims, ar2->dims, sizeof(size_t) * md_dims_n(ar2));
+	dims[dim_i] = size;
+	MD_STAT(size_t old_size = md_dims_array(ar2)[dim_i]);
+	MD_STAT(_md_stats_resize_begin());
+	ar2 = _md_resize_to(ar2, dims);
+	MD_STAT(_md_stats_resize_end(ar2, dim_i, old_size, size));
+	return(ar2);
+}
+
+/* Accepts
+  * ar - Pointer to an array, array slice or view.
+  * new_dims - The new sizes of the dimensions of ar (one per dimension of ar; for a slice,
+    of the dimensions it has left).
+Returns: The resized array.
+Purpose: The same as calling md_resize on every dimension, but the elements are moved at
+most once.*/
+struct MD_ARRAY* md_resize_all(ARRAYLIKE ar, const size_t new_dims[]) {
+	struct MD_ARRAY* ar2;
+	size_t dims[MAX_DIMENSIONS];
+	unsigned int first;
+
+	ar2 = _md_resize_target(ar, &first, "md_resize_all");
+	memcpy(dims, ar2->dims, sizeof(size_t) * first);
+	memcpy(dims + first, new_dims, sizeof(size_t) * (md_dims_n(ar2) - first));
+	MD_STAT(_md_stats_resize_begin());
+	ar2 = _md_resize_to(ar2, dims);
+	MD_STAT(_md_stats_resize_end(ar2, MD_EVENT_ALL_DIMS, 0, 0));
+	return(ar2);
+}
+
+/* Accepts
+  * ar - Pointer to an array, array slice or view.
+  * dim_i - A dimension number (starting from 0).
+  * cap - The number of indices to make room for along dim_i.
+Returns: The array, moved if its capacity changed.
+Purpose: Sets the capacity of a dimension, so that md_resize can grow the dimension up
+to cap without moving the elements. A cap below the size of the dimension trims the
+capacity to the size, giving back the memory of earlier growth.*/
+struct MD_ARRAY* md_reserve(ARRAYLIKE ar, unsigned int dim_i, size_t cap) {
+	struct MD_ARRAY* ar2;
+	size_t caps[MAX_DIMENSIONS];
+	unsigned int first;
+
+	ar2 = _md_resize_target(ar, &first, "md_reserve");
+	dim_i += first;
+	if (cap < ar2->dims[dim_i]) cap = ar2->dims[dim_i];
+	if (cap == ar2->caps[dim_i]) return(ar2);
+	memcpy(caps, ar2->caps, sizeof(size_t) * md_dims_n(ar2));
+	caps[dim_i] = cap;
+	MD_STAT(size_t old_cap = ar2->caps[dim_i]);
+	MD_STAT(_md_stats_resize_begin());
+	ar2 = _md_recap(ar2, ar2->dims, caps);
+	MD_STAT(_md_stats_resize_end(ar2, dim_i, old_cap, cap));
+	return(ar2);
+}
+
 
 
-struct MD_ARRAY* _md_alloc(unsigned int _md_dims[], unsigned int n_dims, unsigned int size) {
+struct MD_ARRAY* md_unshare(ARRAYLIKE ar) {
+	struct MD_ARRAY* ar2;
+	unsigned int first;
+
+	ar2 = _md_resize_target(ar, &first, "md_unshare");
+	if (!md_is_shared(ar2)) return(ar2);
+	MD_STAT(_md_stats_resize_begin());
+	ar2 = _md_resize_copy(ar2, ar2->dims, ar2->caps);
+	MD_STAT(_md_stats_resize_end(ar2, MD_EVENT_ALL_DIMS, 0, 0));
+	return(ar2);
+}
+
+/* Allocates an array in arena, or when arena is NULL from the thread's pools (small
+arrays) or the C heap, with room for caps[k] indices along each dimension (caps NULL:
+exactly _md_dims). The elements are zeroed.*/
+static struct MD_ARRAY* _md_alloc_impl(struct MD_ARENA* arena, const size_t _md_dims[], const size_t caps[], unsigned int n_dims, size_t size, unsigned int flags, unsigned int layout, unsigned int tile_shift) {
+	struct MD_ARRAY header;
 	struct MD_ARRAY* _md_p;
-	struct MD_ARRAY* _md_header;
-	unsigned int _md_i, _md_sz = calculate_array_dimensions(_md_dims, n_dims, size);
+	char* p_block = NULL;
+	size_t _md_sz;
+	size_t data_offset = header.data - (char*)&header, pad = (flags & MD_ALIGN_DATA) ? MD_ALIGNMENT : 0;
 
 	if (n_dims > MAX_DIMENSIONS) {
 		fputs("md_alloc: n_dims should not exceed MAX_DIMENSIONS", stderr);
 		throw MULTIARRAY_EX();
 	}
+	header.struct_identifier = 0xAAAAA;
+	header.n_dims = n_dims;
+	header.type_size = size;
+	header.flags = flags;
+	header.layout = layout;
+	header.tile_shift = tile_shift;
+	memcpy(header.dims, _md_dims, sizeof(size_t) * n_dims);
+	memcpy(header.caps, caps ? caps : _md_dims, sizeof(size_t) * n_dims);
+	_md_sz = _md_layout(&header);
 
-	_md_p = (struct MD_ARRAY*)(calloc(sizeof(struct MD_ARRAY) + _md_sz, 1));
-	if (!_md_p) {
-		fputs("md_alloc: array allocation failed", stderr);
-		throw MULTIARRAY_EX();
+	header.block_size = sizeof(struct MD_ARRAY) + _md_sz + pad;
+	header.p_owner = arena;
+	header.refs = 0;
+	if (arena) {
+		header.storage = MD_STORAGE_ARENA;
+		p_block = (char*)_md_arena_take(arena, header.block_size);
+	} else {
+#ifndef MD_NO_POOL
+		header.storage = MD_STORAGE_POOL;
+		p_block = (char*)_md_pool_take(header.block_size, &header.block_size);
+#endif
+		if (!p_block) {
+			header.storage = MD_STORAGE_HEAP;
+			p_block = (char*)(calloc(header.block_size, 1));
+		}
+		if (!p_block) {
+			fputs("md_alloc: array allocation failed", stderr);
+			throw MULTIARRAY_EX();
+		}
 	}
-	memcpy(_md_p->dims, _md_dims, sizeof(unsigned int) * n_dims);
-	_md_header = _md_p;
-	_md_header->n_dims = n_dims;
-	_md_header->type_size = size;
-	_md_header->struct_identifier = 0xAAAAA;
+	//Place the header so that the data that follows it lands on the alignment boundary.
+	_md_p = (struct MD_ARRAY*)p_block;
+	if (pad) _md_p = (struct MD_ARRAY*)((((size_t)p_block + data_offset + pad - 1) & ~(pad - 1)) - data_offset);
+	header.p_block = p_block;
+	memcpy(_md_p, &header, data_offset);
 	return (_md_p);
 }
+
+/* Accepts:
+  * _md_dims, n_dims, size - As for _md_alloc.
+  * flags - MD_ALIGN_DATA and/or MD_PAD_ROWS.
+Returns: A pointer to the allocated array, with its elements zeroed.*/
+struct MD_ARRAY* _md_alloc_ex(const size_t _md_dims[], unsigned int n_dims, size_t size, unsigned int flags) {
+	struct MD_ARRAY* result = _md_alloc_impl(NULL, _md_dims, NULL, n_dims, size, flags, MD_LAYOUT_ROW_MAJOR, 0);
+
+	MD_STAT(_md_stats_alloc(result));
+	return(result);
+}
+
+/* Accepts:
+  * arena - The arena to allocate from.
+  * _md_dims, n_dims, size - As for _md_alloc.
+Returns: A pointer to the allocated array, with its elements zeroed.*/
+struct MD_ARRAY* _md_alloc_in(struct MD_ARENA* arena, const size_t _md_dims[], unsigned int n_dims, size_t size) {
+	struct MD_ARRAY* result = _md_alloc_impl(arena, _md_dims, NULL, n_dims, size, default_alloc_flags, MD_LAYOUT_ROW_MAJOR, 0);
+
+	MD_STAT(_md_stats_alloc(result));
+	return(result);
+}
+
+//Checks a layout and tile side, and returns log2 of the side.
+static unsigned int _md_tile_shift(unsigned int layout, unsigned int tile, const char* fn_name) {
+	unsigned int shift = 0;
+
+	if (layout > MD_LAYOUT_MORTON) {
+		fprintf(stderr, "%s: unknown layout %u\n", fn_name, layout);
+		throw MULTIARRAY_EX();
+	}
+	if (layout != MD_LAYOUT_TILED) return(0);
+	if (tile == 0 || (tile & (tile - 1))) {
+		fprintf(stderr, "%s: the side of a tile must be a power of 2, not %u\n", fn_name, tile);
+		throw MULTIARRAY_EX();
+	}
+	while ((1u << shift) < tile) shift++;
+	return(shift);
+}
+
+/* Accepts:
+  * _md_dims, n_dims, size - As for _md_alloc.
+  * layout - One of MD_LAYOUT_*.
+  * tile - The side of a tile, for MD_LAYOUT_TILED.
+Returns: A pointer to the allocated array, with its elements zeroed.*/
+struct MD_ARRAY* _md_alloc_layout(const size_t _md_dims[], unsigned int n_dims, size_t size, unsigned int layout, unsigned int tile) {
+	unsigned int shift = _md_tile_shift(layout, tile, "md_alloc_layout");
+	struct MD_ARRAY* result = _md_alloc_impl(NULL, _md_dims, NULL, n_dims, size, default_alloc_flags, layout, shift);
+
+	MD_STAT(_md_stats_alloc(result));
+	return(result);
+}
+
+struct MD_ARRAY* md_relayout(ARRAYLIKE ar, unsigned int layout, unsigned int tile) {
+	size_t dims[MAX_DIMENSIONS];
+	unsigned int n_dims = md_shape(ar, dims);
+	struct MD_ARRAY* result = _md_alloc_layout(dims, n_dims, md_type_size(md_base(ar)), layout, tile);
+
+	_md_transfer(result, ar, n_dims, dims);
+	return(result);
+}
+
+/* Accepts:
+  * flags - MD_ALIGN_DATA and/or MD_PAD_ROWS, or 0 for plain allocations.
+Purpose: Sets the flags used by _md_alloc and md_alloc for all arrays allocated afterwards.*/
+void md_set_alloc_flags(unsigned int flags) {
+	default_alloc_flags = flags;
+}
+
+struct MD_ARRAY* _md_alloc(const size_t _md_dims[], unsigned int n_dims, size_t size) {
+	return(_md_alloc_ex(_md_dims, n_dims, size, default_alloc_flags));
+}
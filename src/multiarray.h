@@ -3,7 +3,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
 #include <exception>
+#include "md_stats.h"
 
 /*Notes:
 Multiarrays (By James Candy)
@@ -15,9 +19,17 @@ Each dimension has a size. These properties are carried in the multi-array.
 
 Multi-arrays may be resized with the md_resize function. In that case elements
 of the multi-array are moved around to add or remove space. Multi-arrays
-cannot change dimensionality.
+cannot change dimensionality. Each dimension has a capacity as well as a size, and
+grows its capacity geometrically, so that growing an array an index at a time is cheap.
 
-Bounds checking is disabled by default. Compile with -DMD_INDEX_CHECKS to enable it.*/
+An array can be shared between several holders without copying it: md_retain takes a
+reference on it (through the array itself or any slice or view of it), and md_free gives one
+back, freeing the array with the last. A shared array is copy-on-write. md_resize and its
+relatives give the resizing holder a private copy and leave the others the old elements, and
+md_unshare does the same before a holder writes in place.
+
+Bounds checking is disabled by default. Compile with -DMD_INDEX_CHECKS to enable it.
+Instrumentation is as well; compile with -DMD_STATS to enable it (see md_stats.h).*/
 
 
 #define md_dims_n(AR) ((AR)->n_dims)
@@ -29,76 +41,298 @@ Bounds checking is disabled by default. Compile with -DMD_INDEX_CHECKS to enable
 struct MULTIARRAY_EX : public std::exception {
 };
 
+/*The largest rank of an array. Compile with -DMAX_DIMENSIONS=<n> to raise it; it must be
+the same for every file of a program. Loops run over the rank of each array, so a larger
+maximum only costs its header bytes. It may be at most 64, since sets of axes are kept
+as bit masks in a 64-bit integer.*/
+#ifndef MAX_DIMENSIONS
 #define MAX_DIMENSIONS 5
+#endif
+static_assert(MAX_DIMENSIONS >= 1 && MAX_DIMENSIONS <= 64, "MAX_DIMENSIONS must be between 1 and 64");
+
+//Alignment, in bytes, used by the allocation flags below: one cache line, and the width of
+//an AVX-512 register.
+#define MD_ALIGNMENT 64
+
+//Allocation flags, recorded in MD_ARRAY::flags.
+#define MD_ALIGN_DATA 1 //data starts on an MD_ALIGNMENT boundary
+#define MD_PAD_ROWS 2 //each row of the innermost dimension is padded to a multiple of MD_ALIGNMENT bytes
+
+//Where the memory of an array comes from, recorded in MD_ARRAY::storage.
+#define MD_STORAGE_HEAP 0 //calloc/realloc/free
+#define MD_STORAGE_POOL 1 //a thread's free list for small blocks
+#define MD_STORAGE_ARENA 2 //an MD_ARENA, named by p_owner
+#define MD_STORAGE_MMAP 3 //a file mapping made by md_open_mmap
+
+//Orders of the elements in memory, recorded in MD_ARRAY::layout; see md_alloc_layout.
+#define MD_LAYOUT_ROW_MAJOR 0 //the last index varies fastest, as in C
+#define MD_LAYOUT_COL_MAJOR 1 //the first index varies fastest, as in Fortran
+#define MD_LAYOUT_TILED 2 //square tiles, row-major within a tile and from tile to tile
+#define MD_LAYOUT_MORTON 3 //Z-order: the bits of the indices are interleaved
+
+//Modes of md_open_mmap.
+#define MD_MMAP_READONLY 0 //the elements may only be read
+#define MD_MMAP_COPY_ON_WRITE 1 //writes go to private pages and never reach the file
 
 
 struct MD_ARRAYLIKE {
 	unsigned int struct_identifier;
 };
 
-typedef struct MD_ARRAYLIKE* ARRAYLIKE; // = array or slice
+typedef struct MD_ARRAYLIKE* ARRAYLIKE; // = array, slice or view (or sparse or chunked array, see md_sparse.h and md_chunked.h)
 
 struct MD_ARRAY : public MD_ARRAYLIKE {
 	//struct_identifier must be AAAAA
 	unsigned int n_dims;
-	unsigned int type_size;
-
-	unsigned int dims[MAX_DIMENSIONS];
+	size_t type_size;
+
+	size_t dims[MAX_DIMENSIONS];
+	size_t caps[MAX_DIMENSIONS]; //Room allocated along each dimension; caps[k] >= dims[k]
+
+	unsigned int flags;
+	unsigned int layout; //MD_LAYOUT_*
+	unsigned int tile_shift; //log2 of the side of a tile, for MD_LAYOUT_TILED
+	//Bytes between consecutive indices of each dimension. Tiled arrays keep the bytes between
+	//consecutive tiles here, and Morton-order arrays the bits of the Z-order index that
+	//belong to the dimension; see _md_dim_offset.
+	size_t strides[MAX_DIMENSIONS];
+	unsigned int storage;
+	unsigned int refs; //Holders besides the first; see md_retain. Changed atomically
+	void* p_block; //The allocation holding this array
+	size_t block_size;
+	void* p_owner; //The arena, for MD_STORAGE_ARENA
 
 	char data[1];
 };
 
 //Always stack allocated
+struct MD_VIEW : public MD_ARRAYLIKE {
+	//struct_identifier must be AAAAC
+	struct MD_ARRAY* p_base;
+	char* p_indexing_base; //Address of the element at index 0 on every axis
+	unsigned int n_dims;
+	size_t dims[MAX_DIMENSIONS];
+	ptrdiff_t strides[MAX_DIMENSIONS]; //In bytes; negative for reversed axes
+};
+
+//Always stack allocated. A small POD that is passed and returned by value.
 struct MD_SLICE : public MD_ARRAYLIKE {
 	//struct_identifier must be AAAAB
 	struct MD_ARRAY* p_base;
+	const struct MD_VIEW* p_view; //The view the slice was taken on, or NULL
 	char* p_indexing_base;
 	unsigned int n_dims;
-	unsigned int stride;
+	size_t stride; //Byte size of the subarray, padding included; unused for slices of views
 };
 
 
-struct MD_ARRAY* _md_alloc(unsigned int _md_dims[], unsigned int n_dims, unsigned int size);
+struct MD_ARENA;
+
+struct MD_ARRAY* _md_alloc(const size_t _md_dims[], unsigned int n_dims, size_t size);
+struct MD_ARRAY* _md_alloc_ex(const size_t _md_dims[], unsigned int n_dims, size_t size, unsigned int flags);
+struct MD_ARRAY* _md_alloc_in(struct MD_ARENA* arena, const size_t _md_dims[], unsigned int n_dims, size_t size);
+struct MD_ARRAY* _md_alloc_layout(const size_t _md_dims[], unsigned int n_dims, size_t size, unsigned int layout, unsigned int tile);
+void md_set_alloc_flags(unsigned int flags);
+
+//Dimensions may also be given as unsigned ints.
+#if SIZE_MAX > UINT_MAX
+static inline const size_t* _md_widen_dims(const unsigned int _md_dims[], unsigned int n_dims, size_t wide[]) {
+	unsigned int k;
+
+	if (n_dims > MAX_DIMENSIONS) {
+		fputs("md_alloc: n_dims should not exceed MAX_DIMENSIONS", stderr);
+		throw MULTIARRAY_EX();
+	}
+	for (k=0;k<n_dims;k++) wide[k] = _md_dims[k];
+	return(wide);
+}
+
+static inline struct MD_ARRAY* _md_alloc(const unsigned int _md_dims[], unsigned int n_dims, size_t size) {
+	size_t wide[MAX_DIMENSIONS];
+
+	return(_md_alloc(_md_widen_dims(_md_dims, n_dims, wide), n_dims, size));
+}
+
+static inline struct MD_ARRAY* _md_alloc_ex(const unsigned int _md_dims[], unsigned int n_dims, size_t size, unsigned int flags) {
+	size_t wide[MAX_DIMENSIONS];
+
+	return(_md_alloc_ex(_md_widen_dims(_md_dims, n_dims, wide), n_dims, size, flags));
+}
+
+static inline struct MD_ARRAY* _md_alloc_in(struct MD_ARENA* arena, const unsigned int _md_dims[], unsigned int n_dims, size_t size) {
+	size_t wide[MAX_DIMENSIONS];
+
+	return(_md_alloc_in(arena, _md_widen_dims(_md_dims, n_dims, wide), n_dims, size));
+}
+#endif
+
+//Used by the allocator; see arena.cpp.
+void _md_release(struct MD_ARRAY* ar);
+void* _md_arena_take(struct MD_ARENA* arena, size_t bytes);
+void* _md_pool_take(size_t bytes, size_t* p_block_size);
+void _md_pool_give(void* p, size_t block_size);
+void _md_unmap(struct MD_ARRAY* ar);
+
+//Fills table with the byte offsets from md_getptr(ar) of indices 0 to n-1 along dimension k
+//of ar, in any layout; see multiarray.cpp.
+void _md_axis_offsets(ARRAYLIKE ar, unsigned int k, size_t n, ptrdiff_t table[]);
+
+/*Kinds of array defined outside this file: sparse arrays (struct_identifier AAAAD) and
+their slices (AAAAE) in sparse.cpp, columnar arrays of records (AAAAF) in columns.cpp, and
+chunked, file-backed arrays (AAAB0) and their slices (AAAB1) in chunked.cpp. Each of those
+files registers its entry points when it is linked in, so that md_free, md_getptr, md_shape
+and md_index reach them without the core having to link them.*/
+#define MD_KIND_FIRST 0xAAAADu
+#define MD_KIND_LAST 0xAAAB1u
+#define _md_is_sparse(AR) ((AR)->struct_identifier == 0xAAAAD || (AR)->struct_identifier == 0xAAAAE)
+#define _md_is_chunked(AR) ((AR)->struct_identifier == 0xAAAB0 || (AR)->struct_identifier == 0xAAAB1)
+
+struct MD_KIND {
+	void (*free_fn)(ARRAYLIKE ar);
+	char* (*getptr_fn)(ARRAYLIKE ar); //NULL when md_getptr does not apply
+	unsigned int (*shape_fn)(ARRAYLIKE ar, size_t dims[]);
+	ARRAYLIKE (*index_fn)(ARRAYLIKE ar, size_t i); //NULL when md_index does not apply
+	const char* base_error; //What md_base reports
+};
+
+extern struct MD_KIND _md_kinds[MD_KIND_LAST - MD_KIND_FIRST + 1];
+
+//Returns: 1, so that it can be called from the initializer of a static variable.
+int _md_register_kind(unsigned int struct_identifier, const struct MD_KIND* kind);
+
+//Returns: The registered kind of ar, or NULL for arrays, slices and views.
+static inline const struct MD_KIND* _md_kind(ARRAYLIKE ar) {
+	unsigned int id = ar->struct_identifier;
+
+	if (id < MD_KIND_FIRST || id > MD_KIND_LAST || !_md_kinds[id - MD_KIND_FIRST].free_fn) return(NULL);
+	return(&_md_kinds[id - MD_KIND_FIRST]);
+}
 
 /*Accepts:
   * _md_dims - A static/stack allocated array containing the dimensions.
   * type- The type of array to allocate.
-Returns a pointer to the allocated array.*/
+Returns a pointer to the allocated array.
+Note: The array is allocated with the flags last given to md_set_alloc_flags (none by default).*/
 #define md_alloc(_md_dims, type) (_md_alloc((_md_dims), N_ELEMS(_md_dims), sizeof(type)))
 
+/*The same as md_alloc, with explicit allocation flags (MD_ALIGN_DATA, MD_PAD_ROWS).
+Note: MD_PAD_ROWS only aligns every row when combined with MD_ALIGN_DATA. Code that walks
+a padded array must use its strides (md_strides) rather than assume it is packed.*/
+#define md_alloc_ex(_md_dims, type, flags) (_md_alloc_ex((_md_dims), N_ELEMS(_md_dims), sizeof(type), (flags)))
+
+/*Storage layouts. An array is row-major unless allocated with md_alloc_layout, which can
+instead lay it out column-major, in square tiles or in Morton (Z) order. Neighbours along
+every axis of a tiled or Morton-order array lie close together in memory, which suits
+stencils and other 2-D/3-D neighbourhood access: a tile is a few cache lines or a page,
+and a Z-order block of any power-of-two side is contiguous.
+
+Indexing (md_index, md_slice_at and the md_#d macros) works on every layout. Column-major
+arrays have strides, and everything else accepts them too; tiled and Morton-order arrays
+have none, so md_strides throws for them and code that walks strides (views, md_iter, the
+reductions and arithmetic) needs a strided copy, made by md_relayout. Resizing a tiled or
+Morton-order array copies it.
+
+Accepts:
+  * _md_dims - A static/stack allocated array containing the dimensions.
+  * type - The type of array to allocate.
+  * layout - One of MD_LAYOUT_*.
+  * tile - The side of a tile, a power of 2, for MD_LAYOUT_TILED (0 for other layouts).
+Returns: A pointer to the allocated array, with its elements zeroed.
+Note: The capacities of a tiled array are rounded up to whole tiles, and those of a
+Morton-order array to powers of 2.*/
+#define md_alloc_layout(_md_dims, type, layout, tile) (_md_alloc_layout((_md_dims), N_ELEMS(_md_dims), sizeof(type), (layout), (tile)))
+
+/*Arenas. An arena allocates arrays out of large chunks and releases all of them at once in
+md_arena_reset, which is far cheaper than a calloc and a free per array for short-lived
+arrays. md_free and md_resize accept arrays allocated in an arena: md_free does nothing
+(the memory comes back at the reset) and md_resize moves the array within the same arena.
+An arena must only be used by one thread at a time.
+
+Arrays allocated with md_alloc are served from per-thread size-class pools when they are
+small; compile with -DMD_NO_POOL to send every allocation to calloc.*/
+struct MD_ARENA* md_arena_create(size_t chunk_size);
+void md_arena_reset(struct MD_ARENA* arena);
+void md_arena_destroy(struct MD_ARENA* arena);
+
+/*Accepts:
+  * arena - The arena to allocate from.
+  * _md_dims - A static/stack allocated array containing the dimensions.
+  * type- The type of array to allocate.
+Returns a pointer to the allocated array, which lives until the arena is reset or destroyed.*/
+#define md_alloc_in(arena, _md_dims, type) (_md_alloc_in((arena), (_md_dims), N_ELEMS(_md_dims), sizeof(type)))
+
+/*Persistence. Arrays are saved in the NumPy .npy format and opened again by mapping the
+file into memory, so opening costs the same for any size of array and the elements are
+paged in from the file as they are touched. md_free unmaps a mapped array; md_resize
+copies it to the heap. POSIX only.
+
+Accepts:
+  * path - The path of a .npy file (versions 1 to 3, C order, native byte order).
+  * mode - MD_MMAP_READONLY or MD_MMAP_COPY_ON_WRITE.
+Returns: The array stored in the file.
+Note: The file must not be truncated while the array is open. In MD_MMAP_READONLY mode the
+page holding the MD_ARRAY header (the elements in its first 4 KiB or so) stays writable,
+since md_retain and md_free update the header; writes there reach only the private copy
+instead of faulting. The rest of the elements are protected.*/
+struct MD_ARRAY* md_open_mmap(const char* path, unsigned int mode);
+
+/*Accepts:
+  * ar - An array, array slice or view.
+  * path - The file to create or overwrite.
+  * descr - The NumPy type string of the elements, e.g. "<f8" for double or "<i4" for int;
+    NULL saves them as opaque records of the element size.
+Purpose: Writes ar to path in the .npy format.*/
+void md_save(ARRAYLIKE ar, const char* path, const char* descr = NULL);
+
 /* Accepts:
-  * ar - An array or array slice.
+  * ar - An array, array slice or view.
 Returns: void.
-Purpose: Frees the multi-array. If an array slice is provided, its attached array is freed in its
-entirety, after which time the array slice will no longer work.
+Purpose: Frees the multi-array. If an array slice or view is provided, its attached array is freed
+in its entirety, after which time the array slice or view will no longer work.
+When the array is shared (see md_retain), only the reference held through ar is given back;
+the array is freed with the last one.
 Note: Use this function to free multi-arrays. Do not use it to free plain old C arrays;
 use free instead.*/
 static void md_free(ARRAYLIKE ar) {
 	struct MD_ARRAY* ar2;
 	struct MD_SLICE* pSlice;
+	struct MD_VIEW* pView;
 
 	if (!ar) return;
 again:
 	switch (ar->struct_identifier) {
 	case 0xAAAAA:
 		ar2 = (struct MD_ARRAY*)ar;
+		//refs counts the other holders, so the last one finds it at 0 (and leaves it
+		//wrapped around, in memory that is about to be freed).
+		if (__atomic_fetch_sub(&ar2->refs, 1, __ATOMIC_ACQ_REL) != 0) break;
 		//The code for md_free writes a magic number into the memory of the array before
 		//freeing it, in an attempt to detect subsequent wild accesses to this memory;
 		//of course the effectiveness of this technique is theoretically limited to
 		//whether or not the optimizer allows the test.
+		MD_STAT(_md_stats_free(ar2));
 		ar2->struct_identifier = 0xFEEED;
-		free(ar);
+		_md_release(ar2);
 		break;
 	case 0xAAAAB:
 		pSlice = (struct MD_SLICE*)ar;
 		pSlice->struct_identifier = 0xFEEED;
 		ar = (ARRAYLIKE)(pSlice->p_base);
 		goto again;
+	case 0xAAAAC:
+		pView = (struct MD_VIEW*)ar;
+		pView->struct_identifier = 0xFEEED;
+		ar = (ARRAYLIKE)(pView->p_base);
+		goto again;
 	case 0xFEEED:
 		fputs("md_free: already freed.", stderr);
 		throw MULTIARRAY_EX();
 	default:
-		fputs("md_free: not an array or array slice.", stderr);
+		if (_md_kind(ar)) {
+			_md_kind(ar)->free_fn(ar);
+			break;
+		}
+		fputs("md_free: not an array, array slice or view.", stderr);
 		throw MULTIARRAY_EX();
 	}
 }
@@ -115,11 +349,88 @@ that C arrays are allowed to be ragged, whereas this array concept is not). Anot
 difference is that in C indexing upon a one dimensional array gives a pointer to the element
 type, whereas here it gives a zero-dimensional slice containing one element. No matter the
 dimensionality of a slice, its first element can be examined by using md_getptr (provided
-it's non empty). */
-struct MD_SLICE* md_index(ARRAYLIKE ar, unsigned int i);
+it's non empty). Indexing a view gives a view of one less dimension. */
+ARRAYLIKE md_index(ARRAYLIKE ar, size_t i);
+
+/* Accepts:
+  * ar - An array, array slice or view.
+  * i - The index for the next dimension to index.
+Returns: The slice of ar at index i, by value.
+Purpose: The same as md_index, except that the slice is a value owned by the caller rather
+than a thread-local temporary, so any number of slices can be live at once and held in
+registers across loop iterations.
+Note: A slice taken on a view refers to the view, which must outlive it.*/
+struct MD_SLICE md_slice_at(ARRAYLIKE ar, size_t i);
+
+#if defined(__BMI2__) && SIZE_MAX > UINT_MAX
+#include <immintrin.h>
+#endif
+
+//Deposits the low bits of x at the set bits of mask, in order (the BMI2 pdep instruction).
+static inline size_t _md_pdep(size_t x, size_t mask) {
+#if defined(__BMI2__) && SIZE_MAX > UINT_MAX
+	return(_pdep_u64(x, mask));
+#else
+	size_t result = 0;
+
+	for (;mask;x>>=1) {
+		if (x & 1) result |= mask & (0 - mask);
+		mask &= mask - 1;
+	}
+	return(result);
+#endif
+}
+
+/*Returns: The byte offset that index i along dimension level of ar adds to the address of
+an element. In every layout the offsets of the dimensions add up, which is what lets slices
+be taken one index at a time.*/
+static inline size_t _md_dim_offset(const struct MD_ARRAY* ar, unsigned int level, size_t i) {
+	unsigned int t = ar->tile_shift;
+
+	if (__builtin_expect(ar->layout < MD_LAYOUT_TILED, 1)) return(i * ar->strides[level]);
+	if (ar->layout == MD_LAYOUT_MORTON) return(_md_pdep(i, ar->strides[level]) * md_type_size(ar));
+	return((i >> t) * ar->strides[level] +
+		((i & (((size_t)1 << t) - 1)) << (t * (md_dims_n(ar) - 1 - level))) * md_type_size(ar));
+}
+
+//Slices a slice value; inline and free of any dispatch on struct_identifier.
+static inline struct MD_SLICE md_slice_at(const struct MD_SLICE& s, size_t i) {
+	struct MD_SLICE slice = s;
+	const struct MD_ARRAY* p_header = s.p_base;
+	size_t dim_size;
+	unsigned int level;
+
+	MD_STAT(_md_tls_stats.index_calls++);
+#ifdef MD_INDEX_CHECKS
+	if (s.n_dims == 0) {
+		fputs("md_slice_at: indexed more times than there are dimensions", stderr);
+		throw MULTIARRAY_EX();
+	}
+#endif
+	if (s.p_view) {
+		level = s.p_view->n_dims - s.n_dims;
+		dim_size = s.p_view->dims[level];
+		slice.p_indexing_base = s.p_indexing_base + (ptrdiff_t)i * s.p_view->strides[level];
+	} else {
+		level = md_dims_n(p_header) - s.n_dims;
+		dim_size = md_dims_array(p_header)[level];
+		slice.stride = p_header->strides[level];
+		slice.p_indexing_base = s.p_indexing_base + _md_dim_offset(p_header, level, i);
+	}
+#ifdef MD_INDEX_CHECKS
+	if (i >= dim_size) {
+		fprintf(stderr, "md_slice_at: %zu out of range %zu in dimension %u\n", i, dim_size, level);
+		throw MULTIARRAY_EX();
+	}
+#else
+	(void)dim_size;
+#endif
+	slice.n_dims = s.n_dims - 1;
+	return(slice);
+}
 
 /* Accepts:
-  * ar - An array or array slice.
+  * ar - An array, array slice or view.
 Returns: A pointer to the first element of the given array-like object.*/
 static char* md_getptr(ARRAYLIKE ar) {
 	struct MD_ARRAY* ar2;
@@ -129,6 +440,8 @@ static char* md_getptr(ARRAYLIKE ar) {
 	case 0xAAAAB:
 		pSlice = (struct MD_SLICE*)ar;
 		return pSlice->p_indexing_base;
+	case 0xAAAAC:
+		return ((struct MD_VIEW*)ar)->p_indexing_base;
 	case 0xAAAAA:
 		ar2 = (struct MD_ARRAY*)ar;
 		return ar2->data;
@@ -136,22 +449,201 @@ static char* md_getptr(ARRAYLIKE ar) {
 		fputs("md_getptr: already freed.", stderr);
 		throw MULTIARRAY_EX();
 	default:
-		fputs("md_getptr: not an array or array slice.", stderr);
+		if (_md_kind(ar) && _md_kind(ar)->getptr_fn) return _md_kind(ar)->getptr_fn(ar);
+		fputs("md_getptr: not an array, array slice or view.", stderr);
 		throw MULTIARRAY_EX();
 	}
 }
 
+/* Accepts:
+  * ar - An array, array slice or view.
+Returns: The array that owns the data of the given array-like object.*/
+static struct MD_ARRAY* md_base(ARRAYLIKE ar) {
+	switch (ar->struct_identifier) {
+	case 0xAAAAB:
+		return ((struct MD_SLICE*)ar)->p_base;
+	case 0xAAAAC:
+		return ((struct MD_VIEW*)ar)->p_base;
+	case 0xAAAAA:
+		return (struct MD_ARRAY*)ar;
+	case 0xFEEED:
+		fputs("md_base: already freed.", stderr);
+		throw MULTIARRAY_EX();
+	default:
+		if (_md_kind(ar)) {
+			fputs(_md_kind(ar)->base_error, stderr);
+			throw MULTIARRAY_EX();
+		}
+		fputs("md_base: not an array, array slice or view.", stderr);
+		throw MULTIARRAY_EX();
+	}
+}
+
+/* Accepts:
+  * ar - An array, array slice or view.
+Returns: ar.
+Purpose: Takes a reference on the array behind ar, in O(1), so that the array outlives
+md_free calls until every reference has been given back. Hand each consumer its own
+reference (a slice or view for a part of the array), and have it call md_free when done.
+Note: The count is atomic, so references may be taken and given back on any thread. Writing
+in place to a shared array is seen by every holder; call md_unshare first for a private copy.*/
+static inline ARRAYLIKE md_retain(ARRAYLIKE ar) {
+	__atomic_fetch_add(&md_base(ar)->refs, 1, __ATOMIC_RELAXED);
+	return(ar);
+}
+
+//Returns: Whether the array behind ar has more than one holder.
+static inline bool md_is_shared(ARRAYLIKE ar) {
+	return(__atomic_load_n(&md_base(ar)->refs, __ATOMIC_ACQUIRE) != 0);
+}
+
+/* Accepts:
+  * ar - An array, array slice or view.
+  * dims - Receives the sizes of the dimensions of ar (MAX_DIMENSIONS entries at most).
+Returns: The dimensionality of ar. For a slice these are the trailing dimensions of its
+array that have not been indexed yet.*/
+static unsigned int md_shape(ARRAYLIKE ar, size_t dims[]) {
+	struct MD_ARRAY* p_base;
+	const struct MD_VIEW* pView = NULL;
+	unsigned int n_dims, i;
+
+	if (_md_kind(ar)) return(_md_kind(ar)->shape_fn(ar, dims));
+	p_base = md_base(ar);
+	if (ar->struct_identifier == 0xAAAAC) pView = (struct MD_VIEW*)ar;
+	n_dims = ar->struct_identifier == 0xAAAAB ? ((struct MD_SLICE*)ar)->n_dims : md_dims_n(p_base);
+	if (ar->struct_identifier == 0xAAAAB) pView = ((struct MD_SLICE*)ar)->p_view;
+	if (pView) {
+		if (ar->struct_identifier == 0xAAAAC) n_dims = pView->n_dims;
+		for (i=0;i<n_dims;i++) dims[i] = pView->dims[pView->n_dims - n_dims + i];
+		return(n_dims);
+	}
+	for (i=0;i<n_dims;i++) dims[i] = md_dims_array(p_base)[md_dims_n(p_base) - n_dims + i];
+	return(n_dims);
+}
+
+/* Accepts:
+  * ar - An array, array slice or view.
+  * strides - Receives the distance in bytes between consecutive indices of each dimension.
+Returns: The dimensionality of ar.
+Note: Tiled and Morton-order arrays have no strides (see md_alloc_layout); for them (and
+their slices) md_strides throws MULTIARRAY_EX.*/
+static unsigned int md_strides(ARRAYLIKE ar, ptrdiff_t strides[]) {
+	const struct MD_VIEW* pView = NULL;
+	struct MD_ARRAY* p_base = md_base(ar);
+	size_t dims[MAX_DIMENSIONS];
+	unsigned int n_dims, i;
+
+	n_dims = md_shape(ar, dims);
+	if (ar->struct_identifier == 0xAAAAC) pView = (struct MD_VIEW*)ar;
+	if (ar->struct_identifier == 0xAAAAB) pView = ((struct MD_SLICE*)ar)->p_view;
+	if (pView) {
+		for (i=0;i<n_dims;i++) strides[i] = pView->strides[pView->n_dims - n_dims + i];
+		return(n_dims);
+	}
+	if (p_base->layout >= MD_LAYOUT_TILED && n_dims) {
+		fputs("md_strides: a tiled or Morton-order array has no strides; see md_relayout.", stderr);
+		throw MULTIARRAY_EX();
+	}
+	for (i=0;i<n_dims;i++) strides[i] = p_base->strides[md_dims_n(p_base) - n_dims + i];
+	return(n_dims);
+}
+
 /*Accepts:
-  * AR - An array or array slice.
+  * AR - An array, array slice or view.
   * I, J, K, etc. - Array indices.
   * TYPE - The type of object that the array contains. If a void pointer is desired pass 'void'.
 Returns: A pointer to an array element.
 Notes: If the indexing done does not exhaust the dimensions of the array, a pointer to the first
-element in the remaining dimensions is returned.*/
-#define md_2d(AR, I, J, TYPE) ((TYPE*)md_getptr(md_index(md_index((AR), (I)), (J))))
-#define md_3d(AR, I, J, K, TYPE) ((TYPE*)md_getptr(md_index(md_index(md_index((AR), (I)), (J)), (K))))
-#define md_4d(AR, I, J, K, L, TYPE) ((TYPE*)md_getptr(md_index(md_index(md_index(md_index((AR), (I)), (J)), (K)), (L))))
+element in the remaining dimensions is returned. The indexing goes through slice values
+(md_slice_at), so expressions may use any number of md_#d calls at once.*/
+#define md_2d(AR, I, J, TYPE) ((TYPE*)md_slice_at(md_slice_at((AR), (I)), (J)).p_indexing_base)
+#define md_3d(AR, I, J, K, TYPE) ((TYPE*)md_slice_at(md_slice_at(md_slice_at((AR), (I)), (J)), (K)).p_indexing_base)
+#define md_4d(AR, I, J, K, L, TYPE) ((TYPE*)md_slice_at(md_slice_at(md_slice_at(md_slice_at((AR), (I)), (J)), (K)), (L)).p_indexing_base)
+
+struct MD_ARRAY* md_resize(ARRAYLIKE ar, unsigned int dim_i, size_t size);
+
+/* Accepts:
+  * ar - An array, array slice or view.
+  * new_dims - The new sizes of the dimensions of ar.
+Returns: The resized array.
+Purpose: Resizes every dimension at once, moving the elements at most once.*/
+struct MD_ARRAY* md_resize_all(ARRAYLIKE ar, const size_t new_dims[]);
+
+#if SIZE_MAX > UINT_MAX
+static inline struct MD_ARRAY* md_resize_all(ARRAYLIKE ar, const unsigned int new_dims[]) {
+	size_t wide[MAX_DIMENSIONS];
+
+	return(md_resize_all(ar, _md_widen_dims(new_dims, md_shape(ar, wide), wide)));
+}
+#endif
+
+/* Accepts:
+  * ar - An array, array slice or view.
+  * dim_i - A dimension number (starting from 0).
+  * cap - The number of indices to make room for along dim_i; a cap below the size of the
+    dimension trims the capacity to the size.
+Returns: The array, which may have moved.
+Purpose: Lets md_resize grow dimension dim_i up to cap without moving the elements.*/
+struct MD_ARRAY* md_reserve(ARRAYLIKE ar, unsigned int dim_i, size_t cap);
+
+/* Accepts:
+  * ar - An array, array slice or view; a slice or view is used up, as by md_resize.
+Returns: The array behind ar when the caller is its only holder; otherwise a private copy
+of it (same dimensions, capacities and flags), and the caller's reference to the shared
+array is given back.
+Purpose: The copy step of copy-on-write: call it before writing in place to an array that
+may be shared (see md_retain).*/
+struct MD_ARRAY* md_unshare(ARRAYLIKE ar);
+
+/* Accepts:
+  * ar - An array, array slice or view.
+  * axis - The dimension to restrict.
+  * start - The first index taken along axis.
+  * stop - The index at which to stop (exclusive). Indices are not wrapped: to walk a
+    whole axis of size n backwards pass start = n-1, stop = -1, step = -1.
+  * step - The distance between taken indices; negative steps walk the axis backwards.
+Returns: A view of ar in which axis holds the indices start, start+step, ... before stop,
+and the other dimensions are unchanged. start and stop are clamped to the axis.
+Purpose: Windowing and downsampling without copying. The view shares the data of ar and is
+accepted by md_getptr, md_index, md_resize and md_free like a slice is.
+Note: The view is returned by value; keep it on the stack and pass its address.*/
+struct MD_VIEW md_subview(ARRAYLIKE ar, unsigned int axis, ptrdiff_t start, ptrdiff_t stop, ptrdiff_t step);
 
-struct MD_ARRAY* md_resize(ARRAYLIKE ar, unsigned int dim_i, unsigned int size);
+/* Accepts:
+  * ar - An array, array slice or view.
+  * n_dims - The rank to broadcast to; at least the rank of ar.
+  * dims - The shape to broadcast to.
+Returns: A view of ar with the shape dims, following NumPy's broadcasting rules: the
+dimensions of ar are matched against the last dimensions of dims, and each must either
+equal its counterpart or be 1. Dimensions of size 1, and the leading dimensions ar lacks,
+are repeated by giving them a stride of 0, so nothing is copied.
+Note: Several indices of the view name the same element; write through it only when that
+is intended. Throws MULTIARRAY_EX if the shapes are incompatible.*/
+struct MD_VIEW md_broadcast_to(ARRAYLIKE ar, unsigned int n_dims, const size_t dims[]);
+
+/* Accepts:
+  * a, b - Arrays, array slices or views.
+  * dims - Receives the shape a and b broadcast to; room for MAX_DIMENSIONS.
+Returns: The rank of that shape.
+Note: Throws MULTIARRAY_EX if the shapes are incompatible.*/
+unsigned int md_broadcast_shape(ARRAYLIKE a, ARRAYLIKE b, size_t dims[]);
+
+/* Accepts:
+  * ar - An array or array slice of any dimensionality up to MAX_DIMENSIONS.
+  * axes - A permutation of the dimension numbers of ar; dimension k of the result is
+    dimension axes[k] of ar.
+Returns: A newly allocated array holding the permuted elements.
+Note: The copy is tiled for the cache and uses SSE/AVX register transposes for elements
+of 1, 2, 4 and 8 bytes. A transpose of a matrix is md_permute with axes {1, 0}.*/
+struct MD_ARRAY* md_permute(ARRAYLIKE ar, const unsigned int axes[]);
+
+/* Accepts:
+  * ar - An array, array slice or view, in any layout.
+  * layout - One of MD_LAYOUT_*.
+  * tile - The side of a tile, a power of 2, for MD_LAYOUT_TILED (0 for other layouts).
+Returns: A new array with the shape and elements of ar, laid out as layout asks.
+Purpose: Converts between layouts, e.g. to tile an array for a stencil and back for code
+that needs strides. The elements are moved in runs that are contiguous on both sides.*/
+struct MD_ARRAY* md_relayout(ARRAYLIKE ar, unsigned int layout, unsigned int tile = 0);
 
 #endif
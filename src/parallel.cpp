@@ -0,0 +1,187 @@
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "md_parallel.h"
+
+/* The pool keeps one deque of tasks per worker. md_parallel_for deals its chunks out over
+the deques; a worker pops from the back of its own deque and, when that runs dry, steals
+from the front of the others. The calling thread steals as well while it waits, so a call
+never sits idle behind a busy pool. */
+
+struct _md_job {
+	MD_RANGE_FN fn;
+	void* ctx;
+	std::atomic<size_t> remaining;
+	std::mutex lock;
+	std::condition_variable done;
+	std::exception_ptr error;
+};
+
+struct _md_task {
+	struct _md_job* job;
+	size_t begin, end;
+};
+
+struct _md_queue {
+	std::mutex lock;
+	std::deque<struct _md_task> tasks;
+};
+
+static std::mutex pool_lock;
+static std::condition_variable pool_wake;
+static std::vector<std::thread> pool_workers;
+static std::deque<struct _md_queue> pool_queues;
+static std::atomic<size_t> pool_pending(0);
+static bool pool_stopping = false;
+static unsigned int pool_size = 0; //0 = not chosen yet
+static thread_local bool in_pool_task = false;
+
+static bool _md_pop(unsigned int self, struct _md_task* task) {
+	size_t n = pool_queues.size(), i;
+
+	if (self < n) {
+		std::lock_guard<std::mutex> guard(pool_queues[self].lock);
+		if (!pool_queues[self].tasks.empty()) {
+			*task = pool_queues[self].tasks.back();
+			pool_queues[self].tasks.pop_back();
+			return true;
+		}
+	}
+	for (i=1;i<=n;i++) {
+		struct _md_queue& victim = pool_queues[(self + i) % n];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty()) {
+			*task = victim.tasks.front();
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+static void _md_run(struct _md_task* task) {
+	struct _md_job* job = task->job;
+
+	pool_pending--;
+	in_pool_task = true;
+	try {
+		job->fn(task->begin, task->end, job->ctx);
+	} catch (...) {
+		std::lock_guard<std::mutex> guard(job->lock);
+		if (!job->error) job->error = std::current_exception();
+	}
+	in_pool_task = false;
+	//The count drops under the job's lock: once the caller sees zero it may return and
+	//take the job off its stack.
+	std::lock_guard<std::mutex> guard(job->lock);
+	if (--job->remaining == 0) job->done.notify_all();
+}
+
+static void _md_worker(unsigned int self) {
+	struct _md_task task;
+
+	for (;;) {
+		if (_md_pop(self, &task)) {
+			_md_run(&task);
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(pool_lock);
+		pool_wake.wait(guard, [] { return pool_stopping || pool_pending > 0; });
+		if (pool_stopping) return;
+	}
+}
+
+static void _md_stop_pool() {
+	{
+		std::lock_guard<std::mutex> guard(pool_lock);
+		pool_stopping = true;
+	}
+	pool_wake.notify_all();
+	for (std::thread& t : pool_workers) t.join();
+	pool_workers.clear();
+	pool_queues.clear();
+	pool_stopping = false;
+}
+
+struct _md_pool_reaper {
+	~_md_pool_reaper() { _md_stop_pool(); }
+};
+static struct _md_pool_reaper pool_reaper;
+
+static unsigned int _md_pool_size() {
+	if (!pool_size) {
+		pool_size = std::thread::hardware_concurrency();
+		if (!pool_size) pool_size = 1;
+	}
+	return pool_size;
+}
+
+//Starts the workers; the calling thread counts as one of the pool's threads.
+static void _md_start_pool() {
+	unsigned int i, n = _md_pool_size();
+	std::lock_guard<std::mutex> guard(pool_lock);
+
+	if (!pool_workers.empty() || n <= 1) return;
+	pool_queues.resize(n - 1);
+	for (i=0;i<n-1;i++) pool_workers.push_back(std::thread(_md_worker, i));
+}
+
+void md_set_num_threads(unsigned int n) {
+	_md_stop_pool();
+	pool_size = n;
+	_md_pool_size();
+}
+
+unsigned int md_get_num_threads() {
+	return _md_pool_size();
+}
+
+void md_parallel_for(size_t n, size_t grain, MD_RANGE_FN fn, void* ctx) {
+	struct _md_job job;
+	struct _md_task task;
+	size_t n_chunks, chunk, begin, i;
+	unsigned int n_threads = _md_pool_size();
+
+	if (!n) return;
+	if (!grain) grain = MD_PARALLEL_GRAIN;
+	if (n_threads <= 1 || n <= grain || in_pool_task) {
+		fn(0, n, ctx);
+		return;
+	}
+	_md_start_pool();
+
+	//Several chunks per thread, so that stealing can even out the load.
+	n_chunks = (n + grain - 1) / grain;
+	if (n_chunks > (size_t)n_threads * 8) n_chunks = (size_t)n_threads * 8;
+	chunk = (n + n_chunks - 1) / n_chunks;
+	n_chunks = (n + chunk - 1) / chunk;
+
+	job.fn = fn;
+	job.ctx = ctx;
+	job.remaining = n_chunks;
+	task.job = &job;
+	{
+		std::lock_guard<std::mutex> guard(pool_lock);
+		pool_pending += n_chunks;
+	}
+	for (i=0,begin=0;i<n_chunks;i++,begin+=chunk) {
+		struct _md_queue& q = pool_queues[i % pool_queues.size()];
+		task.begin = begin;
+		task.end = begin + chunk < n ? begin + chunk : n;
+		std::lock_guard<std::mutex> guard(q.lock);
+		q.tasks.push_back(task);
+	}
+	pool_wake.notify_all();
+
+	while (job.remaining > 0 && _md_pop((unsigned int)pool_queues.size(), &task)) _md_run(&task);
+	{
+		std::unique_lock<std::mutex> guard(job.lock);
+		job.done.wait(guard, [&] { return job.remaining == 0; });
+	}
+	if (job.error) std::rethrow_exception(job.error);
+}
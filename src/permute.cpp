@@ -0,0 +1,270 @@
+#include <string.h>
+#include "multiarray.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+//Edge length (in elements) of the square tiles the copy is blocked into. A 64x64 tile of
+//8-byte elements is 32KB on each side, which keeps the source and destination tiles in L1/L2.
+#define MD_PERMUTE_TILE 64
+
+/* The transposing micro-kernels. Each one reads a K x K block whose rows are src_ld bytes
+apart and writes its transpose into a block whose rows are dst_ld bytes apart. The
+generic version is used for element sizes without a register transpose, and for the
+ragged edges of a tile. */
+template <typename T> struct _md_kernel {
+	enum { K = 1 };
+	static inline void run(char* dst, ptrdiff_t dst_ld, const char* src, ptrdiff_t src_ld) {
+		*(T*)dst = *(const T*)src;
+	}
+};
+
+#if defined(__SSE2__)
+template <> struct _md_kernel<unsigned char> {
+	enum { K = 8 };
+	static inline void run(char* dst, ptrdiff_t dst_ld, const char* src, ptrdiff_t src_ld) {
+		__m128i b0, b1, b2, b3, c0, c1, c2, c3, d0, d1, d2, d3;
+
+		b0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src)), _mm_loadl_epi64((const __m128i*)(src + src_ld)));
+		b1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + 2*src_ld)), _mm_loadl_epi64((const __m128i*)(src + 3*src_ld)));
+		b2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + 4*src_ld)), _mm_loadl_epi64((const __m128i*)(src + 5*src_ld)));
+		b3 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + 6*src_ld)), _mm_loadl_epi64((const __m128i*)(src + 7*src_ld)));
+		c0 = _mm_unpacklo_epi16(b0, b1);
+		c1 = _mm_unpackhi_epi16(b0, b1);
+		c2 = _mm_unpacklo_epi16(b2, b3);
+		c3 = _mm_unpackhi_epi16(b2, b3);
+		d0 = _mm_unpacklo_epi32(c0, c2);
+		d1 = _mm_unpackhi_epi32(c0, c2);
+		d2 = _mm_unpacklo_epi32(c1, c3);
+		d3 = _mm_unpackhi_epi32(c1, c3);
+		_mm_storel_epi64((__m128i*)(dst), d0);
+		_mm_storel_epi64((__m128i*)(dst + dst_ld), _mm_unpackhi_epi64(d0, d0));
+		_mm_storel_epi64((__m128i*)(dst + 2*dst_ld), d1);
+		_mm_storel_epi64((__m128i*)(dst + 3*dst_ld), _mm_unpackhi_epi64(d1, d1));
+		_mm_storel_epi64((__m128i*)(dst + 4*dst_ld), d2);
+		_mm_storel_epi64((__m128i*)(dst + 5*dst_ld), _mm_unpackhi_epi64(d2, d2));
+		_mm_storel_epi64((__m128i*)(dst + 6*dst_ld), d3);
+		_mm_storel_epi64((__m128i*)(dst + 7*dst_ld), _mm_unpackhi_epi64(d3, d3));
+	}
+};
+
+template <> struct _md_kernel<unsigned short> {
+	enum { K = 8 };
+	static inline void run(char* dst, ptrdiff_t dst_ld, const char* src, ptrdiff_t src_ld) {
+		__m128i a[8], b[8], c[8];
+		int ii;
+
+		for (ii=0;ii<8;ii++) a[ii] = _mm_loadu_si128((const __m128i*)(src + ii*src_ld));
+		for (ii=0;ii<4;ii++) {
+			b[2*ii] = _mm_unpacklo_epi16(a[2*ii], a[2*ii+1]);
+			b[2*ii+1] = _mm_unpackhi_epi16(a[2*ii], a[2*ii+1]);
+		}
+		c[0] = _mm_unpacklo_epi32(b[0], b[2]);
+		c[1] = _mm_unpackhi_epi32(b[0], b[2]);
+		c[2] = _mm_unpacklo_epi32(b[1], b[3]);
+		c[3] = _mm_unpackhi_epi32(b[1], b[3]);
+		c[4] = _mm_unpacklo_epi32(b[4], b[6]);
+		c[5] = _mm_unpackhi_epi32(b[4], b[6]);
+		c[6] = _mm_unpacklo_epi32(b[5], b[7]);
+		c[7] = _mm_unpackhi_epi32(b[5], b[7]);
+		for (ii=0;ii<4;ii++) {
+			_mm_storeu_si128((__m128i*)(dst + 2*ii*dst_ld), _mm_unpacklo_epi64(c[ii], c[ii+4]));
+			_mm_storeu_si128((__m128i*)(dst + (2*ii+1)*dst_ld), _mm_unpackhi_epi64(c[ii], c[ii+4]));
+		}
+	}
+};
+
+#if defined(__AVX__)
+template <> struct _md_kernel<unsigned int> {
+	enum { K = 8 };
+	static inline void run(char* dst, ptrdiff_t dst_ld, const char* src, ptrdiff_t src_ld) {
+		__m256 r[8], t[8], tt[8];
+		int ii;
+
+		for (ii=0;ii<8;ii++) r[ii] = _mm256_loadu_ps((const float*)(src + ii*src_ld));
+		for (ii=0;ii<4;ii++) {
+			t[2*ii] = _mm256_unpacklo_ps(r[2*ii], r[2*ii+1]);
+			t[2*ii+1] = _mm256_unpackhi_ps(r[2*ii], r[2*ii+1]);
+		}
+		tt[0] = _mm256_shuffle_ps(t[0], t[2], _MM_SHUFFLE(1,0,1,0));
+		tt[1] = _mm256_shuffle_ps(t[0], t[2], _MM_SHUFFLE(3,2,3,2));
+		tt[2] = _mm256_shuffle_ps(t[1], t[3], _MM_SHUFFLE(1,0,1,0));
+		tt[3] = _mm256_shuffle_ps(t[1], t[3], _MM_SHUFFLE(3,2,3,2));
+		tt[4] = _mm256_shuffle_ps(t[4], t[6], _MM_SHUFFLE(1,0,1,0));
+		tt[5] = _mm256_shuffle_ps(t[4], t[6], _MM_SHUFFLE(3,2,3,2));
+		tt[6] = _mm256_shuffle_ps(t[5], t[7], _MM_SHUFFLE(1,0,1,0));
+		tt[7] = _mm256_shuffle_ps(t[5], t[7], _MM_SHUFFLE(3,2,3,2));
+		for (ii=0;ii<4;ii++) {
+			_mm256_storeu_ps((float*)(dst + ii*dst_ld), _mm256_permute2f128_ps(tt[ii], tt[ii+4], 0x20));
+			_mm256_storeu_ps((float*)(dst + (ii+4)*dst_ld), _mm256_permute2f128_ps(tt[ii], tt[ii+4], 0x31));
+		}
+	}
+};
+#else
+template <> struct _md_kernel<unsigned int> {
+	enum { K = 4 };
+	static inline void run(char* dst, ptrdiff_t dst_ld, const char* src, ptrdiff_t src_ld) {
+		__m128 r0 = _mm_loadu_ps((const float*)(src));
+		__m128 r1 = _mm_loadu_ps((const float*)(src + src_ld));
+		__m128 r2 = _mm_loadu_ps((const float*)(src + 2*src_ld));
+		__m128 r3 = _mm_loadu_ps((const float*)(src + 3*src_ld));
+
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		_mm_storeu_ps((float*)(dst), r0);
+		_mm_storeu_ps((float*)(dst + dst_ld), r1);
+		_mm_storeu_ps((float*)(dst + 2*dst_ld), r2);
+		_mm_storeu_ps((float*)(dst + 3*dst_ld), r3);
+	}
+};
+#endif
+
+template <> struct _md_kernel<unsigned long long> {
+	enum { K = 2 };
+	static inline void run(char* dst, ptrdiff_t dst_ld, const char* src, ptrdiff_t src_ld) {
+		__m128d r0 = _mm_loadu_pd((const double*)(src));
+		__m128d r1 = _mm_loadu_pd((const double*)(src + src_ld));
+
+		_mm_storeu_pd((double*)(dst), _mm_unpacklo_pd(r0, r1));
+		_mm_storeu_pd((double*)(dst + dst_ld), _mm_unpackhi_pd(r0, r1));
+	}
+};
+#endif
+
+/* Transposes an ny x nx block: the source has ny rows of nx contiguous elements, src_ld
+bytes apart; the destination receives nx rows of ny contiguous elements, dst_ld bytes apart.
+The block is walked in MD_PERMUTE_TILE square tiles, and each tile in K x K register blocks.*/
+template <typename T>
+static void _md_transpose_block(char* dst, ptrdiff_t dst_ld, const char* src, ptrdiff_t src_ld, size_t ny, size_t nx) {
+	const size_t K = _md_kernel<T>::K;
+	size_t y0, x0, y, x, y_end, x_end;
+
+	for (y0=0;y0<ny;y0+=MD_PERMUTE_TILE) {
+		y_end = y0 + MD_PERMUTE_TILE < ny ? y0 + MD_PERMUTE_TILE : ny;
+		for (x0=0;x0<nx;x0+=MD_PERMUTE_TILE) {
+			x_end = x0 + MD_PERMUTE_TILE < nx ? x0 + MD_PERMUTE_TILE : nx;
+			for (y=y0;y+K<=y_end;y+=K) {
+				for (x=x0;x+K<=x_end;x+=K) {
+					_md_kernel<T>::run(dst + x*dst_ld + y*sizeof(T), dst_ld, src + y*src_ld + x*sizeof(T), src_ld);
+				}
+				for (;x<x_end;x++) {
+					for (size_t yy=y;yy<y+K;yy++) {
+						*(T*)(dst + x*dst_ld + yy*sizeof(T)) = *(const T*)(src + yy*src_ld + x*sizeof(T));
+					}
+				}
+			}
+			for (;y<y_end;y++) {
+				for (x=x0;x<x_end;x++) {
+					*(T*)(dst + x*dst_ld + y*sizeof(T)) = *(const T*)(src + y*src_ld + x*sizeof(T));
+				}
+			}
+		}
+	}
+}
+
+//Fallback for element sizes that are not 1, 2, 4 or 8 bytes: tiled, one memcpy per element.
+static void _md_transpose_block_any(char* dst, ptrdiff_t dst_ld, const char* src, ptrdiff_t src_ld, size_t ny, size_t nx, size_t el_sz) {
+	size_t y0, x0, y, x, y_end, x_end;
+
+	for (y0=0;y0<ny;y0+=MD_PERMUTE_TILE) {
+		y_end = y0 + MD_PERMUTE_TILE < ny ? y0 + MD_PERMUTE_TILE : ny;
+		for (x0=0;x0<nx;x0+=MD_PERMUTE_TILE) {
+			x_end = x0 + MD_PERMUTE_TILE < nx ? x0 + MD_PERMUTE_TILE : nx;
+			for (y=y0;y<y_end;y++) {
+				for (x=x0;x<x_end;x++) {
+					memcpy(dst + x*dst_ld + y*el_sz, src + y*src_ld + x*el_sz, el_sz);
+				}
+			}
+		}
+	}
+}
+
+static void _md_transpose_dispatch(char* dst, ptrdiff_t dst_ld, const char* src, ptrdiff_t src_ld, size_t ny, size_t nx, size_t el_sz) {
+	switch (el_sz) {
+	case 1: _md_transpose_block<unsigned char>(dst, dst_ld, src, src_ld, ny, nx); break;
+	case 2: _md_transpose_block<unsigned short>(dst, dst_ld, src, src_ld, ny, nx); break;
+	case 4: _md_transpose_block<unsigned int>(dst, dst_ld, src, src_ld, ny, nx); break;
+	case 8: _md_transpose_block<unsigned long long>(dst, dst_ld, src, src_ld, ny, nx); break;
+	default: _md_transpose_block_any(dst, dst_ld, src, src_ld, ny, nx, el_sz); break;
+	}
+}
+
+/* Accepts:
+  * ar - An array, array slice or view.
+  * axes - A permutation of 0..n-1, n being the dimensionality of ar.
+Returns: A newly allocated array whose dimension k is dimension axes[k] of ar.
+Purpose: Generalized transpose. The copy is organized around the plane spanned by the
+destination's innermost axis (contiguous writes) and the axis that is innermost in the
+source (contiguous reads); that plane is transposed in cache-sized tiles with register
+transposes, and every other axis is walked by an odometer outside of it. A view with no
+contiguous axis is gathered one element at a time along the destination rows.*/
+struct MD_ARRAY* md_permute(ARRAYLIKE ar, const unsigned int axes[]) {
+	struct MD_ARRAY* result;
+	const char* p_src;
+	char* p_dst;
+	size_t el_sz, src_dims[MAX_DIMENSIONS], dims[MAX_DIMENSIONS], counter[MAX_DIMENSIONS], j;
+	ptrdiff_t src_str[MAX_DIMENSIONS], dst_str[MAX_DIMENSIONS], str_from_src[MAX_DIMENSIONS];
+	unsigned int n_dims, i, k, p, last;
+	unsigned long long seen = 0;
+	ptrdiff_t src_off, dst_off;
+
+	p_src = md_getptr(ar);
+	n_dims = md_shape(ar, src_dims);
+	el_sz = md_type_size(md_base(ar));
+
+	for (i=0;i<n_dims;i++) {
+		if (axes[i] >= n_dims || (seen & (1ull << axes[i]))) {
+			fputs("md_permute: axes must be a permutation of the array's dimensions", stderr);
+			throw MULTIARRAY_EX();
+		}
+		seen |= 1ull << axes[i];
+		dims[i] = src_dims[axes[i]];
+	}
+	result = _md_alloc(dims, n_dims, el_sz);
+	p_dst = result->data;
+	if (n_dims == 0) {
+		memcpy(p_dst, p_src, el_sz);
+		return(result);
+	}
+	for (i=0;i<n_dims;i++) {
+		if (!dims[i]) return(result);
+	}
+
+	md_strides(ar, src_str);
+	md_strides(result, dst_str);
+	for (i=0;i<n_dims;i++) str_from_src[i] = src_str[axes[i]];
+
+	//p is the destination axis that is contiguous in the source.
+	last = n_dims - 1;
+	for (p=0;p<last&&str_from_src[p]!=(ptrdiff_t)el_sz;p++);
+
+	//Every axis except p and last is stepped by the odometer; the plane (p, last) is one
+	//transpose call, or a row copy when p == last.
+	memset(counter, 0, sizeof(counter));
+	src_off = dst_off = 0;
+	for (;;) {
+		if (p == last && str_from_src[last] == (ptrdiff_t)el_sz) {
+			memcpy(p_dst + dst_off, p_src + src_off, dims[last] * el_sz);
+		} else if (p == last) {
+			for (j=0;j<dims[last];j++) memcpy(p_dst + dst_off + j*el_sz, p_src + src_off + (ptrdiff_t)j*str_from_src[last], el_sz);
+		} else {
+			_md_transpose_dispatch(p_dst + dst_off, dst_str[p], p_src + src_off, str_from_src[last], dims[last], dims[p], el_sz);
+		}
+		for (k=last;k-->0;) {
+			if (k == p) continue;
+			counter[k]++;
+			src_off += str_from_src[k];
+			dst_off += dst_str[k];
+			if (counter[k] < dims[k]) break;
+			src_off -= str_from_src[k] * (ptrdiff_t)dims[k];
+			dst_off -= dst_str[k] * (ptrdiff_t)dims[k];
+			counter[k] = 0;
+		}
+		if (k == (unsigned int)-1) break;
+	}
+	return(result);
+}
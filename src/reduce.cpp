@@ -0,0 +1,530 @@
+#include <string.h>
+#include <limits>
+#include <vector>
+#include "md_reduce.h"
+#include "md_parallel.h"
+
+/* Each reduction is a policy with a state type and four operations: init sets a state to
+the identity, add folds in one element, run folds in a run of elements, and merge folds in
+the state of the elements that follow. The engines below only walk the arrays and split
+the work; the policies do the arithmetic. */
+
+#define MD_REDUCE_GRAIN 65536 //elements reduced by one task, at the least
+#define MD_REDUCE_BLOCK 256 //outputs reduced together when the reduced axis is not innermost
+#define MD_REDUCE_SPLIT 64 //below this many outputs (or blocks), the reduced axis is split too
+#define MD_REDUCE_LANES 8
+
+static inline ptrdiff_t _md_abs(ptrdiff_t x) {
+	return x < 0 ? -x : x;
+}
+
+//Returns: The byte offset of element o, counted in C order, of a shape with the given strides.
+static inline ptrdiff_t _md_offset(size_t o, const size_t dims[], const ptrdiff_t strides[], unsigned int n_dims) {
+	ptrdiff_t result = 0;
+	unsigned int k;
+
+	for (k=n_dims;k-->0;) {
+		result += (ptrdiff_t)(o % dims[k]) * strides[k];
+		o /= dims[k];
+	}
+	return result;
+}
+
+/* Pairwise summation of a contiguous run, as NumPy does it: blocks of up to 128 elements are
+summed in MD_REDUCE_LANES independent lanes, and the block sums are added pairwise, so that
+the rounding error grows with log n rather than n.*/
+template <typename T>
+static T _md_pairwise(const T* x, size_t n) {
+	T lanes[MD_REDUCE_LANES], s = 0;
+	size_t i, k, half;
+
+	if (n < MD_REDUCE_LANES) {
+		for (i=0;i<n;i++) s += x[i];
+		return s;
+	}
+	if (n <= 128) {
+		for (k=0;k<MD_REDUCE_LANES;k++) lanes[k] = x[k];
+		for (i=MD_REDUCE_LANES;i+MD_REDUCE_LANES<=n;i+=MD_REDUCE_LANES) {
+			for (k=0;k<MD_REDUCE_LANES;k++) lanes[k] += x[i+k];
+		}
+		s = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+		for (;i<n;i++) s += x[i];
+		return s;
+	}
+	half = n / 2;
+	half -= half % MD_REDUCE_LANES;
+	return _md_pairwise(x, half) + _md_pairwise(x + half, n - half);
+}
+
+//Integer sums are exact, so they are accumulated directly.
+template <typename T, bool FLOAT = std::is_floating_point<T>::value>
+struct _md_sum {
+	typedef typename md_reduce_types<T>::sum_type out_type;
+	struct state {
+		out_type s;
+	};
+	static const bool needs_elements = false;
+
+	static inline void init(state& st) {
+		st.s = 0;
+	}
+	static inline void add(state& st, T x, size_t) {
+		st.s += x;
+	}
+	static void run(state& st, const char* p, ptrdiff_t step, size_t n, size_t) {
+		out_type s = 0;
+		size_t i;
+
+		if (step == sizeof(T)) {
+			const T* x = (const T*)p;
+			for (i=0;i<n;i++) s += x[i];
+		} else {
+			for (i=0;i<n;i++) s += *(const T*)(p + (ptrdiff_t)i * step);
+		}
+		st.s += s;
+	}
+	static inline void merge(state& st, const state& other) {
+		st.s += other.s;
+	}
+	static inline out_type result(const state& st, size_t) {
+		return st.s;
+	}
+};
+
+//Floating point sums keep a Kahan compensation term c; the true sum is s - c.
+template <typename T>
+struct _md_sum<T, true> {
+	typedef T out_type;
+	struct state {
+		T s, c;
+	};
+	static const bool needs_elements = false;
+
+	static inline void init(state& st) {
+		st.s = st.c = 0;
+	}
+	static inline void add(state& st, T x, size_t) {
+		T y = x - st.c, t = st.s + y;
+
+		st.c = (t - st.s) - y;
+		st.s = t;
+	}
+	static void run(state& st, const char* p, ptrdiff_t step, size_t n, size_t) {
+		size_t i;
+
+		if (step == sizeof(T)) {
+			add(st, _md_pairwise((const T*)p, n), 0);
+		} else {
+			for (i=0;i<n;i++) add(st, *(const T*)(p + (ptrdiff_t)i * step), 0);
+		}
+	}
+	static inline void merge(state& st, const state& other) {
+		add(st, other.s, 0);
+		add(st, -other.c, 0);
+	}
+	static inline T result(const state& st, size_t) {
+		return st.s - st.c;
+	}
+};
+
+template <typename T>
+struct _md_mean : public _md_sum<T> {
+	typedef typename md_reduce_types<T>::mean_type out_type;
+
+	//An empty mean is 0/0, which is NaN in the floating point mean_type.
+	static inline out_type result(const typename _md_sum<T>::state& st, size_t n) {
+		return (out_type)_md_sum<T>::result(st, n) / (out_type)n;
+	}
+};
+
+template <typename T, bool MAX>
+static inline bool _md_better(T x, T v) {
+	return MAX ? x > v : x < v;
+}
+
+//The identity of the minimum (MAX false) or maximum (MAX true).
+template <typename T, bool MAX>
+static inline T _md_worst() {
+	if (std::numeric_limits<T>::has_infinity) return MAX ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::infinity();
+	return MAX ? std::numeric_limits<T>::lowest() : std::numeric_limits<T>::max();
+}
+
+//Returns: The minimum or maximum of a run of n elements, or the identity if n is 0.
+template <typename T, bool MAX>
+static T _md_extreme_run(const char* p, ptrdiff_t step, size_t n) {
+	T lanes[MD_REDUCE_LANES], v = _md_worst<T, MAX>(), x;
+	size_t i = 0, k;
+
+	if (step == sizeof(T)) {
+		const T* a = (const T*)p;
+		for (k=0;k<MD_REDUCE_LANES;k++) lanes[k] = v;
+		for (;i+MD_REDUCE_LANES<=n;i+=MD_REDUCE_LANES) {
+			for (k=0;k<MD_REDUCE_LANES;k++) lanes[k] = _md_better<T, MAX>(a[i+k], lanes[k]) ? a[i+k] : lanes[k];
+		}
+		for (k=0;k<MD_REDUCE_LANES;k++) v = _md_better<T, MAX>(lanes[k], v) ? lanes[k] : v;
+	}
+	for (;i<n;i++) {
+		x = *(const T*)(p + (ptrdiff_t)i * step);
+		v = _md_better<T, MAX>(x, v) ? x : v;
+	}
+	return v;
+}
+
+template <typename T, bool MAX>
+struct _md_extreme {
+	typedef T out_type;
+	struct state {
+		T v;
+	};
+	static const bool needs_elements = true;
+
+	static inline void init(state& st) {
+		st.v = _md_worst<T, MAX>();
+	}
+	static inline void add(state& st, T x, size_t) {
+		st.v = _md_better<T, MAX>(x, st.v) ? x : st.v;
+	}
+	static void run(state& st, const char* p, ptrdiff_t step, size_t n, size_t) {
+		add(st, _md_extreme_run<T, MAX>(p, step, n), 0);
+	}
+	static inline void merge(state& st, const state& other) {
+		add(st, other.v, 0);
+	}
+	static inline T result(const state& st, size_t) {
+		return st.v;
+	}
+};
+
+//at is SIZE_MAX until the first element is seen. Ties go to the earliest index.
+template <typename T, bool MAX>
+struct _md_arg {
+	typedef size_t out_type;
+	struct state {
+		T v;
+		size_t at;
+	};
+	static const bool needs_elements = true;
+
+	static inline void init(state& st) {
+		st.v = _md_worst<T, MAX>();
+		st.at = SIZE_MAX;
+	}
+	static inline void add(state& st, T x, size_t i) {
+		if (_md_better<T, MAX>(x, st.v) || st.at == SIZE_MAX) {
+			st.v = x;
+			st.at = i;
+		}
+	}
+	//Finds the extreme with the vectorized pass, then looks for its first position.
+	static void run(state& st, const char* p, ptrdiff_t step, size_t n, size_t first) {
+		T v = _md_extreme_run<T, MAX>(p, step, n);
+		size_t i;
+
+		if (!n || !(_md_better<T, MAX>(v, st.v) || st.at == SIZE_MAX)) return;
+		for (i=0;i<n;i++) {
+			if (*(const T*)(p + (ptrdiff_t)i * step) == v) break;
+		}
+		if (i == n) {
+			//Only NaNs; take the first element as the non-vectorized loop would.
+			add(st, *(const T*)p, first);
+			return;
+		}
+		st.v = v;
+		st.at = first + i;
+	}
+	static inline void merge(state& st, const state& other) {
+		if (other.at != SIZE_MAX && (st.at == SIZE_MAX || _md_better<T, MAX>(other.v, st.v))) st = other;
+	}
+	static inline size_t result(const state& st, size_t) {
+		return st.at;
+	}
+};
+
+static void _md_check_type(ARRAYLIKE ar, size_t el_sz, const char* fn_name) {
+	if (md_type_size(md_base(ar)) != el_sz) {
+		fprintf(stderr, "%s: element size of the array does not match the reduction\n", fn_name);
+		throw MULTIARRAY_EX();
+	}
+}
+
+/* Reduces every element of ar into *result. The elements are cut into parts of
+MD_REDUCE_GRAIN in C order, which are reduced in parallel and merged in order.
+Returns: The number of elements.*/
+template <typename T, typename P>
+static size_t _md_reduce_all(ARRAYLIKE ar, typename P::state* result, const char* fn_name) {
+	struct _md_walk w;
+	const size_t el_sz[] = {sizeof(T)};
+	size_t n_parts, i;
+
+	_md_walk_init(&w, 1, &ar, el_sz, fn_name);
+	n_parts = (w.n_elems + MD_REDUCE_GRAIN - 1) / MD_REDUCE_GRAIN;
+	std::vector<typename P::state> partial(n_parts);
+	md_parallel_for(n_parts, 1, [&](size_t begin, size_t end) {
+		size_t part, first, last;
+
+		for (part=begin;part<end;part++) {
+			first = part * MD_REDUCE_GRAIN;
+			last = first + MD_REDUCE_GRAIN < w.n_elems ? first + MD_REDUCE_GRAIN : w.n_elems;
+			P::init(partial[part]);
+			_md_walk_range(&w, first, last, [&](char** p, const ptrdiff_t* step, size_t count) {
+				P::run(partial[part], p[0], step[0], count, first);
+				first += count;
+			});
+		}
+	});
+	P::init(*result);
+	for (i=0;i<n_parts;i++) P::merge(*result, partial[i]);
+	return w.n_elems;
+}
+
+//Folds rows i0..i1-1 of a block of width outputs into st[]; rows are sr bytes apart and
+//the outputs of a row sj bytes apart.
+template <typename T, typename P>
+static void _md_reduce_rows(typename P::state* st, const char* base, ptrdiff_t sj, size_t width, ptrdiff_t sr, size_t i0, size_t i1) {
+	size_t i, j;
+	const char* row;
+
+	for (i=i0;i<i1;i++) {
+		row = base + (ptrdiff_t)i * sr;
+		if (sj == sizeof(T)) {
+			const T* x = (const T*)row;
+			for (j=0;j<width;j++) P::add(st[j], x[j], i);
+		} else {
+			for (j=0;j<width;j++) P::add(st[j], *(const T*)(row + (ptrdiff_t)j * sj), i);
+		}
+	}
+}
+
+/* Reduces ar along axis. When the reduced axis is the innermost one in memory, each output
+is the reduction of one run; otherwise blocks of neighbouring outputs are reduced together
+a row at a time, so that the inner loop runs over contiguous elements either way. When
+there are too few outputs to occupy the pool, the reduced axis is cut into parts as well,
+and the parts are merged in order afterwards.*/
+template <typename T, typename P>
+static struct MD_ARRAY* _md_reduce_axis(ARRAYLIKE ar, unsigned int axis) {
+	typedef typename P::state S;
+	typedef typename P::out_type R;
+	size_t dims[MAX_DIMENSIONS], odims[MAX_DIMENSIONS];
+	ptrdiff_t strides[MAX_DIMENSIONS], istr[MAX_DIMENSIONS], ostr[MAX_DIMENSIONS];
+	unsigned int n_dims, m = 0, k;
+	size_t L, n_out = 1, J, unit, blocks_per_row, n_units, n_parts = 1, part_len, grain;
+	ptrdiff_t sr, sj;
+	bool along;
+	struct MD_ARRAY* out;
+	char *p, *q;
+
+	_md_check_type(ar, sizeof(T), "md_reduce");
+	n_dims = md_shape(ar, dims);
+	if (axis >= n_dims) {
+		fputs("md_reduce: axis out of range", stderr);
+		throw MULTIARRAY_EX();
+	}
+	md_strides(ar, strides);
+	p = md_getptr(ar);
+	L = dims[axis];
+	sr = strides[axis];
+	for (k=0;k<n_dims;k++) {
+		if (k == axis) continue;
+		odims[m] = dims[k];
+		istr[m] = strides[k];
+		n_out *= dims[k];
+		m++;
+	}
+	if (!m) {
+		odims[0] = 1;
+		istr[0] = 0;
+		m = 1;
+	}
+	if (!L && n_out && P::needs_elements) {
+		fputs("md_reduce: the axis is empty", stderr);
+		throw MULTIARRAY_EX();
+	}
+	out = _md_alloc(odims, m, sizeof(R));
+	if (!n_out) return out;
+	md_strides(out, ostr);
+	q = md_getptr(out);
+
+	J = odims[m-1];
+	sj = istr[m-1];
+	along = J == 1 || _md_abs(sr) <= _md_abs(sj);
+	unit = along ? 1 : (J < MD_REDUCE_BLOCK ? J : MD_REDUCE_BLOCK);
+	blocks_per_row = (J + unit - 1) / unit;
+	n_units = along ? n_out : n_out / J * blocks_per_row;
+	if (n_units < MD_REDUCE_SPLIT) {
+		n_parts = L * unit / MD_REDUCE_GRAIN;
+		if (n_parts > L) n_parts = L;
+		if (n_parts < 1) n_parts = 1;
+	}
+	part_len = (L + n_parts - 1) / n_parts;
+	if (part_len) n_parts = (L + part_len - 1) / part_len;
+	grain = part_len ? MD_REDUCE_GRAIN / (unit * part_len) : MD_REDUCE_GRAIN;
+	if (grain < 1) grain = 1;
+
+	std::vector<S> partial(n_parts > 1 ? n_units * n_parts * unit : 0);
+	md_parallel_for(n_units * n_parts, grain, [&](size_t begin, size_t end) {
+		S st[MD_REDUCE_BLOCK];
+		size_t idx[MAX_DIMENSIONS];
+		size_t t, u, part, i0, i1, o, width, j;
+		unsigned int d;
+		const char* base;
+		char* dst;
+
+		if (along && n_parts == 1) {
+			//One whole run per output: step through the outputs like an odometer.
+			o = begin;
+			for (d=m;d-->0;) {
+				idx[d] = o % odims[d];
+				o /= odims[d];
+			}
+			base = p + _md_offset(begin, odims, istr, m);
+			dst = q + _md_offset(begin, odims, ostr, m);
+			for (t=begin;t<end;t++) {
+				P::init(st[0]);
+				P::run(st[0], base, sr, L, 0);
+				*(R*)dst = P::result(st[0], L);
+				for (d=m;d-->0;) {
+					base += istr[d];
+					dst += ostr[d];
+					if (++idx[d] < odims[d]) break;
+					base -= istr[d] * (ptrdiff_t)odims[d];
+					dst -= ostr[d] * (ptrdiff_t)odims[d];
+					idx[d] = 0;
+				}
+			}
+			return;
+		}
+		for (t=begin;t<end;t++) {
+			u = t / n_parts;
+			part = t % n_parts;
+			i0 = part * part_len;
+			i1 = i0 + part_len < L ? i0 + part_len : L;
+			if (along) {
+				o = u;
+				width = 1;
+			} else {
+				o = u / blocks_per_row * J + u % blocks_per_row * unit;
+				width = J - o % J < unit ? J - o % J : unit;
+			}
+			base = p + _md_offset(o, odims, istr, m);
+			for (j=0;j<width;j++) P::init(st[j]);
+			if (along) P::run(st[0], base + (ptrdiff_t)i0 * sr, sr, i1 - i0, i0);
+			else _md_reduce_rows<T, P>(st, base, sj, width, sr, i0, i1);
+			if (n_parts == 1) {
+				dst = q + _md_offset(o, odims, ostr, m);
+				for (j=0;j<width;j++) *(R*)(dst + (ptrdiff_t)j * ostr[m-1]) = P::result(st[j], L);
+			} else {
+				memcpy(&partial[(u * n_parts + part) * unit], st, width * sizeof(S));
+			}
+		}
+	});
+	if (n_parts > 1) {
+		md_parallel_for(n_units, 1, [&](size_t begin, size_t end) {
+			size_t u, part, o, width, j;
+			char* dst;
+			S st;
+
+			for (u=begin;u<end;u++) {
+				o = along ? u : u / blocks_per_row * J + u % blocks_per_row * unit;
+				width = along ? 1 : (J - o % J < unit ? J - o % J : unit);
+				dst = q + _md_offset(o, odims, ostr, m);
+				for (j=0;j<width;j++) {
+					st = partial[u * n_parts * unit + j];
+					for (part=1;part<n_parts;part++) P::merge(st, partial[(u * n_parts + part) * unit + j]);
+					*(R*)(dst + (ptrdiff_t)j * ostr[m-1]) = P::result(st, L);
+				}
+			}
+		});
+	}
+	return out;
+}
+
+template <typename T>
+struct MD_ARRAY* md_reduce(ARRAYLIKE ar, unsigned int axis, unsigned int op) {
+	switch (op) {
+	case MD_SUM:
+		return _md_reduce_axis<T, _md_sum<T> >(ar, axis);
+	case MD_MIN:
+		return _md_reduce_axis<T, _md_extreme<T, false> >(ar, axis);
+	case MD_MAX:
+		return _md_reduce_axis<T, _md_extreme<T, true> >(ar, axis);
+	case MD_MEAN:
+		return _md_reduce_axis<T, _md_mean<T> >(ar, axis);
+	case MD_ARGMIN:
+		return _md_reduce_axis<T, _md_arg<T, false> >(ar, axis);
+	case MD_ARGMAX:
+		return _md_reduce_axis<T, _md_arg<T, true> >(ar, axis);
+	}
+	fputs("md_reduce: unknown operation", stderr);
+	throw MULTIARRAY_EX();
+}
+
+template <typename T>
+typename md_reduce_types<T>::sum_type md_sum(ARRAYLIKE ar) {
+	typename _md_sum<T>::state st;
+
+	_md_reduce_all<T, _md_sum<T> >(ar, &st, "md_sum");
+	return _md_sum<T>::result(st, 0);
+}
+
+template <typename T>
+typename md_reduce_types<T>::mean_type md_mean(ARRAYLIKE ar) {
+	typename _md_mean<T>::state st;
+	size_t n = _md_reduce_all<T, _md_mean<T> >(ar, &st, "md_mean");
+
+	return _md_mean<T>::result(st, n);
+}
+
+//The reductions that are undefined on an empty array.
+template <typename T, typename P>
+static typename P::out_type _md_reduce_nonempty(ARRAYLIKE ar, const char* fn_name) {
+	typename P::state st;
+
+	if (!_md_reduce_all<T, P>(ar, &st, fn_name)) {
+		fprintf(stderr, "%s: the array is empty\n", fn_name);
+		throw MULTIARRAY_EX();
+	}
+	return P::result(st, 0);
+}
+
+template <typename T>
+T md_min(ARRAYLIKE ar) {
+	return _md_reduce_nonempty<T, _md_extreme<T, false> >(ar, "md_min");
+}
+
+template <typename T>
+T md_max(ARRAYLIKE ar) {
+	return _md_reduce_nonempty<T, _md_extreme<T, true> >(ar, "md_max");
+}
+
+template <typename T>
+size_t md_argmin(ARRAYLIKE ar) {
+	return _md_reduce_nonempty<T, _md_arg<T, false> >(ar, "md_argmin");
+}
+
+template <typename T>
+size_t md_argmax(ARRAYLIKE ar) {
+	return _md_reduce_nonempty<T, _md_arg<T, true> >(ar, "md_argmax");
+}
+
+#define MD_REDUCE_INSTANTIATE(T) \
+	template struct MD_ARRAY* md_reduce<T>(ARRAYLIKE ar, unsigned int axis, unsigned int op); \
+	template md_reduce_types<T>::sum_type md_sum<T>(ARRAYLIKE ar); \
+	template T md_min<T>(ARRAYLIKE ar); \
+	template T md_max<T>(ARRAYLIKE ar); \
+	template md_reduce_types<T>::mean_type md_mean<T>(ARRAYLIKE ar); \
+	template size_t md_argmin<T>(ARRAYLIKE ar); \
+	template size_t md_argmax<T>(ARRAYLIKE ar);
+
+MD_REDUCE_INSTANTIATE(char)
+MD_REDUCE_INSTANTIATE(signed char)
+MD_REDUCE_INSTANTIATE(unsigned char)
+MD_REDUCE_INSTANTIATE(short)
+MD_REDUCE_INSTANTIATE(unsigned short)
+MD_REDUCE_INSTANTIATE(int)
+MD_REDUCE_INSTANTIATE(unsigned int)
+MD_REDUCE_INSTANTIATE(long)
+MD_REDUCE_INSTANTIATE(unsigned long)
+MD_REDUCE_INSTANTIATE(long long)
+MD_REDUCE_INSTANTIATE(unsigned long long)
+MD_REDUCE_INSTANTIATE(float)
+MD_REDUCE_INSTANTIATE(double)
@@ -1,24 +1,32 @@
-#include "reflectable.h"
-#include <stdio.h>
-
-const struct REFLECT definition_int = {"int", 0, 4, {NULL}, {""}};
-const struct REFLECT definition_long = {"long", 0, 4, {NULL}, {""}};
-const struct REFLECT definition_short = {"short", 0, 2, {NULL}, {""}};
-const struct REFLECT definition_char = {"char", 0, 1, {NULL}, {""}};
-const struct REFLECT definition_float = {"float", 0, 4, {NULL}, {""}};
-const struct REFLECT definition_double = {"double", 0, 8, {NULL}, {""}};
-const struct REFLECT definition_time_t = {"time_t", 2, 8, {&definition_long, &definition_long}, {"tv_sec", "tv_nsec"}};
-
-void reflect_print(const struct REFLECT* p) {
-	int ii;
-
-	for (ii = 0;ii < 80;ii++) putchar('*');
-	printf("\nStructure name: %s (size: %u)\n", p->typenm, p->bytessize);
-	for (ii = 0;ii < 80;ii++) putchar('*');
-	puts("\nMember names:           Types:");
-	for (ii = 0;ii < p->n_members;ii++) {
-		printf("%-23s %-56s\n", p->member_names[ii], p->members[ii]->typenm);
-	}
-	for (ii = 0;ii < 80;ii++) putchar('*');
-	puts("");
-}
+#include "reflectable.h"
+#include <stdio.h>
+
+#ifdef REFLECT_INLINE_DEFINITIONS
+//Emits the inline definitions here too, for files that only declare them (C).
+extern const struct REFLECT* const _reflect_builtins[] = {
+	&definition_int, &definition_long, &definition_short, &definition_char,
+	&definition_float, &definition_double, &definition_time_t
+};
+#else
+const struct REFLECT definition_int = {"int", 0, 4, {NULL}, {""}, 0, {0}, {0}, {0}};
+const struct REFLECT definition_long = {"long", 0, 4, {NULL}, {""}, 0, {0}, {0}, {0}};
+const struct REFLECT definition_short = {"short", 0, 2, {NULL}, {""}, 0, {0}, {0}, {0}};
+const struct REFLECT definition_char = {"char", 0, 1, {NULL}, {""}, 0, {0}, {0}, {0}};
+const struct REFLECT definition_float = {"float", 0, 4, {NULL}, {""}, 0, {0}, {0}, {0}};
+const struct REFLECT definition_double = {"double", 0, 8, {NULL}, {""}, 0, {0}, {0}, {0}};
+const struct REFLECT definition_time_t = {"time_t", 2, 8, {&definition_long, &definition_long}, {"tv_sec", "tv_nsec"}, 0, {0}, {0}, {0}};
+#endif
+
+void reflect_print(const struct REFLECT* p) {
+	int ii;
+
+	for (ii = 0;ii < 80;ii++) putchar('*');
+	printf("\nStructure name: %s (size: %u)\n", p->typenm, p->bytessize);
+	for (ii = 0;ii < 80;ii++) putchar('*');
+	puts("\nMember names:           Types:");
+	for (ii = 0;ii < p->n_members;ii++) {
+		printf("%-23s %-56s\n", p->member_names[ii], p->members[ii]->typenm);
+	}
+	for (ii = 0;ii < 80;ii++) putchar('*');
+	puts("");
+}
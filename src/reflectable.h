@@ -2,7 +2,13 @@
 #define _JC_REFLECTABLE
 
 #include <stdlib.h>
-#include "CExceptions.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef __cplusplus
+#include <initializer_list>
+#else
+#include "CExceptions.h" //throw and catch for C; C++ has its own
+#endif
 
 typedef void* REFLECTABLE;
 
@@ -11,19 +17,102 @@ available including its typename, size in bytes, and information about its membe
 
 Note: New structures defined as REFLECTABLE have to be packed. Type information
 will be defined in a statically allocated REFLECT structure and referenced
-by all allocated data from that structure.*/
+by all allocated data from that structure.
+
+Each type has exactly one REFLECT structure, so the address of that structure is the
+identity of the type: recast compares addresses, not names. Definitions made with
+reflect_define (C++17 and later, where it is constexpr) also carry the offset of every
+member and two small open-addressed hash tables, of member names and of member type names,
+all computed when the program is compiled; member_by_name and member_by_type then take
+constant time and allocate nothing. The built-in definitions are then inline variables of
+this header. Definitions written as plain initializers, as C requires, leave those tables
+empty, and are searched member by member instead. Compile every file of a program with the
+same choice, so that each type keeps one definition.*/
+
+#define REFLECT_MAX_MEMBERS 10
+#define REFLECT_SLOTS 32 //Slots of each hash table; a power of two, over twice REFLECT_MAX_MEMBERS
 
 #pragma pack(push, 1)
 struct REFLECT {
 	const char* typenm;
 	unsigned short n_members;
 	unsigned short bytessize;
-	const struct REFLECT* members[10];
-	const char* member_names[10];
+	const struct REFLECT* members[REFLECT_MAX_MEMBERS];
+	const char* member_names[REFLECT_MAX_MEMBERS];
+
+	//Filled in by reflect_define; all zero otherwise.
+	unsigned char hashed; //Whether the fields below are filled in
+	unsigned short offsets[REFLECT_MAX_MEMBERS]; //Byte offset of each member
+	unsigned char name_slots[REFLECT_SLOTS]; //Member index + 1 by hash of member name; 0 = empty
+	unsigned char type_slots[REFLECT_SLOTS]; //The same by hash of type name, for the first member of each type
 };
 #pragma pack(pop)
 
+#if defined(__cplusplus) && __cpp_constexpr >= 201304L
+#define REFLECT_CONSTEXPR constexpr
+#else
+#define REFLECT_CONSTEXPR
+#endif
+
+//Returns: The hash table slot at which a search for the name s starts (FNV-1a).
+static REFLECT_CONSTEXPR unsigned int reflect_hash(const char* s) {
+	unsigned int h = 2166136261u;
+
+	while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h & (REFLECT_SLOTS - 1);
+}
+
+#if defined(__cplusplus) && __cpp_constexpr >= 201304L && __cpp_inline_variables >= 201606L
+#define REFLECT_INLINE_DEFINITIONS
+static constexpr bool _reflect_streq(const char* a, const char* b) {
+	while (*a && *a == *b) {
+		a++;
+		b++;
+	}
+	return *a == *b;
+}
+
+/* Accepts:
+  * typenm - The name of the type.
+  * bytessize - Its size in bytes.
+  * members - The types of its members, in order; at most REFLECT_MAX_MEMBERS.
+  * member_names - Their names.
+Returns: The REFLECT structure of the type, with its offset table and hash tables filled in.
+Purpose: Defines a REFLECTABLE type at compile time:
+	constexpr struct REFLECT definition_time_t = reflect_define("time_t", 8,
+		{&definition_long, &definition_long}, {"tv_sec", "tv_nsec"});*/
+static constexpr struct REFLECT reflect_define(const char* typenm, unsigned short bytessize,
+		std::initializer_list<const struct REFLECT*> members, std::initializer_list<const char*> member_names) {
+	struct REFLECT r = {};
+	unsigned int i = 0, j = 0, s = 0;
+	unsigned short offset = 0;
+
+	if (members.size() > REFLECT_MAX_MEMBERS || members.size() != member_names.size()) throw("Badmembers");
+	r.typenm = typenm;
+	r.bytessize = bytessize;
+	r.n_members = (unsigned short)members.size();
+	r.hashed = 1;
+	for (i=0;i<r.n_members;i++) {
+		r.members[i] = members.begin()[i];
+		r.member_names[i] = member_names.begin()[i];
+		r.offsets[i] = offset;
+		offset += r.members[i]->bytessize;
+
+		for (s=reflect_hash(r.member_names[i]);r.name_slots[s];s=(s+1)&(REFLECT_SLOTS-1));
+		r.name_slots[s] = (unsigned char)(i + 1);
+
+		for (j=0;j<i&&!_reflect_streq(r.members[j]->typenm, r.members[i]->typenm);j++);
+		if (j < i) continue;
+		for (s=reflect_hash(r.members[i]->typenm);r.type_slots[s];s=(s+1)&(REFLECT_SLOTS-1));
+		r.type_slots[s] = (unsigned char)(i + 1);
+	}
+	return r;
+}
+#endif
+
+//Allocated data is preceded by its element count and then by its REFLECT pointer.
 #define _reflect_header_p(P) ((struct REFLECT**)(P) - 1)
+#define _reflect_count_p(P) ((size_t*)_reflect_header_p(P) - 1)
 
 /*Purpose: To access ths structure containing reflection information for a structure,
 using a pointer to data from that structure.*/
@@ -45,13 +134,22 @@ static void reflect_free(REFLECTABLE p) {
 		throw("Reflectable");
 	}
 	*p_header = NULL;
-	free(p_header);
+	free(_reflect_count_p(p));
+}
+
+/*Returns: The number of elements allocated at p by alloc_array (1 for alloc).*/
+static size_t reflect_count(REFLECTABLE p) {
+	reflect_header(p);
+	return *_reflect_count_p(p);
 }
 
 static REFLECTABLE _alloc(const struct REFLECT* p, size_t n_elements, size_t n_sz) {
-	struct REFLECT** p2 = calloc(1, n_elements*n_sz+sizeof(const struct REFLECT*));
+	size_t* p_count = (size_t*)calloc(1, n_elements*n_sz+sizeof(size_t)+sizeof(const struct REFLECT*));
+	struct REFLECT** p2;
 
-	if(!p2) throw("Allocfailed");
+	if(!p_count) throw("Allocfailed");
+	*p_count = n_elements;
+	p2 = (struct REFLECT**)(p_count + 1);
 	*p2 = (struct REFLECT*)p;
 	return p2+1;
 }
@@ -74,7 +172,7 @@ static REFLECTABLE _structural_subtyping(REFLECTABLE sub, const struct REFLECT*
 
 static REFLECTABLE _recast(REFLECTABLE p, const struct REFLECT* type_def) {
 	return
-		(!strcmp(reflect_header(p)->typenm, type_def->typenm)
+		(reflect_header(p) == type_def
 		? p
 		: NULL);
 }
@@ -94,13 +192,23 @@ by P2.*/
 
 /* Accepts:
   * P - A pointer to data with reflection information.
-Returns: The coercion of P if P points to a structure of typename TYPE; NULL otherwise.*/
+Returns: The coercion of P if P points to a structure of type TYPE; NULL otherwise.*/
 #define recast(P, TYPE) ((TYPE*)_recast((P), &definition_##TYPE))
 
 /* The same as recast but gets the reflection information from the structure referenced
 by P2.*/
 #define recast_as(P, P2) (_recast((P), reflect_header(P2)))
 
+#ifdef REFLECT_INLINE_DEFINITIONS
+//Inline, so that they are one object across the program and reflect_define can read them.
+inline constexpr struct REFLECT definition_int = reflect_define("int", 4, {}, {});
+inline constexpr struct REFLECT definition_long = reflect_define("long", 4, {}, {});
+inline constexpr struct REFLECT definition_short = reflect_define("short", 2, {}, {});
+inline constexpr struct REFLECT definition_char = reflect_define("char", 1, {}, {});
+inline constexpr struct REFLECT definition_float = reflect_define("float", 4, {}, {});
+inline constexpr struct REFLECT definition_double = reflect_define("double", 8, {}, {});
+inline constexpr struct REFLECT definition_time_t = reflect_define("time_t", 8, {&definition_long, &definition_long}, {"tv_sec", "tv_nsec"});
+#else
 extern const struct REFLECT definition_int;
 extern const struct REFLECT definition_long;
 extern const struct REFLECT definition_short;
@@ -108,27 +216,45 @@ extern const struct REFLECT definition_char;
 extern const struct REFLECT definition_float;
 extern const struct REFLECT definition_double;
 extern const struct REFLECT definition_time_t;
+#endif
+
+/*Returns: The byte offset of member i of the type.*/
+static unsigned short reflect_offset(const struct REFLECT* header, unsigned int i) {
+	unsigned short bytesoff = 0;
+	unsigned int k;
+
+	if (header->hashed) return header->offsets[i];
+	for (k=0;k<i;k++) bytesoff += header->members[k]->bytessize;
+	return bytesoff;
+}
+
+/*Returns: The index of the member named member_name, or -1 if there is none.*/
+static int reflect_member_index(const struct REFLECT* header, const char member_name[]) {
+	unsigned int i, s;
+
+	if (header->hashed) {
+		for (s=reflect_hash(member_name);header->name_slots[s];s=(s+1)&(REFLECT_SLOTS-1)) {
+			i = header->name_slots[s] - 1;
+			if (!strcmp(header->member_names[i], member_name)) return (int)i;
+		}
+		return -1;
+	}
+	for (i=0;i<header->n_members;i++) {
+		if (!strcmp(header->member_names[i], member_name)) return (int)i;
+	}
+	return -1;
+}
 
 /*Purpose: Retrieves pointer to member by member name. The caller may optionally
 provide a typename, in which case the result is type checked against the typename.
 Returns: A pointer to member on success; NULL on failure.*/
 static void* member_by_name(REFLECTABLE p, const char member_name[], const char typenm[]/*optional*/) {
 	const struct REFLECT* header = reflect_header(p);
-	unsigned int i;
-	unsigned short bytesoff = 0;
-	char* p2 = p;
+	int i = reflect_member_index(header, member_name);
 
-	for (i=0;i<header->n_members;i++) {
-		if (!strcmp(header->member_names[i], member_name)) {
-			if(!typenm || !strcmp(header->members[i]->typenm, typenm)) {
-				return p2;
-			} else {
-				throw("Typemismatch");
-			}
-		}
-		p2 += header->members[i]->bytessize;
-	}
-	return NULL;
+	if (i < 0) return NULL;
+	if (typenm && strcmp(header->members[i]->typenm, typenm)) throw("Typemismatch");
+	return (char*)p + reflect_offset(header, (unsigned int)i);
 }
 
 /*Purpose: Retrieves pointer to member by typename.
@@ -137,13 +263,17 @@ Note: If there are multiple members with the same typename, the one with the sma
 is selected.*/
 static void* member_by_type(REFLECTABLE p, const char typenm[]) {
 	const struct REFLECT* header = reflect_header(p);
-	unsigned int i;
-	unsigned short bytesoff = 0;
-	char* p2 = (char*)p;
+	unsigned int i, s;
 
+	if (header->hashed) {
+		for (s=reflect_hash(typenm);header->type_slots[s];s=(s+1)&(REFLECT_SLOTS-1)) {
+			i = header->type_slots[s] - 1;
+			if (!strcmp(header->members[i]->typenm, typenm)) return (char*)p + header->offsets[i];
+		}
+		return NULL;
+	}
 	for (i=0;i<header->n_members;i++) {
-		if (!strcmp(header->members[i]->typenm, typenm)) return p2;
-		p2 += header->members[i]->bytessize;
+		if (!strcmp(header->members[i]->typenm, typenm)) return (char*)p + reflect_offset(header, i);
 	}
 	return NULL;
 }
@@ -151,4 +281,4 @@ static void* member_by_type(REFLECTABLE p, const char typenm[]) {
 /*Purpose: Prints the name and members of the structure definition to stdout.*/
 void reflect_print(const struct REFLECT* p);
 
-#endif
\ No newline at end of file
+#endif
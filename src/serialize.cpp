@@ -0,0 +1,218 @@
+#include <stdint.h>
+#include <string.h>
+#include "serialize.h"
+
+/* The layout of a message, in the byte order of the writer:
+	char magic[4]; //REFLECT_STREAM_MAGIC
+	uint16_t byte_order; //0x0102
+	uint16_t reserved;
+	uint32_t schema_size; //Bytes of schema, a multiple of 8
+	uint32_t reserved;
+	schema
+	uint64_t count;
+	payload //count * bytessize bytes
+The header, the schema and the count are all multiples of 8 bytes, so the payload starts on
+an 8-byte boundary of the message. A schema is
+	uint16_t bytessize, n_members, name_length; char name[name_length];
+followed, for each member, by
+	uint16_t name_length; char name[name_length]; the schema of the member's type
+and then zero padding.*/
+
+#define REFLECT_BYTE_ORDER 0x0102
+#define REFLECT_HEADER_SIZE 16
+
+struct _reflect_header {
+	char magic[4];
+	uint16_t byte_order;
+	uint16_t reserved;
+	uint32_t schema_size;
+	uint32_t reserved2;
+};
+
+//Writes (when out is not NULL) and measures a string with its length.
+static size_t _reflect_put_string(const char* s, char* out) {
+	uint16_t n = (uint16_t)strlen(s);
+
+	if (out) {
+		memcpy(out, &n, sizeof(n));
+		memcpy(out + sizeof(n), s, n);
+	}
+	return sizeof(n) + n;
+}
+
+//Writes (when out is not NULL) and measures the schema of type, without padding.
+static size_t _reflect_put_schema(const struct REFLECT* type, char* out) {
+	uint16_t fields[2] = {type->bytessize, type->n_members};
+	size_t size = sizeof(fields);
+	unsigned int i;
+
+	if (out) memcpy(out, fields, sizeof(fields));
+	size += _reflect_put_string(type->typenm, out ? out + size : NULL);
+	for (i=0;i<type->n_members;i++) {
+		size += _reflect_put_string(type->member_names[i], out ? out + size : NULL);
+		size += _reflect_put_schema(type->members[i], out ? out + size : NULL);
+	}
+	return size;
+}
+
+static inline size_t _reflect_schema_size(const struct REFLECT* type) {
+	return (_reflect_put_schema(type, NULL) + 7) & ~(size_t)7;
+}
+
+//Writes the header, schema and count of a message into out.
+static size_t _reflect_put_preamble(const struct REFLECT* type, size_t count, char* out) {
+	struct _reflect_header header;
+	size_t schema_size = _reflect_schema_size(type);
+	uint64_t count64 = count;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, REFLECT_STREAM_MAGIC, 4);
+	header.byte_order = REFLECT_BYTE_ORDER;
+	header.schema_size = (uint32_t)schema_size;
+	memcpy(out, &header, sizeof(header));
+	memset(out + REFLECT_HEADER_SIZE, 0, schema_size);
+	_reflect_put_schema(type, out + REFLECT_HEADER_SIZE);
+	memcpy(out + REFLECT_HEADER_SIZE + schema_size, &count64, sizeof(count64));
+	return REFLECT_HEADER_SIZE + schema_size + sizeof(count64);
+}
+
+size_t reflect_message_size(const struct REFLECT* type, size_t count) {
+	return REFLECT_HEADER_SIZE + _reflect_schema_size(type) + sizeof(uint64_t) + count * type->bytessize;
+}
+
+void reflect_serialize_n(const struct REFLECT* type, const void* data, size_t count, void* buf) {
+	size_t offset = _reflect_put_preamble(type, count, (char*)buf);
+
+	if (count) memcpy((char*)buf + offset, data, count * type->bytessize);
+}
+
+void reflect_write_n(FILE* f, const struct REFLECT* type, const void* data, size_t count) {
+	size_t size = REFLECT_HEADER_SIZE + _reflect_schema_size(type) + sizeof(uint64_t);
+	char* preamble = (char*)malloc(size);
+	bool ok;
+
+	if (!preamble) throw("Allocfailed");
+	_reflect_put_preamble(type, count, preamble);
+	ok = fwrite(preamble, 1, size, f) == size && (!count || fwrite(data, type->bytessize, count, f) == count);
+	free(preamble);
+	if (!ok) {
+		fputs("reflect_write: write failed.", stderr);
+		throw("Badstream");
+	}
+}
+
+void reflect_write(FILE* f, REFLECTABLE p) {
+	reflect_write_n(f, reflect_header(p), p, reflect_count(p));
+}
+
+//Reads a string with its length from the schema at *p_pos, and compares it to s.
+static bool _reflect_match_string(const char* schema, size_t size, size_t* p_pos, const char* s) {
+	uint16_t n;
+
+	if (*p_pos + sizeof(n) > size) return false;
+	memcpy(&n, schema + *p_pos, sizeof(n));
+	*p_pos += sizeof(n);
+	if (*p_pos + n > size) return false;
+	*p_pos += n;
+	return n == strlen(s) && !memcmp(schema + *p_pos - n, s, n);
+}
+
+//Compares the schema at *p_pos with type, member by member.
+static bool _reflect_match_schema(const char* schema, size_t size, size_t* p_pos, const struct REFLECT* type) {
+	uint16_t fields[2];
+	unsigned int i;
+
+	if (*p_pos + sizeof(fields) > size) return false;
+	memcpy(fields, schema + *p_pos, sizeof(fields));
+	*p_pos += sizeof(fields);
+	if (fields[0] != type->bytessize || fields[1] != type->n_members) return false;
+	if (!_reflect_match_string(schema, size, p_pos, type->typenm)) return false;
+	for (i=0;i<type->n_members;i++) {
+		if (!_reflect_match_string(schema, size, p_pos, type->member_names[i])) return false;
+		if (!_reflect_match_schema(schema, size, p_pos, type->members[i])) return false;
+	}
+	return true;
+}
+
+static void _reflect_check_header(const struct _reflect_header* header, const char* fn_name) {
+	if (memcmp(header->magic, REFLECT_STREAM_MAGIC, 4) || header->byte_order != REFLECT_BYTE_ORDER || header->schema_size % 8) {
+		fprintf(stderr, "%s: not a message, or written with another byte order.", fn_name);
+		throw("Badstream");
+	}
+}
+
+static void _reflect_check_schema(const char* schema, size_t size, const struct REFLECT* type, const char* fn_name) {
+	size_t pos = 0;
+
+	if (!_reflect_match_schema(schema, size, &pos, type)) {
+		fprintf(stderr, "%s: the message does not hold elements of type %s.", fn_name, type->typenm);
+		throw("Badschema");
+	}
+}
+
+REFLECTABLE reflect_read(FILE* f, const struct REFLECT* type) {
+	struct _reflect_header header;
+	uint64_t count;
+	char* schema;
+	REFLECTABLE p;
+
+	if (fread(&header, sizeof(header), 1, f) != 1) {
+		fputs("reflect_read: stream too short.", stderr);
+		throw("Badstream");
+	}
+	_reflect_check_header(&header, "reflect_read");
+	schema = (char*)malloc(header.schema_size ? header.schema_size : 1);
+	if (!schema) throw("Allocfailed");
+	if (fread(schema, 1, header.schema_size, f) != header.schema_size || fread(&count, sizeof(count), 1, f) != 1) {
+		free(schema);
+		fputs("reflect_read: stream too short.", stderr);
+		throw("Badstream");
+	}
+	try {
+		_reflect_check_schema(schema, header.schema_size, type, "reflect_read");
+	} catch (...) {
+		free(schema);
+		throw;
+	}
+	free(schema);
+	//_alloc adds its own header to count * bytessize; neither may overflow.
+	if (count > (SIZE_MAX - sizeof(size_t) - sizeof(const struct REFLECT*)) / (type->bytessize ? type->bytessize : 1)) {
+		fputs("reflect_read: element count too large.", stderr);
+		throw("Badstream");
+	}
+	p = _alloc(type, (size_t)count, type->bytessize);
+	if (count && fread(p, type->bytessize, (size_t)count, f) != count) {
+		reflect_free(p);
+		fputs("reflect_read: stream too short.", stderr);
+		throw("Badstream");
+	}
+	return p;
+}
+
+const void* reflect_map(const void* buf, size_t size, const struct REFLECT* type, size_t* p_count) {
+	const char* p = (const char*)buf;
+	struct _reflect_header header;
+	uint64_t count;
+	size_t offset;
+
+	if (size < REFLECT_HEADER_SIZE) {
+		fputs("reflect_map: message too short.", stderr);
+		throw("Badstream");
+	}
+	memcpy(&header, p, sizeof(header));
+	_reflect_check_header(&header, "reflect_map");
+	offset = REFLECT_HEADER_SIZE + header.schema_size;
+	if (size < offset + sizeof(count)) {
+		fputs("reflect_map: message too short.", stderr);
+		throw("Badstream");
+	}
+	_reflect_check_schema(p + REFLECT_HEADER_SIZE, header.schema_size, type, "reflect_map");
+	memcpy(&count, p + offset, sizeof(count));
+	offset += sizeof(count);
+	if (type->bytessize && count > (size - offset) / type->bytessize) {
+		fputs("reflect_map: message too short.", stderr);
+		throw("Badstream");
+	}
+	*p_count = (size_t)count;
+	return p + offset;
+}
@@ -0,0 +1,63 @@
+#ifndef _JC_SERIALIZE
+#define _JC_SERIALIZE
+
+#include "reflectable.h"
+
+/*Binary serialization of REFLECTABLE data, driven by its REFLECT structure.
+
+A stream holds one message: a fixed header, a schema block describing the element type
+(its name and size, and the name and schema of each member, recursively), the number of
+elements, and then the elements themselves exactly as they lie in memory. Since
+REFLECTABLE structures are packed, the payload is written with a single fwrite and read
+back with a single fread, or used in place where the message already is in memory (a
+shared mapping, a received buffer): reflect_map checks the schema and returns a pointer
+into the message. A message is only read on a machine of the same byte order.
+
+The schema is checked once per message against the type the reader expects: type and
+member names, sizes and member counts must all agree, at every level. A mismatch throws
+"Badschema"; a short or damaged stream throws "Badstream".*/
+
+#define REFLECT_STREAM_MAGIC "RFL1"
+
+/* Accepts:
+  * f - The stream to write to.
+  * p - Data from alloc or alloc_array.
+Purpose: Writes all the elements of p, with their schema, as one message.*/
+void reflect_write(FILE* f, REFLECTABLE p);
+
+/* Accepts:
+  * f - The stream to write to.
+  * type - The type of the elements.
+  * data - count packed elements of type; they need not come from alloc_array.
+  * count - The number of elements.
+Purpose: The same as reflect_write, for elements held anywhere in memory.*/
+void reflect_write_n(FILE* f, const struct REFLECT* type, const void* data, size_t count);
+
+/* Accepts:
+  * type - The type of the elements.
+  * count - The number of elements.
+Returns: The size in bytes of the message that reflect_serialize_n writes.*/
+size_t reflect_message_size(const struct REFLECT* type, size_t count);
+
+/* Accepts:
+  * type, data, count - As for reflect_write_n.
+  * buf - Room for reflect_message_size(type, count) bytes.
+Purpose: Writes the message into memory rather than to a stream.*/
+void reflect_serialize_n(const struct REFLECT* type, const void* data, size_t count, void* buf);
+
+/* Accepts:
+  * f - The stream to read from.
+  * type - The type the elements are expected to have.
+Returns: The elements of the next message of f, in a new allocation as from alloc_array;
+reflect_count gives their number. Free it with reflect_free.*/
+REFLECTABLE reflect_read(FILE* f, const struct REFLECT* type);
+
+/* Accepts:
+  * buf - A message, as written by reflect_write or reflect_serialize_n.
+  * size - The number of bytes available at buf.
+  * type - The type the elements are expected to have.
+  * p_count - Receives the number of elements.
+Returns: A pointer to the first element, inside buf; nothing is copied.*/
+const void* reflect_map(const void* buf, size_t size, const struct REFLECT* type, size_t* p_count);
+
+#endif
@@ -0,0 +1,535 @@
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "md_sparse.h"
+#include "md_iter.h"
+
+/* Sparse arrays. The three formats share one header; CSR is the hub of the conversions, so
+that each format only needs to be turned into and out of CSR. */
+
+static __thread struct MD_SPARSE_SLICE temporary_sparse_slice;
+
+static struct MD_SPARSE* _md_sparse_check(ARRAYLIKE ar, const char* fn_name) {
+	if (ar->struct_identifier == 0xAAAAD) return (struct MD_SPARSE*)ar;
+	fprintf(stderr, "%s: not a sparse array.", fn_name);
+	throw MULTIARRAY_EX();
+}
+
+//The sparse array behind ar, with the indices ar has taken (as MD_SPARSE_SLICE::offset) and
+//the number of dimensions left to index.
+static struct MD_SPARSE* _md_sparse_resolve(ARRAYLIKE ar, size_t* p_offset, unsigned int* p_n_dims, const char* fn_name) {
+	struct MD_SPARSE_SLICE* p_slice;
+
+	switch (ar->struct_identifier) {
+	case 0xAAAAD:
+		*p_offset = 0;
+		*p_n_dims = ((struct MD_SPARSE*)ar)->n_dims;
+		return (struct MD_SPARSE*)ar;
+	case 0xAAAAE:
+		p_slice = (struct MD_SPARSE_SLICE*)ar;
+		*p_offset = p_slice->offset;
+		*p_n_dims = p_slice->n_dims;
+		return p_slice->p_base;
+	case 0xFEEED:
+		fprintf(stderr, "%s: already freed.", fn_name);
+		throw MULTIARRAY_EX();
+	default:
+		fprintf(stderr, "%s: not a sparse array or sparse array slice.", fn_name);
+		throw MULTIARRAY_EX();
+	}
+}
+
+//Rows are the leading dimensions flattened; columns are the last dimension.
+static inline void _md_sparse_rows(const struct MD_SPARSE* sp, size_t* p_rows, size_t* p_cols) {
+	unsigned int k;
+
+	*p_rows = 1;
+	*p_cols = sp->n_dims ? sp->dims[sp->n_dims-1] : 1;
+	for (k=0;k+1<sp->n_dims;k++) *p_rows *= sp->dims[k];
+}
+
+static inline size_t _md_sparse_entry_size(const struct MD_SPARSE* sp) {
+	return sp->type_size * sp->block[0] * sp->block[1];
+}
+
+static inline bool _md_is_zero(const char* p, size_t size) {
+	size_t k;
+
+	for (k=0;k<size;k++) if (p[k]) return false;
+	return true;
+}
+
+#ifdef MD_INDEX_CHECKS
+//Throws if the zeros that stand for unstored elements have been written through md_getptr.
+static void _md_sparse_check_zero(const struct MD_SPARSE* sp, const char* fn_name) {
+	if (!_md_is_zero(sp->zero, sp->type_size)) {
+		fprintf(stderr, "%s: an element that is not stored was written through md_getptr; use md_sparse_insert", fn_name);
+		throw MULTIARRAY_EX();
+	}
+}
+#endif
+
+//Writes the indices of row r into idx[0..n_dims-2].
+static inline void _md_sparse_unravel(const struct MD_SPARSE* sp, size_t r, size_t idx[]) {
+	unsigned int k;
+
+	for (k=sp->n_dims-1;k>0;k--) {
+		idx[k-1] = r % sp->dims[k-1];
+		r /= sp->dims[k-1];
+	}
+}
+
+static void _md_sparse_reserve(struct MD_SPARSE* sp, size_t cap) {
+	size_t* p_index;
+	char* p_values;
+
+	if (cap <= sp->cap) return;
+	p_index = (size_t*)realloc(sp->p_index, cap * sizeof(size_t));
+	if (p_index) sp->p_index = p_index;
+	p_values = (char*)realloc(sp->p_values, cap * _md_sparse_entry_size(sp));
+	if (p_values) sp->p_values = p_values;
+	if (!p_index || !p_values) {
+		fputs("md_sparse: allocation failed", stderr);
+		throw MULTIARRAY_EX();
+	}
+	sp->cap = cap;
+}
+
+//Grows the entries geometrically, so that appending one at a time is cheap.
+static inline void _md_sparse_grow(struct MD_SPARSE* sp) {
+	if (sp->nnz == sp->cap) _md_sparse_reserve(sp, sp->cap < 8 ? 16 : sp->cap * 2);
+}
+
+//An empty array in the given format, with room for the row offsets of CSR and BSR.
+static struct MD_SPARSE* _md_sparse_new(const size_t _md_dims[], unsigned int n_dims, size_t size, unsigned int format, size_t block_rows, size_t block_cols) {
+	struct MD_SPARSE* sp;
+	size_t rows, cols;
+
+	if (n_dims > MAX_DIMENSIONS) {
+		fputs("md_sparse_alloc: n_dims should not exceed MAX_DIMENSIONS", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (format > MD_SPARSE_BSR) {
+		fprintf(stderr, "md_sparse: unknown format %u\n", format);
+		throw MULTIARRAY_EX();
+	}
+	if (format != MD_SPARSE_BSR) block_rows = block_cols = 1;
+	if (block_rows == 0 || block_cols == 0) {
+		fputs("md_sparse: block dimensions must not be zero", stderr);
+		throw MULTIARRAY_EX();
+	}
+	sp = (struct MD_SPARSE*)calloc(sizeof(struct MD_SPARSE) + size, 1);
+	if (!sp) {
+		fputs("md_sparse_alloc: allocation failed", stderr);
+		throw MULTIARRAY_EX();
+	}
+	sp->struct_identifier = 0xAAAAD;
+	sp->n_dims = n_dims;
+	sp->type_size = size;
+	memcpy(sp->dims, _md_dims, sizeof(size_t) * n_dims);
+	sp->format = format;
+	sp->block[0] = block_rows;
+	sp->block[1] = block_cols;
+	if (format != MD_SPARSE_COO) {
+		_md_sparse_rows(sp, &rows, &cols);
+		rows = (rows + block_rows - 1) / block_rows;
+		sp->p_rows = (size_t*)calloc(rows + 1, sizeof(size_t));
+		if (!sp->p_rows) {
+			free(sp);
+			fputs("md_sparse_alloc: allocation failed", stderr);
+			throw MULTIARRAY_EX();
+		}
+	}
+	return(sp);
+}
+
+struct MD_SPARSE* _md_sparse_alloc(const size_t _md_dims[], unsigned int n_dims, size_t size) {
+	return(_md_sparse_new(_md_dims, n_dims, size, MD_SPARSE_COO, 1, 1));
+}
+
+void* md_sparse_insert(struct MD_SPARSE* sp, const size_t idx[]) {
+	size_t linear = 0;
+	unsigned int k;
+	char* p_value;
+
+	if (sp->format != MD_SPARSE_COO) {
+		fputs("md_sparse_insert: elements may only be inserted into COO arrays", stderr);
+		throw MULTIARRAY_EX();
+	}
+	for (k=0;k<sp->n_dims;k++) {
+#ifdef MD_INDEX_CHECKS
+		if (idx[k] >= sp->dims[k]) {
+			fprintf(stderr, "md_sparse_insert: %zu out of range %zu in dimension %u\n", idx[k], sp->dims[k], k);
+			throw MULTIARRAY_EX();
+		}
+#endif
+		linear = linear * sp->dims[k] + idx[k];
+	}
+	_md_sparse_grow(sp);
+	sp->p_index[sp->nnz] = linear;
+	p_value = sp->p_values + sp->nnz * sp->type_size;
+	memset(p_value, 0, sp->type_size);
+	sp->nnz++;
+	return(p_value);
+}
+
+//The stored element at a linear index, or NULL.
+static char* _md_sparse_find(const struct MD_SPARSE* sp, size_t linear) {
+	size_t rows, cols, r, c, k;
+	const size_t *p_first, *p_last, *p_found;
+
+	if (sp->format == MD_SPARSE_COO) {
+		//The last insertion wins.
+		for (k=sp->nnz;k>0;k--) {
+			if (sp->p_index[k-1] == linear) return sp->p_values + (k-1) * sp->type_size;
+		}
+		return NULL;
+	}
+	_md_sparse_rows(sp, &rows, &cols);
+	r = cols ? linear / cols : 0;
+	c = cols ? linear % cols : 0;
+	p_first = sp->p_index + sp->p_rows[r / sp->block[0]];
+	p_last = sp->p_index + sp->p_rows[r / sp->block[0] + 1];
+	p_found = std::lower_bound(p_first, p_last, c / sp->block[1]);
+	if (p_found == p_last || *p_found != c / sp->block[1]) return NULL;
+	k = p_found - sp->p_index;
+	return sp->p_values + ((k * sp->block[0] + r % sp->block[0]) * sp->block[1] + c % sp->block[1]) * sp->type_size;
+}
+
+void* md_sparse_at(ARRAYLIKE ar, const size_t idx[]) {
+	struct MD_SPARSE* sp;
+	size_t linear;
+	unsigned int n_dims, k;
+
+	sp = _md_sparse_resolve(ar, &linear, &n_dims, "md_sparse_at");
+#ifdef MD_INDEX_CHECKS
+	_md_sparse_check_zero(sp, "md_sparse_at");
+#endif
+	for (k=sp->n_dims-n_dims;k<sp->n_dims;k++) {
+#ifdef MD_INDEX_CHECKS
+		if (idx[k-(sp->n_dims-n_dims)] >= sp->dims[k]) {
+			fprintf(stderr, "md_sparse_at: %zu out of range %zu in dimension %u\n", idx[k-(sp->n_dims-n_dims)], sp->dims[k], k);
+			throw MULTIARRAY_EX();
+		}
+#endif
+		linear = linear * sp->dims[k] + idx[k-(sp->n_dims-n_dims)];
+	}
+	return(_md_sparse_find(sp, linear));
+}
+
+/* Accepts:
+  * ar - A sparse array or sparse array slice.
+Returns: The first element of ar, as md_getptr does: the stored element, or a block of zeros
+shared by the whole array when it is not stored. The zeros must not be written to (see
+md_sparse.h).*/
+static char* _md_sparse_getptr(ARRAYLIKE ar) {
+	struct MD_SPARSE* sp;
+	size_t linear;
+	unsigned int n_dims, k;
+	char* p_value;
+
+	sp = _md_sparse_resolve(ar, &linear, &n_dims, "md_getptr");
+#ifdef MD_INDEX_CHECKS
+	_md_sparse_check_zero(sp, "md_getptr");
+#endif
+	for (k=sp->n_dims-n_dims;k<sp->n_dims;k++) linear *= sp->dims[k];
+	p_value = _md_sparse_find(sp, linear);
+	return p_value ? p_value : sp->zero;
+}
+
+static unsigned int _md_sparse_shape(ARRAYLIKE ar, size_t dims[]) {
+	struct MD_SPARSE* sp;
+	size_t offset;
+	unsigned int n_dims;
+
+	sp = _md_sparse_resolve(ar, &offset, &n_dims, "md_shape");
+	memcpy(dims, sp->dims + (sp->n_dims - n_dims), sizeof(size_t) * n_dims);
+	return(n_dims);
+}
+
+static ARRAYLIKE _md_sparse_index(ARRAYLIKE ar, size_t i) {
+	struct MD_SPARSE_SLICE slice;
+	unsigned int level;
+
+	slice.struct_identifier = 0xAAAAE;
+	slice.p_base = _md_sparse_resolve(ar, &slice.offset, &slice.n_dims, "md_index");
+	MD_STAT(_md_tls_stats.index_calls++);
+	level = slice.p_base->n_dims - slice.n_dims;
+#ifdef MD_INDEX_CHECKS
+	if (slice.n_dims == 0) {
+		fputs("md_index: indexed more times than there are dimensions", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (i >= slice.p_base->dims[level]) {
+		fprintf(stderr, "md_index: %zu out of range %zu in dimension %u\n", i, slice.p_base->dims[level], level);
+		throw MULTIARRAY_EX();
+	}
+#endif
+	slice.offset = slice.offset * slice.p_base->dims[level] + i;
+	slice.n_dims--;
+	temporary_sparse_slice = slice;
+	return &temporary_sparse_slice;
+}
+
+static void _md_sparse_free(ARRAYLIKE ar) {
+	struct MD_SPARSE* sp;
+
+	if (ar->struct_identifier == 0xAAAAE) {
+		ar->struct_identifier = 0xFEEED;
+		ar = ((struct MD_SPARSE_SLICE*)ar)->p_base;
+	}
+	sp = _md_sparse_check(ar, "md_free");
+	free(sp->p_index);
+	free(sp->p_rows);
+	free(sp->p_values);
+	sp->struct_identifier = 0xFEEED;
+	free(sp);
+}
+
+static const struct MD_KIND sparse_kind = {_md_sparse_free, _md_sparse_getptr, _md_sparse_shape, _md_sparse_index,
+	"md_base: a sparse array has no dense base; see md_sparse_to_dense."};
+static int sparse_registered = _md_register_kind(0xAAAAD, &sparse_kind) + _md_register_kind(0xAAAAE, &sparse_kind);
+
+//COO to CSR: a stable sort by linear index (skipped when the entries are already in
+//order), then one pass that keeps the last of each run of equal indices.
+static struct MD_SPARSE* _md_coo_to_csr(const struct MD_SPARSE* sp) {
+	struct MD_SPARSE* out = _md_sparse_new(sp->dims, sp->n_dims, sp->type_size, MD_SPARSE_CSR, 1, 1);
+	std::vector<size_t> order(sp->nnz);
+	size_t rows, cols, k, j, linear, r;
+	bool sorted = true;
+
+	for (k=0;k<sp->nnz;k++) {
+		order[k] = k;
+		if (k && sp->p_index[k] < sp->p_index[k-1]) sorted = false;
+	}
+	if (!sorted) {
+		std::stable_sort(order.begin(), order.end(), [sp](size_t a, size_t b) { return sp->p_index[a] < sp->p_index[b]; });
+	}
+	_md_sparse_rows(sp, &rows, &cols);
+	_md_sparse_reserve(out, sp->nnz);
+	for (k=0;k<sp->nnz;k=j) {
+		linear = sp->p_index[order[k]];
+		for (j=k+1;j<sp->nnz&&sp->p_index[order[j]]==linear;j++);
+		r = linear / cols;
+		out->p_rows[r+1]++;
+		out->p_index[out->nnz] = linear % cols;
+		memcpy(out->p_values + out->nnz * sp->type_size, sp->p_values + order[j-1] * sp->type_size, sp->type_size);
+		out->nnz++;
+	}
+	for (r=0;r<rows;r++) out->p_rows[r+1] += out->p_rows[r];
+	return(out);
+}
+
+static struct MD_SPARSE* _md_csr_to_coo(const struct MD_SPARSE* sp) {
+	struct MD_SPARSE* out = _md_sparse_new(sp->dims, sp->n_dims, sp->type_size, MD_SPARSE_COO, 1, 1);
+	size_t rows, cols, r, k;
+
+	_md_sparse_rows(sp, &rows, &cols);
+	_md_sparse_reserve(out, sp->nnz);
+	for (r=0;r<rows;r++) {
+		for (k=sp->p_rows[r];k<sp->p_rows[r+1];k++) out->p_index[k] = r * cols + sp->p_index[k];
+	}
+	if (sp->nnz) memcpy(out->p_values, sp->p_values, sp->nnz * sp->type_size);
+	out->nnz = sp->nnz;
+	return(out);
+}
+
+//CSR to BSR, one block row at a time: the block columns the rows touch are collected and
+//sorted, and each element is copied into its zero-initialized block.
+static struct MD_SPARSE* _md_csr_to_bsr(const struct MD_SPARSE* sp, size_t block_rows, size_t block_cols) {
+	struct MD_SPARSE* out = _md_sparse_new(sp->dims, sp->n_dims, sp->type_size, MD_SPARSE_BSR, block_rows, block_cols);
+	size_t rows, cols, brows, bcols, br, r, r_end, k, c, first, entry_size = _md_sparse_entry_size(out);
+	std::vector<size_t> slot, touched;
+
+	_md_sparse_rows(sp, &rows, &cols);
+	brows = (rows + block_rows - 1) / block_rows;
+	bcols = (cols + block_cols - 1) / block_cols;
+	slot.assign(bcols, (size_t)-1);
+	for (br=0;br<brows;br++) {
+		r_end = std::min(rows, (br + 1) * block_rows);
+		touched.clear();
+		for (r=br*block_rows;r<r_end;r++) {
+			for (k=sp->p_rows[r];k<sp->p_rows[r+1];k++) {
+				c = sp->p_index[k] / block_cols;
+				if (slot[c] == (size_t)-1) {
+					slot[c] = 0;
+					touched.push_back(c);
+				}
+			}
+		}
+		std::sort(touched.begin(), touched.end());
+		first = out->nnz;
+		if (first + touched.size() > out->cap) _md_sparse_reserve(out, std::max(first + touched.size(), out->cap * 2));
+		for (k=0;k<touched.size();k++) {
+			slot[touched[k]] = first + k;
+			out->p_index[first+k] = touched[k];
+		}
+		if (touched.size()) memset(out->p_values + first * entry_size, 0, touched.size() * entry_size);
+		out->nnz += touched.size();
+		for (r=br*block_rows;r<r_end;r++) {
+			for (k=sp->p_rows[r];k<sp->p_rows[r+1];k++) {
+				c = sp->p_index[k];
+				memcpy(out->p_values + ((slot[c / block_cols] * block_rows + r % block_rows) * block_cols + c % block_cols) * sp->type_size,
+					sp->p_values + k * sp->type_size, sp->type_size);
+			}
+		}
+		for (k=0;k<touched.size();k++) slot[touched[k]] = (size_t)-1;
+		out->p_rows[br+1] = out->nnz;
+	}
+	return(out);
+}
+
+//BSR to CSR, dropping the zeros the blocks were padded with.
+static struct MD_SPARSE* _md_bsr_to_csr(const struct MD_SPARSE* sp) {
+	struct MD_SPARSE* out = _md_sparse_new(sp->dims, sp->n_dims, sp->type_size, MD_SPARSE_CSR, 1, 1);
+	size_t rows, cols, r, k, j, c, b0 = sp->block[0], b1 = sp->block[1];
+	const char* p_value;
+
+	_md_sparse_rows(sp, &rows, &cols);
+	for (r=0;r<rows;r++) {
+		for (k=sp->p_rows[r/b0];k<sp->p_rows[r/b0+1];k++) {
+			for (j=0;j<b1;j++) {
+				c = sp->p_index[k] * b1 + j;
+				if (c >= cols) break;
+				p_value = sp->p_values + ((k * b0 + r % b0) * b1 + j) * sp->type_size;
+				if (_md_is_zero(p_value, sp->type_size)) continue;
+				_md_sparse_grow(out);
+				out->p_index[out->nnz] = c;
+				memcpy(out->p_values + out->nnz * sp->type_size, p_value, sp->type_size);
+				out->nnz++;
+			}
+		}
+		out->p_rows[r+1] = out->nnz;
+	}
+	return(out);
+}
+
+static struct MD_SPARSE* _md_sparse_copy(const struct MD_SPARSE* sp) {
+	struct MD_SPARSE* out = _md_sparse_new(sp->dims, sp->n_dims, sp->type_size, sp->format, sp->block[0], sp->block[1]);
+	size_t rows, cols;
+
+	_md_sparse_reserve(out, sp->nnz);
+	if (sp->nnz) {
+		memcpy(out->p_index, sp->p_index, sp->nnz * sizeof(size_t));
+		memcpy(out->p_values, sp->p_values, sp->nnz * _md_sparse_entry_size(sp));
+	}
+	out->nnz = sp->nnz;
+	if (sp->p_rows) {
+		_md_sparse_rows(sp, &rows, &cols);
+		memcpy(out->p_rows, sp->p_rows, ((rows + sp->block[0] - 1) / sp->block[0] + 1) * sizeof(size_t));
+	}
+	return(out);
+}
+
+struct MD_SPARSE* md_sparse_convert(const struct MD_SPARSE* sp, unsigned int format, size_t block_rows, size_t block_cols) {
+	struct MD_SPARSE *csr, *out;
+
+	_md_sparse_check((ARRAYLIKE)sp, "md_sparse_convert");
+	if (format > MD_SPARSE_BSR) {
+		fprintf(stderr, "md_sparse_convert: unknown format %u\n", format);
+		throw MULTIARRAY_EX();
+	}
+	if (format == MD_SPARSE_CSR && sp->format == MD_SPARSE_CSR) return(_md_sparse_copy(sp));
+	if (format == MD_SPARSE_BSR && sp->format == MD_SPARSE_BSR && sp->block[0] == block_rows && sp->block[1] == block_cols) return(_md_sparse_copy(sp));
+	if (sp->format == MD_SPARSE_COO) csr = _md_coo_to_csr(sp);
+	else if (sp->format == MD_SPARSE_BSR) csr = _md_bsr_to_csr(sp);
+	else csr = (struct MD_SPARSE*)sp;
+
+	switch (format) {
+	case MD_SPARSE_COO:
+		out = _md_csr_to_coo(csr);
+		break;
+	case MD_SPARSE_BSR:
+		out = _md_csr_to_bsr(csr, block_rows, block_cols);
+		break;
+	default:
+		return(csr);
+	}
+	if (csr != sp) md_free(csr);
+	return(out);
+}
+
+struct MD_SPARSE* md_sparse_from_dense(ARRAYLIKE ar, unsigned int format, size_t block_rows, size_t block_cols) {
+	size_t dims[MAX_DIMENSIONS];
+	unsigned int order[MAX_DIMENSIONS];
+	unsigned int n_dims, k;
+	size_t size = md_type_size(md_base(ar)), linear = 0, count, j;
+	struct MD_SPARSE *coo, *out;
+	struct MD_ITER it;
+	ptrdiff_t step;
+	char* p;
+
+	n_dims = md_shape(ar, dims);
+	for (k=0;k<n_dims;k++) order[k] = k;
+	coo = _md_sparse_new(dims, n_dims, size, MD_SPARSE_COO, 1, 1);
+	//In row-major order the n-th element visited has linear index n, and the COO comes
+	//out sorted, so converting it needs no sort.
+	md_iter_init(&it, ar, order);
+	step = md_iter_step(&it);
+	while ((p = md_iter_next_run(&it, &count))) {
+		for (j=0;j<count;j++,p+=step,linear++) {
+			if (_md_is_zero(p, size)) continue;
+			_md_sparse_grow(coo);
+			coo->p_index[coo->nnz] = linear;
+			memcpy(coo->p_values + coo->nnz * size, p, size);
+			coo->nnz++;
+		}
+	}
+	if (format == MD_SPARSE_COO) return(coo);
+	out = md_sparse_convert(coo, format, block_rows, block_cols);
+	md_free(coo);
+	return(out);
+}
+
+void md_sparse_for_each(const struct MD_SPARSE* sp, MD_SPARSE_VISITOR f, void* ctx) {
+	size_t idx[MAX_DIMENSIONS];
+	size_t rows, cols, r, k, j, c, linear, b0 = sp->block[0], b1 = sp->block[1];
+	unsigned int n = sp->n_dims, d;
+
+	_md_sparse_check((ARRAYLIKE)sp, "md_sparse_for_each");
+	_md_sparse_rows(sp, &rows, &cols);
+	if (sp->format == MD_SPARSE_COO) {
+		for (k=0;k<sp->nnz;k++) {
+			linear = sp->p_index[k];
+			for (d=n;d>0;d--) {
+				idx[d-1] = linear % sp->dims[d-1];
+				linear /= sp->dims[d-1];
+			}
+			f(idx, sp->p_values + k * sp->type_size, ctx);
+		}
+		return;
+	}
+	for (r=0;r<rows;r++) {
+		if (sp->p_rows[r/b0] == sp->p_rows[r/b0+1]) {
+			r = (r / b0 + 1) * b0 - 1;
+			continue;
+		}
+		if (n) _md_sparse_unravel(sp, r, idx);
+		for (k=sp->p_rows[r/b0];k<sp->p_rows[r/b0+1];k++) {
+			for (j=0;j<b1;j++) {
+				c = sp->p_index[k] * b1 + j;
+				if (c >= cols) break;
+				if (n) idx[n-1] = c;
+				f(idx, sp->p_values + ((k * b0 + r % b0) * b1 + j) * sp->type_size, ctx);
+			}
+		}
+	}
+}
+
+struct MD_ARRAY* md_sparse_to_dense(const struct MD_SPARSE* sp) {
+	struct MD_ARRAY* ar;
+
+	_md_sparse_check((ARRAYLIKE)sp, "md_sparse_to_dense");
+#ifdef MD_INDEX_CHECKS
+	_md_sparse_check_zero(sp, "md_sparse_to_dense");
+#endif
+	ar = _md_alloc(sp->dims, sp->n_dims, sp->type_size);
+	md_sparse_for_each(sp, [ar](const size_t idx[], void* value) {
+		char* p = ar->data;
+		unsigned int k;
+
+		for (k=0;k<ar->n_dims;k++) p += idx[k] * ar->strides[k];
+		memcpy(p, value, ar->type_size);
+	});
+	return(ar);
+}
@@ -0,0 +1,93 @@
+#include <string.h>
+#include <chrono>
+#include "multiarray.h"
+
+/* The counters behind md_stats.h. These functions are always built, so that the library
+links whether or not its users compile with -DMD_STATS; only the calls to them are
+switched off. */
+
+thread_local struct MD_COUNTERS _md_tls_stats;
+
+static MD_EVENT_HOOK event_hook = NULL;
+static void* event_ctx = NULL;
+
+//The resize in progress on this thread.
+static thread_local std::chrono::steady_clock::time_point resize_start;
+static thread_local size_t resize_moved;
+
+static inline unsigned int _md_bucket(unsigned long long value) {
+	unsigned int k = 0;
+
+	while (value > 1 && k < MD_STATS_BUCKETS - 1) {
+		value >>= 1;
+		k++;
+	}
+	return k;
+}
+
+void md_stats_snapshot(struct MD_COUNTERS* stats) {
+	*stats = _md_tls_stats;
+}
+
+void md_stats_reset() {
+	memset(&_md_tls_stats, 0, sizeof(_md_tls_stats));
+}
+
+void md_set_event_hook(MD_EVENT_HOOK hook, void* ctx) {
+	event_hook = hook;
+	event_ctx = ctx;
+}
+
+static void _md_fire(unsigned int kind, const struct MD_ARRAY* ar, size_t bytes) {
+	struct MD_EVENT event;
+
+	memset(&event, 0, sizeof(event));
+	event.kind = kind;
+	event.ar = ar;
+	event.bytes = bytes;
+	event_hook(&event, event_ctx);
+}
+
+void _md_stats_alloc(const struct MD_ARRAY* ar) {
+	_md_tls_stats.alloc_calls++;
+	_md_tls_stats.alloc_bytes += ar->block_size;
+	_md_tls_stats.alloc_size_hist[_md_bucket(ar->block_size)]++;
+	if (event_hook) _md_fire(MD_EVENT_ALLOC, ar, ar->block_size);
+}
+
+void _md_stats_free(const struct MD_ARRAY* ar) {
+	_md_tls_stats.free_calls++;
+	_md_tls_stats.free_bytes += ar->block_size;
+	if (event_hook) _md_fire(MD_EVENT_FREE, ar, ar->block_size);
+}
+
+void _md_stats_resize_begin() {
+	resize_moved = 0;
+	resize_start = std::chrono::steady_clock::now();
+}
+
+//Counts bytes copied to a new block by the resize in progress.
+void _md_stats_moved(size_t bytes) {
+	resize_moved += bytes;
+	_md_tls_stats.resize_moves++;
+}
+
+void _md_stats_resize_end(const struct MD_ARRAY* ar, unsigned int dim_i, size_t old_size, size_t new_size) {
+	struct MD_EVENT event;
+	unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - resize_start).count();
+
+	_md_tls_stats.resize_calls++;
+	_md_tls_stats.resize_bytes_moved += resize_moved;
+	_md_tls_stats.resize_ns += ns;
+	_md_tls_stats.resize_ns_hist[_md_bucket(ns)]++;
+	if (event_hook) {
+		event.kind = MD_EVENT_RESIZE;
+		event.ar = ar;
+		event.bytes = resize_moved;
+		event.dim_i = dim_i;
+		event.old_size = old_size;
+		event.new_size = new_size;
+		event.ns = ns;
+		event_hook(&event, event_ctx);
+	}
+}
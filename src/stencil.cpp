@@ -0,0 +1,426 @@
+#include <string.h>
+#include <vector>
+#include "md_stencil.h"
+#include "md_parallel.h"
+
+#if defined(__AVX__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+/* Arrays of fewer than 3 dimensions are handled as 3-dimensional ones with leading
+dimensions of size 1, and kernels likewise with leading extents of 1. A tile is loaded into
+a buffer laid out row-major, with the halo around it, and the steps of a temporal block
+ping-pong between two such buffers; every buffer coordinate stands for the same element of
+the array in both. Each step leaves a smaller region of the buffer valid, until only the
+tile itself is left to be written out. */
+
+#define MD_STENCIL_ZERO PTRDIFF_MIN //table entry of an index that reads as 0
+
+//The shape of the tiles, by the rank of the arrays.
+static const size_t _md_stencil_tile[3][3] = {{1, 1, 8192}, {1, 64, 256}, {16, 16, 64}};
+
+/* The row kernels. Each one sets dst[x], for x in [0, n), to the sum over the taps t of
+w[t] * src[offs[t] + x]. The generic version relies on the compiler to keep acc in vector
+registers. */
+template <typename T>
+static inline void _md_stencil_tail(T* dst, const T* src, const ptrdiff_t offs[], const T w[], size_t n_taps, size_t n) {
+	T sum;
+	size_t x, t;
+
+	for (x=0;x<n;x++) {
+		sum = 0;
+		for (t=0;t<n_taps;t++) sum += w[t] * src[offs[t] + x];
+		dst[x] = sum;
+	}
+}
+
+template <typename T> struct _md_stencil_kernel {
+	static inline void run(T* dst, const T* src, const ptrdiff_t offs[], const T w[], size_t n_taps, size_t n) {
+		T acc[8];
+		const T* p;
+		size_t x, t;
+		int j;
+
+		for (x=0;x+8<=n;x+=8) {
+			for (j=0;j<8;j++) acc[j] = 0;
+			for (t=0;t<n_taps;t++) {
+				p = src + offs[t] + x;
+				for (j=0;j<8;j++) acc[j] += w[t] * p[j];
+			}
+			for (j=0;j<8;j++) dst[x+j] = acc[j];
+		}
+		_md_stencil_tail(dst + x, src + x, offs, w, n_taps, n - x);
+	}
+};
+
+#if defined(__AVX__) && defined(__FMA__)
+template <> struct _md_stencil_kernel<float> {
+	static inline void run(float* dst, const float* src, const ptrdiff_t offs[], const float w[], size_t n_taps, size_t n) {
+		__m256 acc0, acc1, wt;
+		const float* p;
+		size_t x, t;
+
+		for (x=0;x+16<=n;x+=16) {
+			acc0 = acc1 = _mm256_setzero_ps();
+			for (t=0;t<n_taps;t++) {
+				p = src + offs[t] + x;
+				wt = _mm256_set1_ps(w[t]);
+				acc0 = _mm256_fmadd_ps(wt, _mm256_loadu_ps(p), acc0);
+				acc1 = _mm256_fmadd_ps(wt, _mm256_loadu_ps(p + 8), acc1);
+			}
+			_mm256_storeu_ps(dst + x, acc0);
+			_mm256_storeu_ps(dst + x + 8, acc1);
+		}
+		_md_stencil_tail(dst + x, src + x, offs, w, n_taps, n - x);
+	}
+};
+
+template <> struct _md_stencil_kernel<double> {
+	static inline void run(double* dst, const double* src, const ptrdiff_t offs[], const double w[], size_t n_taps, size_t n) {
+		__m256d acc0, acc1, wt;
+		const double* p;
+		size_t x, t;
+
+		for (x=0;x+8<=n;x+=8) {
+			acc0 = acc1 = _mm256_setzero_pd();
+			for (t=0;t<n_taps;t++) {
+				p = src + offs[t] + x;
+				wt = _mm256_set1_pd(w[t]);
+				acc0 = _mm256_fmadd_pd(wt, _mm256_loadu_pd(p), acc0);
+				acc1 = _mm256_fmadd_pd(wt, _mm256_loadu_pd(p + 4), acc1);
+			}
+			_mm256_storeu_pd(dst + x, acc0);
+			_mm256_storeu_pd(dst + x + 4, acc1);
+		}
+		_md_stencil_tail(dst + x, src + x, offs, w, n_taps, n - x);
+	}
+};
+#endif
+
+//Maps index p of a dimension of size n to the index it reads, or -1 when it reads as 0.
+static ptrdiff_t _md_boundary_index(ptrdiff_t p, ptrdiff_t n, unsigned int boundary) {
+	if (p >= 0 && p < n) return(p);
+	switch (boundary) {
+	case MD_BOUNDARY_CLAMP:
+		return(p < 0 ? 0 : n - 1);
+	case MD_BOUNDARY_WRAP:
+		p %= n;
+		return(p < 0 ? p + n : p);
+	case MD_BOUNDARY_REFLECT:
+		p %= 2 * n;
+		if (p < 0) p += 2 * n;
+		return(p < n ? p : 2 * n - 1 - p);
+	default:
+		return(-1);
+	}
+}
+
+//One trip through memory: s steps of the kernel from in to out, a tile at a time.
+template <typename T>
+struct _md_stencil_pass {
+	size_t dims[3], kdims[3], center[3], tiles[3];
+	unsigned int boundary, s;
+	bool separable;
+	const T* w;
+	size_t lo_halo[3], hi_halo[3];
+	char* p_in;
+	char* p_out;
+	//Byte offsets of the elements of in at indices -lo_halo to dims+hi_halo (boundary mode
+	//applied, MD_STENCIL_ZERO for zeros), and of out at indices 0 to dims.
+	std::vector<ptrdiff_t> in_tabs[3], out_tabs[3];
+	//For the innermost dimension: the end of the run of contiguous elements starting at
+	//each index.
+	std::vector<size_t> in_runs, out_runs;
+
+	void run(ARRAYLIKE in, ARRAYLIKE out, unsigned int n_dims);
+	void tile(size_t t, T* cur, T* nxt, std::vector<ptrdiff_t>& offs, std::vector<T>& taps) const;
+	void fix_boundary(T* buf, const size_t e[], const size_t a[], const size_t b[], const ptrdiff_t dom_lo[]) const;
+};
+
+//Fills runs[i] with the end of the run of consecutive elements of size sz starting at tab[i].
+static void _md_stencil_runs(const std::vector<ptrdiff_t>& tab, size_t sz, std::vector<size_t>& runs) {
+	size_t i = tab.size();
+
+	runs.resize(i);
+	while (i-- > 0) {
+		if (i + 1 < tab.size() && tab[i] != MD_STENCIL_ZERO && tab[i+1] == tab[i] + (ptrdiff_t)sz) runs[i] = runs[i+1];
+		else runs[i] = i + 1;
+	}
+}
+
+template <typename T>
+void _md_stencil_pass<T>::run(ARRAYLIKE in, ARRAYLIKE out, unsigned int n_dims) {
+	std::vector<ptrdiff_t> base;
+	size_t i, n_tiles = 1, buf_size = 1;
+	unsigned int k, lead = 3 - n_dims;
+	ptrdiff_t q;
+
+	p_in = md_getptr(in);
+	p_out = md_getptr(out);
+	for (k=0;k<3;k++) {
+		lo_halo[k] = s * center[k];
+		hi_halo[k] = s * (kdims[k] - 1 - center[k]);
+		in_tabs[k].resize(dims[k] + lo_halo[k] + hi_halo[k]);
+		out_tabs[k].resize(dims[k]);
+		if (k < lead) {
+			in_tabs[k][0] = out_tabs[k][0] = 0;
+		} else {
+			base.resize(dims[k]);
+			_md_axis_offsets(in, k - lead, dims[k], &base[0]);
+			for (i=0;i<in_tabs[k].size();i++) {
+				q = _md_boundary_index((ptrdiff_t)i - (ptrdiff_t)lo_halo[k], dims[k], boundary);
+				in_tabs[k][i] = q < 0 ? MD_STENCIL_ZERO : base[q];
+			}
+			_md_axis_offsets(out, k - lead, dims[k], &out_tabs[k][0]);
+		}
+		n_tiles *= tiles[k];
+		buf_size *= (dims[k] + tiles[k] - 1) / tiles[k] + lo_halo[k] + hi_halo[k];
+	}
+	_md_stencil_runs(in_tabs[2], sizeof(T), in_runs);
+	_md_stencil_runs(out_tabs[2], sizeof(T), out_runs);
+	md_parallel_for(n_tiles, 1, [&](size_t begin, size_t end) {
+		std::vector<T> bufs(2 * buf_size);
+		std::vector<ptrdiff_t> offs;
+		std::vector<T> taps;
+		size_t t;
+
+		for (t=begin;t<end;t++) tile(t, &bufs[0], &bufs[buf_size], offs, taps);
+	});
+}
+
+/* Between the steps of a temporal block, sets the elements of the valid region [a, b) of
+buf that lie beyond the edges of the array as the boundary mode says, from the elements of
+the array in the same buffer. dom_lo is the buffer coordinate of index 0 of each dimension.
+Periodic (MD_BOUNDARY_WRAP) halos need nothing: stepping the periodic extension of the array
+gives the periodic extension of the result.*/
+template <typename T>
+void _md_stencil_pass<T>::fix_boundary(T* buf, const size_t e[], const size_t a[], const size_t b[], const ptrdiff_t dom_lo[]) const {
+	size_t str[3] = {e[1] * e[2], e[2], 1}, q, i, j, n_row = b[2] - a[2];
+	unsigned int k, k1, k2;
+	ptrdiff_t m;
+	T* dst;
+	T* src;
+
+	for (k=0;k<3;k++) {
+		if (dom_lo[k] <= (ptrdiff_t)a[k] && dom_lo[k] + (ptrdiff_t)dims[k] >= (ptrdiff_t)b[k]) continue;
+		//The other two dimensions, outer first.
+		k1 = k == 0 ? 1 : 0;
+		k2 = k == 2 ? 1 : 2;
+		for (q=a[k];q<b[k];q++) {
+			if ((ptrdiff_t)q >= dom_lo[k] && (ptrdiff_t)q < dom_lo[k] + (ptrdiff_t)dims[k]) continue;
+			m = _md_boundary_index((ptrdiff_t)q - dom_lo[k], dims[k], boundary);
+			if (m >= 0) m += dom_lo[k];
+			for (i=a[k1];i<b[k1];i++) {
+				dst = buf + q * str[k] + i * str[k1] + a[k2] * str[k2];
+				src = buf + m * str[k] + i * str[k1] + a[k2] * str[k2];
+				if (k2 == 2) {
+					if (m < 0) memset(dst, 0, n_row * sizeof(T));
+					else memcpy(dst, src, n_row * sizeof(T));
+				} else {
+					for (j=0;j<b[k2]-a[k2];j++) dst[j * str[k2]] = m < 0 ? 0 : src[j * str[k2]];
+				}
+			}
+		}
+	}
+}
+
+template <typename T>
+void _md_stencil_pass<T>::tile(size_t t, T* cur, T* nxt, std::vector<ptrdiff_t>& offs, std::vector<T>& taps) const {
+	size_t lo[3], hi[3], e[3], a[3], b[3], str[3], y, z, i, n_taps, from, end;
+	ptrdiff_t dom_lo[3], row_off, kz, ky, kx;
+	unsigned int k, step, d;
+	const T* wk;
+	T* row;
+	T* tmp;
+
+	for (k=3;k-->0;) {
+		lo[k] = dims[k] * (t % tiles[k]) / tiles[k];
+		hi[k] = dims[k] * (t % tiles[k] + 1) / tiles[k];
+		t /= tiles[k];
+		e[k] = hi[k] - lo[k] + lo_halo[k] + hi_halo[k];
+		a[k] = 0;
+		b[k] = e[k];
+		dom_lo[k] = (ptrdiff_t)lo_halo[k] - (ptrdiff_t)lo[k];
+	}
+	str[0] = e[1] * e[2];
+	str[1] = e[2];
+	str[2] = 1;
+
+	//Load the tile and its halo; buffer coordinate c holds index lo+c-lo_halo.
+	for (z=0;z<e[0];z++) {
+		for (y=0;y<e[1];y++) {
+			row = cur + z * str[0] + y * str[1];
+			if (in_tabs[0][lo[0] + z] == MD_STENCIL_ZERO || in_tabs[1][lo[1] + y] == MD_STENCIL_ZERO) {
+				memset(row, 0, e[2] * sizeof(T));
+				continue;
+			}
+			row_off = in_tabs[0][lo[0] + z] + in_tabs[1][lo[1] + y];
+			for (i=lo[2],end=lo[2]+e[2];i<end;) {
+				if (in_tabs[2][i] == MD_STENCIL_ZERO) {
+					row[i - lo[2]] = 0;
+					i++;
+					continue;
+				}
+				from = i;
+				i = in_runs[i] < end ? in_runs[i] : end;
+				memcpy(row + from - lo[2], p_in + row_off + in_tabs[2][from], (i - from) * sizeof(T));
+			}
+		}
+	}
+
+	for (step=1;step<=s;step++) {
+		if (!separable) {
+			offs.clear();
+			taps.clear();
+			for (kz=0;kz<(ptrdiff_t)kdims[0];kz++) {
+				for (ky=0;ky<(ptrdiff_t)kdims[1];ky++) {
+					for (kx=0;kx<(ptrdiff_t)kdims[2];kx++) {
+						i = (kz * kdims[1] + ky) * kdims[2] + kx;
+						if (w[i] == 0) continue;
+						offs.push_back((kz - (ptrdiff_t)center[0]) * (ptrdiff_t)str[0] + (ky - (ptrdiff_t)center[1]) * (ptrdiff_t)str[1] + kx - (ptrdiff_t)center[2]);
+						taps.push_back(w[i]);
+					}
+				}
+			}
+			for (k=0;k<3;k++) {
+				a[k] += center[k];
+				b[k] -= kdims[k] - 1 - center[k];
+			}
+			n_taps = offs.size();
+			for (z=a[0];z<b[0];z++) {
+				for (y=a[1];y<b[1];y++) {
+					i = z * str[0] + y * str[1] + a[2];
+					if (n_taps) _md_stencil_kernel<T>::run(nxt + i, cur + i, &offs[0], &taps[0], n_taps, b[2] - a[2]);
+					else memset(nxt + i, 0, (b[2] - a[2]) * sizeof(T));
+				}
+			}
+			tmp = cur;
+			cur = nxt;
+			nxt = tmp;
+		} else {
+			//One dimension at a time, innermost first; the region shrinks along each in turn.
+			for (d=3;d-->0;) {
+				wk = w;
+				for (k=0;k<d;k++) wk += kdims[k];
+				if (kdims[d] == 1 && wk[0] == 1) continue;
+				offs.clear();
+				taps.clear();
+				for (i=0;i<kdims[d];i++) {
+					if (wk[i] == 0) continue;
+					offs.push_back(((ptrdiff_t)i - (ptrdiff_t)center[d]) * (ptrdiff_t)str[d]);
+					taps.push_back(wk[i]);
+				}
+				a[d] += center[d];
+				b[d] -= kdims[d] - 1 - center[d];
+				n_taps = offs.size();
+				for (z=a[0];z<b[0];z++) {
+					for (y=a[1];y<b[1];y++) {
+						i = z * str[0] + y * str[1] + a[2];
+						if (n_taps) _md_stencil_kernel<T>::run(nxt + i, cur + i, &offs[0], &taps[0], n_taps, b[2] - a[2]);
+						else memset(nxt + i, 0, (b[2] - a[2]) * sizeof(T));
+					}
+				}
+				tmp = cur;
+				cur = nxt;
+				nxt = tmp;
+			}
+		}
+		if (step < s && boundary != MD_BOUNDARY_WRAP) fix_boundary(cur, e, a, b, dom_lo);
+	}
+
+	//Only the tile itself is left valid; store it.
+	for (z=a[0];z<b[0];z++) {
+		for (y=a[1];y<b[1];y++) {
+			row = cur + z * str[0] + y * str[1] + a[2];
+			row_off = out_tabs[0][lo[0] + z - a[0]] + out_tabs[1][lo[1] + y - a[1]];
+			for (i=lo[2],end=hi[2];i<end;) {
+				from = i;
+				i = out_runs[i] < end ? out_runs[i] : end;
+				memcpy(p_out + row_off + out_tabs[2][from], row + from - lo[2], (i - from) * sizeof(T));
+			}
+		}
+	}
+}
+
+template <typename T>
+void md_stencil(ARRAYLIKE in, ARRAYLIKE out, const struct MD_KERNEL& kernel, unsigned int boundary, unsigned int steps, unsigned int time_block) {
+	size_t dims[MAX_DIMENSIONS], out_dims[MAX_DIMENSIONS], n_weights, min_width, i;
+	unsigned int n_dims = md_shape(in, dims), k, lead, s, n_passes, pass;
+	struct _md_stencil_pass<T> p;
+	struct MD_ARRAY* tmp = NULL;
+	std::vector<T> w;
+	ARRAYLIKE src;
+	ARRAYLIKE dst;
+
+	if (n_dims < 1 || n_dims > 3 || kernel.n_dims != n_dims) {
+		fputs("md_stencil: the arrays must have the rank of the kernel, 1, 2 or 3", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (md_shape(out, out_dims) != n_dims || memcmp(dims, out_dims, sizeof(size_t) * n_dims)) {
+		fputs("md_stencil: in and out must have the same shape", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (md_type_size(md_base(in)) != sizeof(T) || md_type_size(md_base(out)) != sizeof(T)) {
+		fputs("md_stencil: element size does not match the template type", stderr);
+		throw MULTIARRAY_EX();
+	}
+	if (boundary > MD_BOUNDARY_REFLECT || steps == 0) {
+		fputs("md_stencil: unknown boundary mode, or no steps", stderr);
+		throw MULTIARRAY_EX();
+	}
+	n_weights = kernel.separable ? 0 : 1;
+	for (k=0;k<n_dims;k++) {
+		if (kernel.dims[k] == 0 || kernel.center[k] >= kernel.dims[k]) {
+			fprintf(stderr, "md_stencil: dimension %u of the kernel is empty or its centre lies outside it\n", k);
+			throw MULTIARRAY_EX();
+		}
+		if (!dims[k]) return;
+		if (kernel.separable) n_weights += kernel.dims[k];
+		else n_weights *= kernel.dims[k];
+	}
+	w.resize(n_weights);
+	for (i=0;i<n_weights;i++) w[i] = (T)kernel.weights[i];
+
+	lead = 3 - n_dims;
+	s = time_block ? time_block : MD_STENCIL_TIME_BLOCK;
+	if (s > steps) s = steps;
+	for (k=0;k<3;k++) {
+		p.dims[k] = k < lead ? 1 : dims[k - lead];
+		p.kdims[k] = k < lead ? 1 : kernel.dims[k - lead];
+		p.center[k] = k < lead ? 0 : kernel.center[k - lead];
+		p.tiles[k] = (p.dims[k] + _md_stencil_tile[n_dims-1][k] - 1) / _md_stencil_tile[n_dims-1][k];
+		//The halo of a block of steps must stay within the neighbouring tile, where the
+		//elements its boundary mode reads are (see fix_boundary).
+		min_width = p.dims[k] / p.tiles[k];
+		i = p.center[k] > p.kdims[k] - 1 - p.center[k] ? p.center[k] : p.kdims[k] - 1 - p.center[k];
+		if (i && s > min_width / i) s = min_width / i > 1 ? (unsigned int)(min_width / i) : 1;
+	}
+	p.boundary = boundary;
+	p.separable = kernel.separable;
+	p.w = &w[0];
+	if (kernel.separable) {
+		//Leading dimensions the kernel lacks take the 1-D kernel {1}.
+		w.insert(w.begin(), lead, (T)1);
+		p.w = &w[0];
+	}
+
+	n_passes = (steps + s - 1) / s;
+	if (n_passes > 1) tmp = _md_alloc(dims, n_dims, sizeof(T));
+	src = in;
+	for (pass=0;pass<n_passes;pass++) {
+		//Alternate between out and tmp so that the last pass lands in out.
+		dst = (n_passes - 1 - pass) % 2 ? (ARRAYLIKE)tmp : out;
+		p.s = pass + 1 < n_passes ? s : steps - s * (n_passes - 1);
+		try {
+			p.run(src, dst, n_dims);
+		} catch (...) {
+			md_free(tmp);
+			throw;
+		}
+		src = dst;
+	}
+	md_free(tmp);
+}
+
+template void md_stencil<float>(ARRAYLIKE, ARRAYLIKE, const struct MD_KERNEL&, unsigned int, unsigned int, unsigned int);
+template void md_stencil<double>(ARRAYLIKE, ARRAYLIKE, const struct MD_KERNEL&, unsigned int, unsigned int, unsigned int);
@@ -8,26 +8,13 @@
 
 
 struct MD_ARRAY* transpose(struct MD_ARRAY* array) {
-	struct MD_ARRAY* array2;
-	unsigned i, j;
-	unsigned dims[2];
-
+	static const unsigned axes[] = {1, 0};
 
 	if (md_dims_n(array) != 2) {
 		fputs("transpose: need two dimensional array", stderr);
 		return(NULL);
 	}
-	dims[0] = md_dims_array(array)[1];
-	dims[1] = md_dims_array(array)[0];
-	array2 = _md_alloc(dims, 2, md_type_size(array));
-	for (i=0;i<dims[0];i++) {
-		for (j=0;j<dims[1];j++) {
-			memcpy(md_2d(array2, i, j, void), md_2d(array, j, i, void), md_type_size(array));
-		}
-	}
-	return(array2);
-
-
+	return(md_permute(array, axes));
 }
 
 int main() {